@@ -0,0 +1,99 @@
+#ifndef INC_DB_ARENA_H
+#define INC_DB_ARENA_H
+
+#include <string>
+#include <mutex>
+#include <ctime>
+#include <climits>
+#include <cstddef>
+
+using namespace std;
+
+// The arena is cut into slabs. A slab is either free, handed whole to the
+// segment engine, or cut into chunks of one size class for items. Segments
+// are never larger than a slab
+#define DB_ARENA_SLAB_SIZE (1024 * 1024)
+#define DB_ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define DB_ARENA_PREFAULT_STRIDE 4096
+// Chunk sizes start at MIN_CHUNK bytes and grow by GROWTH percent per class
+// up to a whole slab
+#define DB_ARENA_MIN_CHUNK 64
+#define DB_ARENA_GROWTH 125
+#define DB_ARENA_MAX_CLASSES 64
+// Bytes the allocator keeps in front of each block, on top of its usable size
+#define DB_ALLOC_HEADER_SIZE sizeof(size_t)
+// No slab, or no chunk
+#define DB_ARENA_NONE UINT_MAX
+#define DB_ARENA_FREE_CLASS -1
+#define DB_ARENA_WHOLE_CLASS -2
+// Marks an arena file written out by a clean shutdown. The version changes
+// whenever the layout of the file or of an item does
+#define DB_ARENA_MAGIC 0x6d656d7374617368ULL
+#define DB_ARENA_VERSION 9
+
+// A slab of the arena. Chunks are handed out from freeList, then from the
+// part of the slab not yet cut. Slabs of a class with chunks to spare are
+// linked through prev and next. isData is set for a slab handed out whole by
+// dbArenaAllocData, which holds no item, and isDraining for a slab whose items
+// are being freed to move it to another class, which is on no list. Slabs
+// are referred to by number and chunks by offset in their slab, so that a
+// file backed arena can be mapped at another address after a restart
+typedef struct
+{
+  unsigned int prev;
+  unsigned int next;
+  unsigned int freeList;
+  unsigned int carved;
+  unsigned int used;
+  int classNum;
+  unsigned int isData;
+  unsigned int isDraining;
+} DbArenaSlab;
+
+// A size class, guarded by its mutex. It is taken before gArenaMutex
+typedef struct
+{
+  mutex classMutex;
+  unsigned int chunkSize;
+  unsigned int partial;
+} DbArenaClass;
+
+// Kept at the end of the arena. A file backed arena is only used again if
+// the footer was written by a clean shutdown of the same layout. nonce marks
+// the items which were live at the shutdown, and clockStart is the absolute
+// time of relative time 0 of that run
+typedef struct
+{
+  unsigned long long int magic;
+  unsigned long long int nonce;
+  unsigned long long int arenaSize;
+  long long int clockStart;
+  unsigned int version;
+  unsigned int isClean;
+  unsigned int slabCount;
+  unsigned int classCount;
+  unsigned int itemHeaderSize;
+} DbArenaFooter;
+
+typedef bool (*DbArenaChunkFunc)(void *);
+
+void dbArenaInit ();
+bool dbArenaIsEnabled ();
+bool dbArenaIsRestored ();
+const DbArenaFooter *dbArenaGetFooter ();
+void *dbArenaTryAlloc (size_t size);
+void *dbArenaAlloc (size_t size);
+void *dbArenaTryAllocData (size_t size);
+void *dbArenaAllocData (size_t size);
+size_t dbArenaGetChunkSize (size_t size);
+void *dbArenaDrainSlab (size_t size, size_t &chunkSize);
+void dbArenaUndrainSlab (void *ptr, size_t chunkSize);
+void dbArenaFree (void *ptr);
+size_t dbArenaSize (const void *ptr);
+size_t dbArenaUsableSize (const void *ptr);
+void *dbArenaTakeSlab ();
+void dbArenaForEachChunk (DbArenaChunkFunc keepFunc);
+void dbArenaClose (unsigned long long int nonce, time_t clockStart);
+void dbArenaAppendStats (string &output);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef INC_DB_CLOCK_H
+#define INC_DB_CLOCK_H
+
+#include <atomic>
+#include <ctime>
+#include <climits>
+
+using namespace std;
+
+// Seconds since the server started, plus DB_CLOCK_BASE so that a time a few
+// seconds in the past is still above 0. 32 bits last for over a century
+typedef unsigned int RelTimeType;
+
+#define DB_CLOCK_BASE 2
+// Relative time of an item which never expires
+#define DB_CLOCK_NEVER UINT_MAX
+// How often the ticker thread reads the system clock, in milliseconds
+#define DB_CLOCK_TICK_MS 100
+
+extern atomic<RelTimeType> gClockNow;
+
+void dbClockInit ();
+time_t dbClockToAbsolute (RelTimeType relTime);
+RelTimeType dbClockFromAbsolute (time_t absTime);
+RelTimeType dbClockExpiry (unsigned long int seconds, RelTimeType now);
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbClockNow
+ *  Description:  Returns the current relative time. This is a load of the
+ *                value kept by the ticker thread, not a system call
+ * =============================================================================
+ */
+inline RelTimeType dbClockNow ()
+{
+  return gClockNow.load(memory_order_relaxed);
+}		/* -----  end of function dbClockNow  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbClockSecondsLeft
+ *  Description:  Converts the relative expiry of an item which has not expired
+ *                back into seconds from now, as a request would give it. 0
+ *                means that it never expires
+ * =============================================================================
+ */
+inline unsigned long int dbClockSecondsLeft (RelTimeType expiry, 
+    RelTimeType now)
+{
+  if (expiry == DB_CLOCK_NEVER)
+  {
+    return 0;
+  }
+  return (expiry > now) ? (expiry - now) : 1;
+}		/* -----  end of function dbClockSecondsLeft  ----- */
+
+#endif
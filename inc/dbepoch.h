@@ -0,0 +1,27 @@
+#ifndef INC_DB_EPOCH_H
+#define INC_DB_EPOCH_H
+
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <cstddef>
+
+using namespace std;
+
+// Threads that can be inside a read section at the same time. Threads beyond
+// this take the locked path
+#define DB_EPOCH_MAX_THREADS 1024
+// Retired blocks a thread collects before trying to free them. A thread
+// with fewer tries again when it ends a read section, and the evictor
+// frees what idle threads left behind
+#define DB_EPOCH_RECLAIM_THRESHOLD 64
+
+typedef void (*DbEpochFreeFunc)(void *);
+
+bool dbEpochEnter ();
+void dbEpochExit ();
+void dbEpochRetire (void *ptr, DbEpochFreeFunc freeFunc, size_t bytes);
+void dbEpochReclaimAll ();
+size_t dbEpochRetiredBytes ();
+
+#endif
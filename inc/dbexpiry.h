@@ -0,0 +1,45 @@
+#ifndef INC_DB_EXPIRY_H
+#define INC_DB_EXPIRY_H
+
+#include <vector>
+#include <cstddef>
+
+#include "dbitem.h"
+
+using namespace std;
+
+// Seconds covered by one turn of the wheel. Items expiring further out share
+// the buckets and are skipped till their turn comes
+#define DB_EXPIRY_WHEEL_SIZE 4096
+
+/*
+ * =============================================================================
+ *        Class:  DbExpiryWheel
+ *  Description:  Timer wheel of the items of a hash table which have an 
+ *                expiry. Every second has a bucket, and an item is linked into
+ *                the bucket of its expiry second through the expiry links in
+ *                its header. Reclaiming what expired since the last call is a
+ *                walk of the buckets of the seconds in between, instead of a
+ *                scan of the whole table. All calls are made with the lock of
+ *                the hash table held
+ * =============================================================================
+ */
+class DbExpiryWheel
+{
+  public:
+    DbExpiryWheel ();
+
+    void add (ItemStruct *item);
+    void remove (ItemStruct *item);
+    bool collectExpired (RelTimeType now, size_t maxItems,
+        vector<ItemStruct *> &items);
+    size_t size () const { return count; }
+
+  private:
+    vector<ItemStruct *> buckets;
+    // The first second whose bucket has not been walked
+    RelTimeType cursor;
+    size_t count;
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef INC_DB_EXT_H
+#define INC_DB_EXT_H
+
+#include <string>
+#include <cstddef>
+#include <climits>
+
+using namespace std;
+
+// Largest external storage file. Smaller files are used if the size given
+// with -X would not make at least DB_EXT_MIN_FILES of them
+#define DB_EXT_FILE_SIZE (64ULL * 1024 * 1024)
+#define DB_EXT_MIN_FILES 4
+// A file is compacted once fewer than SPARE_FILES are free. Its live values
+// are written out again if they are at most RESCUE_PERCENT of the file, and
+// dropped otherwise
+#define DB_EXT_SPARE_FILES 2
+#define DB_EXT_RESCUE_PERCENT 50
+// Bytes of values held in memory before they are written out together
+#define DB_EXT_WRITE_BUFFER (4 * 1024 * 1024)
+#define DB_EXT_NONE UINT_MAX
+
+// Where a value in external storage is. generation tells whether the file
+// still holds what it held when the value was written
+typedef struct
+{
+  unsigned int fileNum;
+  unsigned int generation;
+  unsigned long long int offset;
+} DbExtRef;
+
+// An external storage file. Values are appended from writeOffset on. The ones
+// before flushedOffset are in the file, and the rest still in the write
+// buffer. liveBytes and liveItems count the values in it which are still
+// stored, and readers the reads in progress; a free file is only written to
+// again once there are none
+typedef struct
+{
+  int fd;
+  unsigned int state;
+  unsigned int generation;
+  unsigned int readers;
+  unsigned long long int writeOffset;
+  unsigned long long int flushedOffset;
+  unsigned long long int liveBytes;
+  unsigned long int liveItems;
+} DbExtFile;
+
+enum dbExtFileState
+{
+  DB_EXT_FILE_FREE,
+  DB_EXT_FILE_WRITING,
+  DB_EXT_FILE_FULL,
+  DB_EXT_FILE_COMPACTING
+};
+
+void dbExtInit ();
+bool dbExtIsEnabled ();
+bool dbExtStage (const char *value, size_t len, DbExtRef &ref);
+void dbExtFlush ();
+bool dbExtRead (const DbExtRef &ref, size_t len, string &value);
+void dbExtRemove (const DbExtRef &ref, size_t len);
+bool dbExtPickCompaction (unsigned int &fileNum, bool &isRescued);
+bool dbExtIsInFile (const DbExtRef &ref, unsigned int fileNum);
+void dbExtReleaseFile (unsigned int fileNum);
+void dbExtAppendStats (string &output);
+
+#endif
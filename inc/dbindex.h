@@ -0,0 +1,83 @@
+#ifndef INC_DB_INDEX_H
+#define INC_DB_INDEX_H
+
+#include <string>
+#include <cstddef>
+#include <atomic>
+#include <vector>
+
+#include "dbitem.h"
+
+using namespace std;
+
+// Control byte values. A full slot holds the low 7 bits of the key hash
+#define DB_INDEX_CTRL_EMPTY   ((signed char)-128)
+#define DB_INDEX_CTRL_DELETED ((signed char)-2)
+#define DB_INDEX_GROUP_SIZE   16
+#define DB_INDEX_MIN_CAPACITY 16
+// Groups of the old table moved to the new one on each insert or erase
+// while the index is being resized
+#define DB_INDEX_MIGRATE_GROUPS 8
+
+// A table is a single allocation: this header, the slots, then the control
+// bytes. Readers load the table pointer once and get a consistent view
+typedef struct
+{
+  size_t capacity;
+  size_t count;
+  signed char *ctrl;
+  ItemStruct **slots;
+} DbIndexTable;
+
+/*
+ * =============================================================================
+ *        Class:  DbHashIndex
+ *  Description:  Open addressing hash index from key to item. Every slot has a
+ *                control byte holding a 7 bit fingerprint of the key hash. The
+ *                control bytes are probed a group of 16 at a time, so a miss is
+ *                usually decided without touching any item memory. 
+ *                The index grows incrementally: a full table is kept as the old
+ *                table while a few of its groups are moved into the new one on
+ *                every insert and erase. Lookups check both tables till the
+ *                move is over. Writers hold the lock of the shard owning the
+ *                index. Readers without the lock must be inside an epoch (see
+ *                dbepoch.h) and must validate what they read, as tables are
+ *                only retired, never freed under them.
+ * =============================================================================
+ */
+class DbHashIndex
+{
+  public:
+    DbHashIndex ();
+    ~DbHashIndex ();
+
+    ItemStruct **findSlot (const string &key, size_t hash) const;
+    ItemStruct **findItemSlot (const ItemStruct *item) const;
+    ItemStruct *find (const string &key, size_t hash) const;
+    void insert (ItemStruct *item);
+    void eraseSlot (ItemStruct **slot);
+    ItemStruct *sample (size_t randomValue) const;
+    size_t scan (size_t cursor, size_t count, 
+        vector<ItemStruct *> &items) const;
+    size_t size () const;
+    size_t getBytes () const;
+    bool isResizing () const { return oldTable.load() != NULL; }
+    unsigned long int getResizeCount () const { return resizeCount; }
+    unsigned long int getResizeUsec () const { return resizeUsec; }
+
+  private:
+    DbHashIndex (const DbHashIndex &);
+    DbHashIndex &operator= (const DbHashIndex &);
+
+    void startResize (size_t newCapacity);
+    void migrate (size_t groups);
+
+    atomic<DbIndexTable *> table;
+    atomic<DbIndexTable *> oldTable;
+    size_t growthLeft;
+    size_t migratePos;
+    unsigned long int resizeCount;
+    unsigned long int resizeUsec;
+};
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef INC_DB_ITEM_H
+#define INC_DB_ITEM_H
+
+#include <string>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+
+#include "dbclock.h"
+#include "dbarena.h"
+
+using namespace std;
+
+typedef string KeyType;
+typedef unsigned long int TimestampType;
+
+// A stored entry. The header is followed in the same allocation by the key,
+// the flags and the value, so that a hit touches a single block of memory.
+// prev and next link the item into a list of the replacement policy, and 
+// priority and frequency are kept by the policies ranking items by value.
+// expiryPrev and expiryNext link it into its bucket of the expiry wheel.
+// cost is the client's hint of how expensive the value is to recompute.
+// The value of an item with isExternal set is in external storage, and only
+// where it is there follows the flags (see dbext.h); valueLen stays the
+// length of the value. A value of rawLen bytes may be kept compressed with
+// zlib, valueLen being its compressed length; rawLen is 0 if it is not.
+// The value of an item with isChunked set is in a chain of chunks, and only
+// the chain follows the flags (see dbItemChain). The value of an item with
+// isNumeric set is a decimal number, kept as the uint64_t it stands for, so
+// that incr and decr need no parsing; valueLen is then its size. An item
+// with isStriped set as well is a counter incremented often enough from
+// several threads at once that it keeps its number in stripes (see
+// dbItemStripes). incrCount counts the incrs of a numeric item in the clock
+// tick incrTick, the low byte of the time, and contention how many of them
+// found the lock taken.
+// timestamp orders the item against flush_all, while accessTime and expiry
+// are relative times (see dbclock.h)
+typedef struct ItemStruct
+{
+  struct ItemStruct *prev;
+  struct ItemStruct *next;
+  struct ItemStruct *expiryPrev;
+  struct ItemStruct *expiryNext;
+  TimestampType timestamp;
+  unsigned long long int casUniq;
+  size_t hash;
+  double priority;
+  RelTimeType accessTime;
+  RelTimeType expiry;
+  unsigned int cost;
+  unsigned int frequency;
+  unsigned int valueLen;
+  unsigned int keyLen;
+  unsigned int flagsLen;
+  unsigned int rawLen;
+  unsigned char policyList;
+  unsigned char isExternal;
+  unsigned char isChunked;
+  unsigned char isNumeric;
+  unsigned char isStriped;
+  unsigned char contention;
+  unsigned char incrTick;
+  unsigned short incrCount;
+  char data[1];
+} ItemStruct;
+
+// A piece of a chunked value, taking up a chunk of the largest size class of
+// the arena. Its bytes are data[start] to data[start + used - 1], so that an
+// append fills the last piece from the front and a prepend the first one
+// from the back. next links the piece that follows
+typedef struct ItemChunk
+{
+  struct ItemChunk *next;
+  unsigned int start;
+  unsigned int used;
+  char data[1];
+} ItemChunk;
+
+#define DB_ITEM_CHUNK_SIZE DB_ARENA_SLAB_SIZE
+#define DB_ITEM_CHUNK_DATA (DB_ITEM_CHUNK_SIZE - offsetof(ItemChunk, data))
+
+// The pieces of a chunked value, in order. allocated is the bytes the
+// allocator handed out for them
+typedef struct
+{
+  ItemChunk *head;
+  ItemChunk *tail;
+  unsigned long int allocated;
+} ItemChunkChain;
+
+// Bytes kept after the flags of a chunked item, with room to align the chain
+#define DB_ITEM_CHAIN_SIZE \
+  (sizeof(ItemChunkChain) + alignof(ItemChunkChain) - 1)
+
+// A part of the number of a striped counter, in a cache line of its own so
+// that threads adding to different stripes do not contend. inflight counts
+// the adds to sum going on without the lock
+typedef struct
+{
+  alignas(64) uint64_t sum;
+  unsigned int inflight;
+} ItemStripe;
+
+// The stripes of a striped counter, whose number is the sum of theirs,
+// wrapping around like incr. Once sealed is set, nothing is added to them
+// without the lock any more
+#define DB_ITEM_STRIPES 16
+typedef struct
+{
+  alignas(64) unsigned int sealed;
+  ItemStripe stripe[DB_ITEM_STRIPES];
+} ItemStripes;
+
+// Bytes kept after the flags of a striped counter: the number once it is
+// folded back, and the pointer to the stripes with room to align it
+#define DB_ITEM_STRIPED_SIZE \
+  (sizeof(uint64_t) + sizeof(ItemStripes *) + alignof(ItemStripes *) - 1)
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbItemSize
+ *  Description:  Returns the number of bytes needed for an item with the given
+ *                key, flags and value lengths
+ * =============================================================================
+ */
+inline size_t dbItemSize (size_t keyLen, size_t flagsLen, size_t valueLen)
+{
+  return offsetof(ItemStruct, data) + keyLen + flagsLen + valueLen;
+}		/* -----  end of function dbItemSize  ----- */
+
+inline const char *dbItemKey (const ItemStruct *item)
+{
+  return item->data;
+}
+
+inline const char *dbItemFlags (const ItemStruct *item)
+{
+  return item->data + item->keyLen;
+}
+
+inline char *dbItemValue (ItemStruct *item)
+{
+  return item->data + item->keyLen + item->flagsLen;
+}
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbItemChain
+ *  Description:  Returns the chain of a chunked item. It is aligned, so that
+ *                readers not holding the lock never see half a pointer
+ * =============================================================================
+ */
+inline ItemChunkChain *dbItemChain (const ItemStruct *item)
+{
+  uintptr_t chain = (uintptr_t)(item->data + item->keyLen + item->flagsLen);
+  chain = (chain + alignof(ItemChunkChain) - 1) & 
+    ~(uintptr_t)(alignof(ItemChunkChain) - 1);
+  return (ItemChunkChain *)chain;
+}		/* -----  end of function dbItemChain  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbItemStripes
+ *  Description:  Returns where a striped counter keeps the pointer to its
+ *                stripes: aligned, after the number, so that folding the
+ *                counter back never overwrites it under a reader
+ * =============================================================================
+ */
+inline ItemStripes **dbItemStripes (const ItemStruct *item)
+{
+  uintptr_t stripes = (uintptr_t)(item->data + item->keyLen + 
+      item->flagsLen + sizeof(uint64_t));
+  stripes = (stripes + alignof(ItemStripes *) - 1) & 
+    ~(uintptr_t)(alignof(ItemStripes *) - 1);
+  return (ItemStripes **)stripes;
+}		/* -----  end of function dbItemStripes  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbItemNumber
+ *  Description:  Returns the number a numeric item stands for
+ * =============================================================================
+ */
+inline uint64_t dbItemNumber (ItemStruct *item)
+{
+  uint64_t number;
+  memcpy(&number, dbItemValue(item), sizeof(number));
+  return number;
+}		/* -----  end of function dbItemNumber  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbItemKeyEquals
+ *  Description:  Checks whether the item is stored under the given key
+ * =============================================================================
+ */
+inline bool dbItemKeyEquals (const ItemStruct *item, const string &key)
+{
+  return (item->keyLen == key.size()) &&
+    (memcmp(dbItemKey(item), key.data(), key.size()) == 0);
+}		/* -----  end of function dbItemKeyEquals  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbItemTouch
+ *  Description:  Sets the access time of the item. Readers not holding the
+ *                lock may do this, so the store is atomic
+ * =============================================================================
+ */
+inline void dbItemTouch (ItemStruct *item, RelTimeType accessTime)
+{
+  __atomic_store_n(&item->accessTime, accessTime, __ATOMIC_RELAXED);
+}		/* -----  end of function dbItemTouch  ----- */
+
+#endif
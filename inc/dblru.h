@@ -2,41 +2,92 @@
 #define INC_DB_LRU_H
 
 #include <iostream>
-#include <unordered_map>
-#include <set>
 #include <utility>
 #include <ctime>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
 #include <atomic>
 #include <string>
 #include <vector>
 #include <random>
 #include <climits>
+#include <cstdlib>
+#include <cctype>
+#include <sched.h>
+#include <functional>
+#include <zlib.h>
+
+#include "dbitem.h"
+#include "dbindex.h"
+#include "dbpolicy.h"
+#include "dbexpiry.h"
+#include "dbseg.h"
+#include "dbarena.h"
+#include "dbsnap.h"
+#include "dbext.h"
 
 using namespace std;
 
-extern atomic<unsigned int> gServMemLimit;
+extern atomic<unsigned long int> gServMemLimit;
+extern atomic<unsigned int> gServBumpWindow;
+extern atomic<unsigned int> gServEvictPolicy;
+extern atomic<unsigned int> gServCrawlerBudget;
+extern atomic<unsigned int> gServStorageEngine;
+extern atomic<unsigned int> gServEvictWatermark;
+extern atomic<bool> gServHugePages;
+extern atomic<bool> gServLockMemory;
+extern string gServMemFile;
+extern string gServSnapshotFile;
+extern atomic<unsigned int> gServSnapshotInterval;
+extern string gServExtPath;
+extern atomic<unsigned long int> gServExtSize;
+extern atomic<unsigned int> gServExtMinValue;
+extern atomic<unsigned int> gServCompressMin;
+extern atomic<unsigned int> gServChunkMin;
+extern atomic<unsigned int> gServStripeRate;
 
-typedef string KeyType;
-typedef unsigned long int TimestampType;
+// For getting the item from the key - no need to order this
+typedef DbHashIndex KeyToValueType;
 
-typedef struct 
+// Sequence count of a hash table for the readers which do not lock it. Padded
+// so that the counts of different tables do not share a cache line
+typedef struct
 {
-    TimestampType expiry;
-    string value;
-    string flags;
-    string casUniq;
-} ValueStruct;
+  alignas(64) atomic<unsigned long int> seq;
+} ShardSeqStruct;
 
-typedef struct 
+// Bytes of the items of a hash table, guarded by its lock: storedSize is what
+// was allocated for them and payloadSize the keys, flags and values in it.
+// unpublished is the part not yet added to the total. budget is the share of
+// the memory limit the table may use, and evictedBytes and victimAccess
+// record the pressure on it since budgets were last rebalanced.
+// compressedItems counts the items with compressed values, which take up
+// compressedSize bytes for rawSize bytes of values, and chunkedItems the
+// chunked items, whose chunks take up chunkedSize bytes. structSize is the
+// part of storedSize taken up by the index, the policy and the bump queue
+// of the table, as last measured. Padded like ShardSeqStruct
+typedef struct
 {
-  TimestampType timestamp;
-  KeyType key;
-} TimestampToKeyStruct;
-
-// For eviction in constant time
-typedef set<TimestampToKeyStruct, bool(*)(TimestampToKeyStruct, TimestampToKeyStruct)> TimestampToKeyType;
+  alignas(64) long int storedSize;
+  long int payloadSize;
+  long int unpublished;
+  long int budget;
+  long int evictedBytes;
+  RelTimeType victimAccess;
+  long int compressedItems;
+  long int compressedSize;
+  long int rawSize;
+  long int chunkedItems;
+  long int chunkedSize;
+  long int structSize;
+} ShardSizeStruct;
 
-// For getting the value from the key - no need to order this
-typedef unordered_map<KeyType,pair<ValueStruct,TimestampType> > KeyToValueType;
+unsigned long long int dbGetNewCas ();
+void dbAppendStat (string &output, const char *name, unsigned long int value);
+void dbWakeEvictor ();
+void dbShutdown ();
+size_t dbSnapshotScan (unsigned int hashTblNum, size_t cursor, 
+    string &buffer, unsigned long int &items);
 #endif
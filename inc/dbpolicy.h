@@ -0,0 +1,131 @@
+#ifndef INC_DB_POLICY_H
+#define INC_DB_POLICY_H
+
+#include <list>
+#include <set>
+#include <vector>
+#include <random>
+#include <unordered_map>
+#include <algorithm>
+#include <cstddef>
+
+#include "sconst.h"
+#include "dbitem.h"
+#include "dbindex.h"
+
+using namespace std;
+
+#define DB_POLICY_MAX_LISTS 3
+
+// A doubly linked list of items through the links in the item header
+typedef struct
+{
+  ItemStruct *head;
+  ItemStruct *tail;
+  size_t count;
+} DbItemList;
+
+/*
+ * =============================================================================
+ *        Class:  DbEvictPolicy
+ *  Description:  Cache replacement policy of a hash table. The policy keeps the
+ *                items of the table on its lists and is told about every
+ *                insert, access and removal. When memory is needed it picks
+ *                the item to be evicted. The policy does not free anything:
+ *                the caller removes the victim from the index and then calls
+ *                onRemove. An item can be swapped for a copy in its place
+ *                without counting as an access, and the items after a victim
+ *                can be walked to pass over ones the caller cannot use. All
+ *                calls are made with the lock of the hash table held. A policy
+ *                which does not keep an order of its items relies on the
+ *                access time the caller sets in the item. getBytes returns
+ *                the memory the policy takes up besides the links in the
+ *                items, for it to be charged to the hash table
+ * =============================================================================
+ */
+class DbEvictPolicy
+{
+  public:
+    DbEvictPolicy ();
+    virtual ~DbEvictPolicy () {}
+
+    virtual void onInsert (ItemStruct *item) = 0;
+    virtual void onAccess (ItemStruct *item) = 0;
+    virtual ItemStruct *chooseVictim () = 0;
+    virtual void onRemove (ItemStruct *item, bool isEvicted) = 0;
+    virtual void onReplace (ItemStruct *oldItem, ItemStruct *newItem);
+    virtual void onSwap (ItemStruct *oldItem, ItemStruct *newItem);
+    virtual ItemStruct *nextVictim (ItemStruct *victim);
+    virtual bool isAccessOrdered () const { return true; }
+    virtual size_t getBytes () const { return 0; }
+    size_t size () const;
+
+  protected:
+    void listPushHead (unsigned char listNum, ItemStruct *item);
+    void listRemove (ItemStruct *item);
+    void listMoveToHead (ItemStruct *item);
+
+    DbItemList lists[DB_POLICY_MAX_LISTS];
+
+  private:
+    DbEvictPolicy (const DbEvictPolicy &);
+    DbEvictPolicy &operator= (const DbEvictPolicy &);
+};
+
+/*
+ * =============================================================================
+ *        Class:  DbGhostList
+ *  Description:  Hashes of recently evicted keys, oldest first out. Used by the
+ *                policies which remember what they evicted
+ * =============================================================================
+ */
+class DbGhostList
+{
+  public:
+    void add (size_t hash);
+    bool remove (size_t hash);
+    void trim (size_t maxCount);
+    size_t size () const { return hashes.size(); }
+    size_t getBytes () const;
+
+  private:
+    list<size_t> hashes;
+    unordered_map<size_t, list<size_t>::iterator> positions;
+};
+
+/*
+ * =============================================================================
+ *        Class:  DbFrequencySketch
+ *  Description:  Count-min sketch of 4 bit counters estimating how often a key
+ *                has been seen. A doorkeeper bloom filter absorbs the first
+ *                occurrence of each key, so that one hit wonders do not take
+ *                up counters. All counts are halved after a sample period so
+ *                that old popularity fades
+ * =============================================================================
+ */
+class DbFrequencySketch
+{
+  public:
+    DbFrequencySketch ();
+
+    void increment (size_t hash);
+    unsigned int estimate (size_t hash) const;
+    void ensureCapacity (size_t count);
+    size_t getBytes () const;
+
+  private:
+    size_t counterIndex (size_t hash, unsigned int row) const;
+    size_t doorkeeperIndex (size_t hash) const;
+    void reset ();
+
+    vector<unsigned char> counters;
+    vector<unsigned long long int> doorkeeper;
+    size_t width;
+    unsigned int widthBits;
+    size_t additions;
+};
+
+DbEvictPolicy *dbCreateEvictPolicy (unsigned int policyType, 
+    const DbHashIndex *index);
+
+#endif
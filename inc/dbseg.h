@@ -0,0 +1,163 @@
+#ifndef INC_DB_SEG_H
+#define INC_DB_SEG_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+#include "dbitem.h"
+
+using namespace std;
+
+// Largest segment. Smaller segments are used if the memory limit would not
+// give at least DB_SEG_MIN_COUNT of them
+#define DB_SEG_SIZE (1024 * 1024)
+#define DB_SEG_MIN_COUNT 8
+// Segments of a TTL bucket merged into one when memory is needed
+#define DB_SEG_MERGE_COUNT 4
+// TTL buckets: 4 ranges of 256 buckets, 8, 128, 2048 and 32768 seconds wide,
+// then one bucket for longer TTLs and one for items which never expire
+#define DB_SEG_TTL_RANGES 4
+#define DB_SEG_TTL_RANGE_BUCKETS 256
+#define DB_SEG_TTL_FIRST_SHIFT 3
+#define DB_SEG_TTL_RANGE_SHIFT 4
+#define DB_SEG_TTL_BUCKETS (DB_SEG_TTL_RANGES * DB_SEG_TTL_RANGE_BUCKETS + 2)
+#define DB_SEG_MAX_FREQUENCY 127
+#define DB_SEG_INDEX_MIN_CAPACITY 16
+
+// An item in a segment. Items are appended one after the other, each padded
+// to 8 bytes. There are no list links: an item only lives as long as its
+// segment, and which items survive a merge is decided by frequency, the
+// number of reads since it was written or last merged
+typedef struct
+{
+  unsigned long long int casUniq;
+  RelTimeType expiry;
+  unsigned int valueLen;
+  unsigned char keyLen;
+  unsigned char flagsLen;
+  unsigned char frequency;
+  char data[1];
+} SegItemStruct;
+
+inline size_t dbSegItemSize (size_t keyLen, size_t flagsLen, size_t valueLen)
+{
+  return (offsetof(SegItemStruct, data) + keyLen + flagsLen + valueLen + 7) &
+    ~(size_t)7;
+}
+
+inline size_t dbSegItemSize (const SegItemStruct *item)
+{
+  return dbSegItemSize(item->keyLen, item->flagsLen, item->valueLen);
+}
+
+// The bytes of the key, flags and value, without the header and padding
+inline size_t dbSegItemPayload (const SegItemStruct *item)
+{
+  return item->keyLen + item->flagsLen + item->valueLen;
+}
+
+inline const char *dbSegItemKey (const SegItemStruct *item)
+{
+  return item->data;
+}
+
+inline const char *dbSegItemFlags (const SegItemStruct *item)
+{
+  return item->data + item->keyLen;
+}
+
+inline char *dbSegItemValue (SegItemStruct *item)
+{
+  return item->data + item->keyLen + item->flagsLen;
+}
+
+// A segment belongs to a TTL bucket while it is in use, and to the free pool
+// otherwise. writers counts the items reserved in it which are not yet in
+// the index; such a segment is neither merged nor freed
+typedef struct DbSegment
+{
+  char *data;
+  size_t used;
+  RelTimeType createTime;
+  RelTimeType maxExpiry;
+  unsigned int ttlBucket;
+  atomic<unsigned int> writers;
+  struct DbSegment *prev;
+  struct DbSegment *next;
+} DbSegment;
+
+typedef struct
+{
+  DbSegment *head;
+  DbSegment *tail;
+} DbSegChain;
+
+typedef struct
+{
+  size_t hash;
+  SegItemStruct *item;
+} SegSlotStruct;
+
+// What a store needs of the element already under its key: nothing, that
+// there is none (add), that there is one (replace), or that there is one with
+// the cas value given, which the new item keeps (touch)
+enum segStoreMode
+{
+  SEG_STORE_ANY,
+  SEG_STORE_ABSENT,
+  SEG_STORE_PRESENT,
+  SEG_STORE_TOUCH
+};
+
+/*
+ * =============================================================================
+ *        Class:  DbSegIndex
+ *  Description:  Hash index from key to the item in its segment. Linear
+ *                probing over slots holding the key hash and the item, with
+ *                entries shifted back on erase so that no tombstones build up.
+ *                Calls are made with the lock of the shard owning the index
+ * =============================================================================
+ */
+class DbSegIndex
+{
+  public:
+    DbSegIndex ();
+
+    SegSlotStruct *findSlot (const char *key, size_t keyLen, size_t hash);
+    void insert (SegItemStruct *item, size_t hash);
+    void eraseSlot (SegSlotStruct *slot);
+    void clear ();
+    size_t scan (size_t cursor, size_t count, 
+        vector<SegItemStruct *> &items) const;
+    size_t size () const { return count; }
+    size_t getBytes () const { return slots.size() * sizeof(SegSlotStruct); }
+
+  private:
+    void grow ();
+
+    vector<SegSlotStruct> slots;
+    size_t count;
+};
+
+void dbSegInit ();
+int dbSegInsertElement (const string &key, const string &flags,
+    const string &casUniq, const string &value,
+    const unsigned long int &expiry);
+int dbSegAddElement (const string &key, const string &flags,
+    const string &value, const unsigned long int &expiry);
+int dbSegReplaceElement (const string &key, const string &flags,
+    const string &value, const unsigned long int &expiry);
+int dbSegTouchElement (const string &key, unsigned long int expiry);
+int dbSegDeleteElement (const string &key, unsigned long int expiry);
+int dbSegGetElement (const string &key, string &flags, string &cas,
+    string &value, unsigned long int &expiry);
+void dbSegFlushAll ();
+bool dbSegCrawl ();
+void dbSegEvict ();
+size_t dbSegSnapshotScan (unsigned int shard, size_t cursor, string &buffer,
+    unsigned long int &items);
+void dbSegAppendStats (string &output);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef INC_DB_SNAP_H
+#define INC_DB_SNAP_H
+
+#include <string>
+#include <ctime>
+
+#include "sconst.h"
+
+using namespace std;
+
+// Marks a snapshot file. The version changes whenever its layout does
+#define DB_SNAP_MAGIC 0x6d656d736e617031ULL
+#define DB_SNAP_VERSION 1
+// Items copied out of a hash table per hold of its lock
+#define DB_SNAP_BATCH 256
+// Bytes a loader reads from the file at a time
+#define DB_SNAP_READ_SIZE (1024 * 1024)
+
+// Start of a snapshot file. The items of each hash table are written as one
+// section, so that a loader thread per section can read them back. The
+// header is written last, once all the sections are in the file
+typedef struct
+{
+  unsigned long long int magic;
+  unsigned int version;
+  unsigned int sectionCount;
+  long long int time;
+  unsigned long long int sectionOffset[DB_MAX_HASH_TABLES];
+  unsigned long long int sectionBytes[DB_MAX_HASH_TABLES];
+  unsigned long long int sectionItems[DB_MAX_HASH_TABLES];
+} DbSnapHeader;
+
+// An item in a section, followed by its key, flags and value. expiry is an
+// absolute time, 0 if the item never expires
+typedef struct
+{
+  long long int expiry;
+  unsigned int keyLen;
+  unsigned int flagsLen;
+  unsigned int valueLen;
+  unsigned int cost;
+} DbSnapRecord;
+
+void dbSnapAppendRecord (string &buffer, const char *key, unsigned int keyLen,
+    const char *flags, unsigned int flagsLen, const char *value,
+    unsigned int valueLen, time_t expiry, unsigned int cost);
+int dbSnapshotWrite ();
+void dbSnapshotInit ();
+void dbSnapshotAppendStats (string &output);
+
+#endif
@@ -11,6 +11,7 @@ typedef struct
   unsigned int bytes;
   string casStr;
   bool noreply;
+  unsigned int cost;
   string data;
 } StorageStruct;
 
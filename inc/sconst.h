@@ -1,12 +1,71 @@
 #ifndef INC_SERV_CONST_H
 #define INC_SERV_CONST_H
 
-#define VERSION_STRING "VERSION 1.0\r\n"
-#define SERV_DEF_MEM_LIMIT 7000
+#define VERSION_NUMBER "1.0"
+#define VERSION_STRING "VERSION " VERSION_NUMBER "\r\n"
+#define SERV_DEF_MEM_LIMIT (64UL * 1024 * 1024)
 #define SERV_DEF_LIST_PORT 11211
 #define SERV_DEF_ADDRESS "127.0.0.1"
 #define SERV_DEF_WORKER_THREADS 100
+// Bytes read off a connection at a time
+#define SERV_RECV_BUFFER (16 * 1024)
+#define SERV_DEF_BUMP_WINDOW 60
+#define SERV_DEF_CRAWLER_BUDGET 5
+#define SERV_DEF_EVICT_WATERMARK 90
+#define SERV_DEF_EXT_SIZE (1024UL * 1024 * 1024)
+#define SERV_DEF_EXT_MIN_VALUE 512
+// Values longer than this are kept in chunks (see dbitem.h). Short enough
+// for an item holding the whole value to fit the largest size class
+#define SERV_DEF_CHUNK_MIN (512 * 1024)
+// Incrs of a counter finding the lock taken, less those finding it free,
+// after which the counter is striped (see dbitem.h)
+#define SERV_DEF_STRIPE_RATE 1000
 #define DB_MAX_HASH_TABLES 10
+#define DB_OPTIMISTIC_READ_TRIES 4
+#define DB_BUMP_BATCH 32
+// Bumps a thread keeps buffered for at most this many seconds, and bumps
+// queued per hash table at most. More are dropped, as bumps are only hints
+#define DB_BUMP_MAX_AGE 1
+#define DB_BUMP_QUEUE_MAX 4096
+// Most elements evicted under one lock, and the longest the evictor sleeps
+// in milliseconds when not woken
+#define DB_EVICT_BATCH 32
+#define DB_EVICT_INTERVAL 100
+// Victims whose values cannot be moved out, which a move to external storage
+// passes over before leaving the rest to eviction
+#define DB_EXT_MAX_SKIPPED 64
+// Victims looked at for items of an arena size class that has run out of
+// chunks, and the times the epoch is moved on for them to be freed before
+// the memory comes from malloc
+#define DB_CLASS_EVICT_SCAN 256
+#define DB_CLASS_RECLAIM_TRIES 4
+// zlib level values of -z bytes or more are compressed at. The fastest, as
+// compression is paid for on every store
+#define DB_COMPRESS_LEVEL 1
+// An item an append has outgrown is allocated with a 1/DIV share of its size
+// to spare, so that the appends after it are done in place
+#define DB_APPEND_SLACK_DIV 4
+// Seconds between rebalances of the hash table budgets. A rebalance moves a
+// 1/STEP_DIV share of a table's initial budget, never leaving a table less
+// than a 1/MIN_DIV share, and takes from a table evicting only if what it
+// evicts is AGE_RATIO times as long unused as what the receiver evicts
+#define DB_BUDGET_INTERVAL 1
+#define DB_BUDGET_STEP_DIV 16
+#define DB_BUDGET_MIN_DIV 4
+#define DB_BUDGET_AGE_RATIO 2
+// Bytes a hash table may gain or lose before the change is added to the
+// total checked against the memory limit. The step is cut to a 1/DIV share of
+// the limit spread over the tables if that is smaller
+#define DB_STORED_SIZE_SLACK (64 * 1024)
+#define DB_STORED_SIZE_SLACK_DIV 16
+// Index slots the crawler looks at per batch, and its rest in milliseconds
+// after a pass over all the hash tables
+#define DB_CRAWL_BATCH 256
+#define DB_CRAWL_PASS_INTERVAL 1000
+// Cost hints of items. DB_ITEM_COST_KEEP keeps the cost of the item replaced
+#define DB_DEF_ITEM_COST 1
+#define DB_MAX_ITEM_COST 1000000000
+#define DB_ITEM_COST_KEEP 0xffffffffU
 #define EXPIRY_THRESHOLD 60*60*24*30
 #define TRUE             1
 #define FALSE            0
@@ -20,5 +79,23 @@ enum retStatus
   FAILURE
 };
 
+// The cache replacement policies which can be chosen at startup
+enum dbPolicyType
+{
+  DB_POLICY_LRU,
+  DB_POLICY_TINYLFU,
+  DB_POLICY_2Q,
+  DB_POLICY_ARC,
+  DB_POLICY_SAMPLED,
+  DB_POLICY_GDSF
+};
+
+// The storage engines which can be chosen at startup
+enum dbEngineType
+{
+  DB_ENGINE_LRU,
+  DB_ENGINE_SEGMENT
+};
+
 
 #endif
@@ -15,17 +15,40 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cctype>
+#include <climits>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <cerrno>
+#include <csignal>
 
 #include "sconst.h"
+#include "dbclock.h"
+#include "dbarena.h"
+#include "dbsnap.h"
+#include "dbext.h"
 #include "sprot.h"
 
 using namespace std;
-extern atomic<unsigned int> gServMemLimit;
+extern atomic<unsigned long int> gServMemLimit;
 extern atomic<unsigned int> gServListPort;
 extern atomic<unsigned int> gServWorkerThreads;
+extern atomic<unsigned int> gServBumpWindow;
+extern atomic<unsigned int> gServEvictPolicy;
+extern atomic<unsigned int> gServCrawlerBudget;
+extern atomic<unsigned int> gServStorageEngine;
+extern atomic<unsigned int> gServEvictWatermark;
+extern atomic<bool> gServHugePages;
+extern atomic<bool> gServLockMemory;
+extern string gServMemFile;
+extern string gServSnapshotFile;
+extern atomic<unsigned int> gServSnapshotInterval;
+extern string gServExtPath;
+extern atomic<unsigned long int> gServExtSize;
+extern atomic<unsigned int> gServExtMinValue;
+extern atomic<unsigned int> gServCompressMin;
+extern atomic<unsigned int> gServChunkMin;
+extern atomic<unsigned int> gServStripeRate;
 #endif
@@ -4,12 +4,21 @@
 #include "sinc.h"
 using namespace std;
 
+void dbInit ();
+void dbShutdown ();
 int dbInsertElement (const string &key, const string &flags, 
     const string &casUniq, const string &value, 
-    const unsigned long int &expiry);
+    const unsigned long int &expiry, unsigned int cost);
 int dbAddElement (const string &key, const string &flags, 
     const string &casUniq, const string &value, 
-    const unsigned long int &expiry);
+    const unsigned long int &expiry, unsigned int cost);
+int dbReplaceElement (const string &key, const string &flags, 
+    const string &casUniq, const string &value, 
+    const unsigned long int &expiry, unsigned int cost);
+int dbTouchElement (const string &key, unsigned long int expiry);
+int dbAppendElement (const string &key, const string &data, bool isPrepend);
+int dbIncrElement (const string &key, unsigned long long int delta, 
+    bool isDecr, unsigned long long int &result);
 int dbDeleteElement (const string &key, unsigned long int expiry);
 int dbGetElement (const string &key, string &flags, string &cas, string &value,
     unsigned long int &expiry);
@@ -17,5 +26,6 @@ void socketMain ();
 int cmdProcessCommand (string &input, string &output);
 void dbSetFlushAll (unsigned long int expiry);
 void dbHandleFlushAll ();
+void dbAppendStats (string &output);
 
 #endif
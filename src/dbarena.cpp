@@ -0,0 +1,851 @@
+/*==============================================================================
+ *
+ *       Filename:  dbarena.cpp
+ *
+ *    Description:  Item memory reserved up front. With -L the arena is mapped
+ *                  on huge pages, or with transparent huge pages asked for if
+ *                  there are none, and prefaulted, so that lookups take fewer
+ *                  TLB misses and no request waits on a page fault. With -k
+ *                  it is also locked into memory. With -R it is a shared
+ *                  mapping of a file, which a clean shutdown leaves behind for
+ *                  the next run to pick up. Items are cut from slabs of the
+ *                  arena by size class; without an arena, or once it is full,
+ *                  they come from malloc
+ *
+ * =============================================================================
+ */
+
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../inc/sconst.h"
+#include "../inc/dblru.h"
+#include "../inc/dbarena.h"
+
+// The slabs are followed by their descriptors, and the footer is at the very
+// end
+static char *gArenaBase = NULL;
+static size_t gArenaSize = 0;
+static bool gIsArenaHuge = false;
+static bool gIsArenaLocked = false;
+static bool gIsArenaFile = false;
+static bool gIsArenaRestored = false;
+static DbArenaSlab *gArenaSlabs = NULL;
+static unsigned int gArenaSlabCount = 0;
+static DbArenaFooter *gArenaFooter = NULL;
+static DbArenaClass gArenaClasses[DB_ARENA_MAX_CLASSES];
+static unsigned int gArenaClassCount = 0;
+// Slabs not in use, guarded by gArenaMutex
+static mutex gArenaMutex;
+static vector<unsigned int> gArenaFreeSlabs;
+static atomic<unsigned long int> gArenaSlabsUsed(0);
+static atomic<unsigned long int> gArenaFallbacks(0);
+static atomic<unsigned long int> gArenaSlabMoves(0);
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  mapArenaAnonymous
+ *  Description:  Maps the arena, on huge pages if there are any reserved.
+ *                Else it is aligned to a huge page and transparent huge pages
+ *                are asked for. Returns NULL if it cannot be mapped
+ * =============================================================================
+ */
+static char *mapArenaAnonymous (size_t size)
+{
+  void *base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (base != MAP_FAILED)
+  {
+    gIsArenaHuge = true;
+    return (char *)base;
+  }
+
+  base = mmap(NULL, size + DB_ARENA_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED)
+  {
+    return NULL;
+  }
+  // Huge pages are only used for aligned ranges
+  char *aligned = (char *)(((uintptr_t)base + DB_ARENA_HUGE_PAGE_SIZE - 1) &
+      ~(uintptr_t)(DB_ARENA_HUGE_PAGE_SIZE - 1));
+  size_t head = aligned - (char *)base;
+  if (head > 0)
+  {
+    munmap(base, head);
+  }
+  munmap(aligned + size, DB_ARENA_HUGE_PAGE_SIZE - head);
+  if (gServHugePages && (madvise(aligned, size, MADV_HUGEPAGE) != 0))
+  {
+    perror("madvise(MADV_HUGEPAGE) failed");
+  }
+  return aligned;
+}		/* -----  end of function mapArenaAnonymous  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  mapArenaFile
+ *  Description:  Maps the arena file given with -R, which should be on tmpfs
+ *                or hugetlbfs. A file of another size is cleared and resized.
+ *                Returns NULL if it cannot be mapped
+ * =============================================================================
+ */
+static char *mapArenaFile (size_t size)
+{
+  int fd = open(gServMemFile.c_str(), O_RDWR | O_CREAT, 0600);
+  if (fd < 0)
+  {
+    return NULL;
+  }
+  struct stat fileStat;
+  if ((fstat(fd, &fileStat) != 0) ||
+      ((fileStat.st_size != (off_t)size) &&
+       ((ftruncate(fd, 0) != 0) || (ftruncate(fd, size) != 0))))
+  {
+    close(fd);
+    return NULL;
+  }
+  void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+  {
+    return NULL;
+  }
+  if (gServHugePages && (madvise(base, size, MADV_HUGEPAGE) != 0))
+  {
+    perror("madvise(MADV_HUGEPAGE) failed");
+  }
+  return (char *)base;
+}		/* -----  end of function mapArenaFile  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  isFooterValid
+ *  Description:  Checks whether the footer was left by a clean shutdown of an
+ *                arena laid out the way this one is
+ * =============================================================================
+ */
+static bool isFooterValid (const DbArenaFooter *footer)
+{
+  return (footer->magic == DB_ARENA_MAGIC) &&
+    (footer->version == DB_ARENA_VERSION) &&
+    (footer->isClean == 1) &&
+    (footer->arenaSize == gArenaSize) &&
+    (footer->slabCount == gArenaSlabCount) &&
+    (footer->classCount == gArenaClassCount) &&
+    (footer->itemHeaderSize == offsetof(ItemStruct, data));
+}		/* -----  end of function isFooterValid  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  restoreSlabs
+ *  Description:  Rebuilds the free slabs and the lists of the size classes
+ *                from the slab descriptors, after a restart or for a new arena
+ *                whose descriptors have just been cleared
+ * =============================================================================
+ */
+static void restoreSlabs ()
+{
+  for (unsigned int slabNum = gArenaSlabCount; slabNum-- > 0; )
+  {
+    DbArenaSlab &slab = gArenaSlabs[slabNum];
+    slab.prev = DB_ARENA_NONE;
+    slab.next = DB_ARENA_NONE;
+    slab.isDraining = 0;
+    if (slab.classNum == DB_ARENA_FREE_CLASS)
+    {
+      gArenaFreeSlabs.push_back(slabNum);
+      continue;
+    }
+    gArenaSlabsUsed++;
+    if (slab.classNum < 0)
+    {
+      continue;
+    }
+    DbArenaClass &sizeClass = gArenaClasses[slab.classNum];
+    if ((slab.freeList != DB_ARENA_NONE) ||
+        (slab.carved + sizeClass.chunkSize <= DB_ARENA_SLAB_SIZE))
+    {
+      slab.next = sizeClass.partial;
+      if (sizeClass.partial != DB_ARENA_NONE)
+      {
+        gArenaSlabs[sizeClass.partial].prev = slabNum;
+      }
+      sizeClass.partial = slabNum;
+    }
+  }
+}		/* -----  end of function restoreSlabs  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaInit
+ *  Description:  Reserves the arena if -L, -k or -R was given. It is sized
+ *                for the memory limit plus a slab per size class, as the last
+ *                slab of each class is only partly used. An arena file left
+ *                by a clean shutdown is picked up as it is. Has to be called
+ *                once the command line options are parsed and the clock is
+ *                started, and before any item is allocated
+ * =============================================================================
+ */
+void dbArenaInit ()
+{
+  if (!gServHugePages && !gServLockMemory && gServMemFile.empty())
+  {
+    return;
+  }
+
+  unsigned int chunkSize = DB_ARENA_MIN_CHUNK;
+  while (gArenaClassCount < DB_ARENA_MAX_CLASSES)
+  {
+    if ((chunkSize >= DB_ARENA_SLAB_SIZE) ||
+        (gArenaClassCount == DB_ARENA_MAX_CLASSES - 1))
+    {
+      chunkSize = DB_ARENA_SLAB_SIZE;
+    }
+    gArenaClasses[gArenaClassCount].chunkSize = chunkSize;
+    gArenaClasses[gArenaClassCount].partial = DB_ARENA_NONE;
+    gArenaClassCount++;
+    if (chunkSize == DB_ARENA_SLAB_SIZE)
+    {
+      break;
+    }
+    chunkSize = ((chunkSize * DB_ARENA_GROWTH / 100) + 7) & ~7U;
+  }
+
+  gArenaSlabCount = (gServMemLimit + DB_ARENA_SLAB_SIZE - 1) /
+    DB_ARENA_SLAB_SIZE + gArenaClassCount;
+  size_t slabBytes = (size_t)gArenaSlabCount * DB_ARENA_SLAB_SIZE;
+  size_t size = slabBytes + gArenaSlabCount * sizeof(DbArenaSlab) +
+    sizeof(DbArenaFooter);
+  size = (size + DB_ARENA_HUGE_PAGE_SIZE - 1) &
+    ~(size_t)(DB_ARENA_HUGE_PAGE_SIZE - 1);
+  gIsArenaFile = !gServMemFile.empty();
+  char *base = gIsArenaFile ? mapArenaFile(size) : mapArenaAnonymous(size);
+  if (base == NULL)
+  {
+    perror("Could not reserve the item arena");
+    return;
+  }
+  gArenaSize = size;
+  gArenaSlabs = (DbArenaSlab *)(base + slabBytes);
+  gArenaFooter = (DbArenaFooter *)(base + size - sizeof(DbArenaFooter));
+
+  gIsArenaRestored = gIsArenaFile && isFooterValid(gArenaFooter);
+  if (!gIsArenaRestored)
+  {
+    for (unsigned int slabNum = 0; slabNum < gArenaSlabCount; slabNum++)
+    {
+      gArenaSlabs[slabNum].freeList = DB_ARENA_NONE;
+      gArenaSlabs[slabNum].carved = 0;
+      gArenaSlabs[slabNum].used = 0;
+      gArenaSlabs[slabNum].classNum = DB_ARENA_FREE_CLASS;
+      gArenaSlabs[slabNum].isData = 0;
+      gArenaSlabs[slabNum].isDraining = 0;
+    }
+    memset(gArenaFooter, 0, sizeof(DbArenaFooter));
+  }
+  restoreSlabs();
+  if (gIsArenaFile)
+  {
+    // Till the next clean shutdown the contents are not to be trusted
+    gArenaFooter->isClean = 0;
+    msync(base + (((char *)gArenaFooter - base) & ~(size_t)4095),
+        4096, MS_SYNC);
+  }
+
+  // Fault every page in now rather than on the first request touching it
+  volatile char *page = base;
+  for (size_t offset = 0; offset < size; offset += DB_ARENA_PREFAULT_STRIDE)
+  {
+    page[offset] = page[offset];
+  }
+  if (gServLockMemory)
+  {
+    gIsArenaLocked = (mlock(base, size) == 0);
+    if (!gIsArenaLocked)
+    {
+      perror("Could not lock the item arena");
+    }
+  }
+  gArenaBase = base;
+  cout<<"Reserved "<<size<<" bytes of item memory"<<
+    (gIsArenaHuge ? " on huge pages" : "")<<
+    (gIsArenaRestored ? ", restored from " : "")<<
+    (gIsArenaRestored ? gServMemFile : "")<<endl;
+}		/* -----  end of function dbArenaInit  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaIsEnabled
+ *  Description:  Checks whether item memory comes from the arena
+ * =============================================================================
+ */
+bool dbArenaIsEnabled ()
+{
+  return gArenaBase != NULL;
+}		/* -----  end of function dbArenaIsEnabled  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaIsRestored
+ *  Description:  Checks whether the arena holds the items of the last run
+ * =============================================================================
+ */
+bool dbArenaIsRestored ()
+{
+  return gIsArenaRestored;
+}		/* -----  end of function dbArenaIsRestored  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaGetFooter
+ *  Description:  Returns the footer the last run left, if restored
+ * =============================================================================
+ */
+const DbArenaFooter *dbArenaGetFooter ()
+{
+  return gArenaFooter;
+}		/* -----  end of function dbArenaGetFooter  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  getSlabNum
+ *  Description:  Returns the number of the slab holding a pointer,
+ *                DB_ARENA_NONE if it is not in the arena
+ * =============================================================================
+ */
+static unsigned int getSlabNum (const void *ptr)
+{
+  const char *p = (const char *)ptr;
+  if ((p < gArenaBase) ||
+      (p >= gArenaBase + (size_t)gArenaSlabCount * DB_ARENA_SLAB_SIZE))
+  {
+    return DB_ARENA_NONE;
+  }
+  return (p - gArenaBase) / DB_ARENA_SLAB_SIZE;
+}		/* -----  end of function getSlabNum  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  getSlabData
+ *  Description:  Returns the memory of a slab
+ * =============================================================================
+ */
+static char *getSlabData (unsigned int slabNum)
+{
+  return gArenaBase + (size_t)slabNum * DB_ARENA_SLAB_SIZE;
+}		/* -----  end of function getSlabData  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  takeSlab
+ *  Description:  Takes a free slab for the given class. Returns DB_ARENA_NONE
+ *                if the arena is used up
+ * =============================================================================
+ */
+static unsigned int takeSlab (int classNum)
+{
+  lock_guard<mutex> lock(gArenaMutex);
+  if (gArenaFreeSlabs.empty())
+  {
+    return DB_ARENA_NONE;
+  }
+  unsigned int slabNum = gArenaFreeSlabs.back();
+  gArenaFreeSlabs.pop_back();
+  DbArenaSlab &slab = gArenaSlabs[slabNum];
+  slab.prev = DB_ARENA_NONE;
+  slab.next = DB_ARENA_NONE;
+  slab.freeList = DB_ARENA_NONE;
+  slab.carved = 0;
+  slab.used = 0;
+  slab.classNum = classNum;
+  slab.isData = 0;
+  slab.isDraining = 0;
+  gArenaSlabsUsed++;
+  return slabNum;
+}		/* -----  end of function takeSlab  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaTakeSlab
+ *  Description:  Hands a whole slab to the caller for good. Used for segments.
+ *                Returns NULL if there is no arena or it is used up
+ * =============================================================================
+ */
+void *dbArenaTakeSlab ()
+{
+  if (gArenaBase == NULL)
+  {
+    return NULL;
+  }
+  unsigned int slabNum = takeSlab(DB_ARENA_WHOLE_CLASS);
+  return (slabNum == DB_ARENA_NONE) ? NULL : getSlabData(slabNum);
+}		/* -----  end of function dbArenaTakeSlab  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  getClassNum
+ *  Description:  Returns the smallest size class holding the given size, -1
+ *                if it is larger than a slab
+ * =============================================================================
+ */
+static int getClassNum (size_t size)
+{
+  for (unsigned int classNum = 0; classNum < gArenaClassCount; classNum++)
+  {
+    if (gArenaClasses[classNum].chunkSize >= size)
+    {
+      return classNum;
+    }
+  }
+  return -1;
+}		/* -----  end of function getClassNum  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  isSlabFull
+ *  Description:  Checks whether a slab has no chunk left to hand out
+ * =============================================================================
+ */
+static bool isSlabFull (const DbArenaSlab &slab, unsigned int chunkSize)
+{
+  return (slab.freeList == DB_ARENA_NONE) &&
+    (slab.carved + chunkSize > DB_ARENA_SLAB_SIZE);
+}		/* -----  end of function isSlabFull  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  unlinkSlab
+ *  Description:  Takes a slab off the list of its size class. The mutex of the
+ *                class must be held
+ * =============================================================================
+ */
+static void unlinkSlab (DbArenaClass &sizeClass, unsigned int slabNum)
+{
+  DbArenaSlab &slab = gArenaSlabs[slabNum];
+  if (slab.prev != DB_ARENA_NONE)
+  {
+    gArenaSlabs[slab.prev].next = slab.next;
+  }
+  else
+  {
+    sizeClass.partial = slab.next;
+  }
+  if (slab.next != DB_ARENA_NONE)
+  {
+    gArenaSlabs[slab.next].prev = slab.prev;
+  }
+  slab.prev = DB_ARENA_NONE;
+  slab.next = DB_ARENA_NONE;
+}		/* -----  end of function unlinkSlab  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  allocChunk
+ *  Description:  Cuts a chunk out of a slab of the size class, taking a new
+ *                slab if none has room. Returns NULL if the arena is used up
+ * =============================================================================
+ */
+static void *allocChunk (int classNum)
+{
+  DbArenaClass &sizeClass = gArenaClasses[classNum];
+  lock_guard<mutex> lock(sizeClass.classMutex);
+
+  unsigned int slabNum = sizeClass.partial;
+  if (slabNum == DB_ARENA_NONE)
+  {
+    slabNum = takeSlab(classNum);
+    if (slabNum == DB_ARENA_NONE)
+    {
+      return NULL;
+    }
+    sizeClass.partial = slabNum;
+  }
+
+  DbArenaSlab &slab = gArenaSlabs[slabNum];
+  char *chunk;
+  if (slab.freeList != DB_ARENA_NONE)
+  {
+    chunk = getSlabData(slabNum) + slab.freeList;
+    slab.freeList = *(unsigned int *)chunk;
+  }
+  else
+  {
+    chunk = getSlabData(slabNum) + slab.carved;
+    slab.carved += sizeClass.chunkSize;
+  }
+  slab.used++;
+  if (isSlabFull(slab, sizeClass.chunkSize))
+  {
+    // It goes back on the list once a chunk is freed
+    unlinkSlab(sizeClass, slabNum);
+  }
+  return chunk;
+}		/* -----  end of function allocChunk  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaTryAlloc
+ *  Description:  Allocates item memory from the arena only. Returns NULL if
+ *                there is no arena or its size class has no chunk to hand out
+ * =============================================================================
+ */
+void *dbArenaTryAlloc (size_t size)
+{
+  if (gArenaBase == NULL)
+  {
+    return NULL;
+  }
+  int classNum = getClassNum(size);
+  return (classNum < 0) ? NULL : allocChunk(classNum);
+}		/* -----  end of function dbArenaTryAlloc  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaAlloc
+ *  Description:  Allocates item memory, from the arena if there is one and it
+ *                has room, else from malloc. Returns NULL if there is no memory
+ * =============================================================================
+ */
+void *dbArenaAlloc (size_t size)
+{
+  void *chunk = dbArenaTryAlloc(size);
+  if (chunk != NULL)
+  {
+    return chunk;
+  }
+  if (gArenaBase != NULL)
+  {
+    gArenaFallbacks++;
+  }
+  return malloc(size);
+}		/* -----  end of function dbArenaAlloc  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaTryAllocData
+ *  Description:  Allocates memory of at most a slab which is not an item, such
+ *                as a piece of a chunked value, from the arena only. It takes
+ *                a whole slab of the largest class, marked so that
+ *                dbArenaForEachChunk never takes what a client wrote into it
+ *                for an item. Returns NULL if there is no arena or no free slab
+ * =============================================================================
+ */
+void *dbArenaTryAllocData (size_t size)
+{
+  if ((gArenaBase == NULL) || (size > DB_ARENA_SLAB_SIZE))
+  {
+    return NULL;
+  }
+  unsigned int slabNum = takeSlab(gArenaClassCount - 1);
+  if (slabNum == DB_ARENA_NONE)
+  {
+    return NULL;
+  }
+  // The one chunk is in use, so the slab is on no list of its class
+  DbArenaSlab &slab = gArenaSlabs[slabNum];
+  slab.carved = DB_ARENA_SLAB_SIZE;
+  slab.used = 1;
+  slab.isData = 1;
+  return getSlabData(slabNum);
+}		/* -----  end of function dbArenaTryAllocData  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaAllocData
+ *  Description:  Allocates memory which is not an item like
+ *                dbArenaTryAllocData, else from malloc. Returns NULL if there
+ *                is no memory
+ * =============================================================================
+ */
+void *dbArenaAllocData (size_t size)
+{
+  void *data = dbArenaTryAllocData(size);
+  if (data != NULL)
+  {
+    return data;
+  }
+  if (gArenaBase != NULL)
+  {
+    gArenaFallbacks++;
+  }
+  return malloc(size);
+}		/* -----  end of function dbArenaAllocData  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaGetChunkSize
+ *  Description:  Returns the size of the chunks the arena hands out for the
+ *                given size, 0 if there is no arena or the size is larger
+ *                than a slab
+ * =============================================================================
+ */
+size_t dbArenaGetChunkSize (size_t size)
+{
+  if (gArenaBase == NULL)
+  {
+    return 0;
+  }
+  int classNum = getClassNum(size);
+  return (classNum < 0) ? 0 : gArenaClasses[classNum].chunkSize;
+}		/* -----  end of function dbArenaGetChunkSize  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaFree
+ *  Description:  Releases memory from dbArenaAlloc. A slab left with no chunk
+ *                in use goes back to the arena for any size class
+ * =============================================================================
+ */
+void dbArenaFree (void *ptr)
+{
+  unsigned int slabNum = getSlabNum(ptr);
+  if (slabNum == DB_ARENA_NONE)
+  {
+    free(ptr);
+    return;
+  }
+
+  DbArenaSlab &slab = gArenaSlabs[slabNum];
+  DbArenaClass &sizeClass = gArenaClasses[slab.classNum];
+  lock_guard<mutex> lock(sizeClass.classMutex);
+  bool wasListed = !slab.isDraining && !isSlabFull(slab, sizeClass.chunkSize);
+  *(unsigned int *)ptr = slab.freeList;
+  slab.freeList = (char *)ptr - getSlabData(slabNum);
+  slab.used--;
+
+  if (slab.used == 0)
+  {
+    if (wasListed)
+    {
+      unlinkSlab(sizeClass, slabNum);
+    }
+    if (slab.isDraining)
+    {
+      gArenaSlabMoves++;
+    }
+    slab.isDraining = 0;
+    slab.classNum = DB_ARENA_FREE_CLASS;
+    lock_guard<mutex> arenaLock(gArenaMutex);
+    gArenaFreeSlabs.push_back(slabNum);
+    gArenaSlabsUsed--;
+  }
+  else if (!wasListed && !slab.isDraining)
+  {
+    slab.prev = DB_ARENA_NONE;
+    slab.next = sizeClass.partial;
+    if (sizeClass.partial != DB_ARENA_NONE)
+    {
+      gArenaSlabs[sizeClass.partial].prev = slabNum;
+    }
+    sizeClass.partial = slabNum;
+  }
+}		/* -----  end of function dbArenaFree  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaDrainSlab
+ *  Description:  Picks the slab of items with the fewest chunks in use out of
+ *                the size classes other than the one of the given size, for
+ *                the caller to free its items so that it goes back to the
+ *                arena for that class. No chunk is cut out of it till
+ *                dbArenaUndrainSlab. Returns the start of the slab and sets
+ *                chunkSize to the size of its chunks, or returns NULL if there
+ *                is no such slab
+ * =============================================================================
+ */
+void *dbArenaDrainSlab (size_t size, size_t &chunkSize)
+{
+  if (gArenaBase == NULL)
+  {
+    return NULL;
+  }
+  int keptClass = getClassNum(size);
+  unsigned int bestSlab = DB_ARENA_NONE;
+  unsigned int bestUsed = UINT_MAX;
+  int bestClass = DB_ARENA_FREE_CLASS;
+  for (int classNum = 0; classNum < (int)gArenaClassCount; classNum++)
+  {
+    if (classNum == keptClass)
+    {
+      continue;
+    }
+    lock_guard<mutex> lock(gArenaClasses[classNum].classMutex);
+    for (unsigned int slabNum = 0; slabNum < gArenaSlabCount; slabNum++)
+    {
+      const DbArenaSlab &slab = gArenaSlabs[slabNum];
+      if ((slab.classNum == classNum) && !slab.isData && !slab.isDraining &&
+          (slab.used > 0) && (slab.used < bestUsed))
+      {
+        bestSlab = slabNum;
+        bestUsed = slab.used;
+        bestClass = classNum;
+      }
+    }
+  }
+  if (bestSlab == DB_ARENA_NONE)
+  {
+    return NULL;
+  }
+
+  // The slab may have changed since its class was let go
+  DbArenaClass &sizeClass = gArenaClasses[bestClass];
+  lock_guard<mutex> lock(sizeClass.classMutex);
+  DbArenaSlab &slab = gArenaSlabs[bestSlab];
+  if ((slab.classNum != bestClass) || slab.isData || slab.isDraining || 
+      (slab.used == 0))
+  {
+    return NULL;
+  }
+  if (!isSlabFull(slab, sizeClass.chunkSize))
+  {
+    unlinkSlab(sizeClass, bestSlab);
+  }
+  slab.isDraining = 1;
+  chunkSize = sizeClass.chunkSize;
+  return getSlabData(bestSlab);
+}		/* -----  end of function dbArenaDrainSlab  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaUndrainSlab
+ *  Description:  Lets chunks be cut out of a slab from dbArenaDrainSlab again,
+ *                if some of its chunks are still in use
+ * =============================================================================
+ */
+void dbArenaUndrainSlab (void *ptr, size_t chunkSize)
+{
+  unsigned int slabNum = getSlabNum(ptr);
+  int classNum = getClassNum(chunkSize);
+  DbArenaClass &sizeClass = gArenaClasses[classNum];
+  lock_guard<mutex> lock(sizeClass.classMutex);
+  DbArenaSlab &slab = gArenaSlabs[slabNum];
+  if ((slab.classNum != classNum) || !slab.isDraining)
+  {
+    return;
+  }
+  slab.isDraining = 0;
+  if (!isSlabFull(slab, sizeClass.chunkSize))
+  {
+    slab.prev = DB_ARENA_NONE;
+    slab.next = sizeClass.partial;
+    if (sizeClass.partial != DB_ARENA_NONE)
+    {
+      gArenaSlabs[sizeClass.partial].prev = slabNum;
+    }
+    sizeClass.partial = slabNum;
+  }
+}		/* -----  end of function dbArenaUndrainSlab  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaSize
+ *  Description:  Returns the bytes really taken by memory from dbArenaAlloc:
+ *                the chunk size, or for malloc the usable size plus its header
+ * =============================================================================
+ */
+size_t dbArenaSize (const void *ptr)
+{
+  unsigned int slabNum = getSlabNum(ptr);
+  if (slabNum == DB_ARENA_NONE)
+  {
+    return malloc_usable_size((void *)ptr) + DB_ALLOC_HEADER_SIZE;
+  }
+  // The class of a slab does not change while a chunk of it is in use
+  return gArenaClasses[gArenaSlabs[slabNum].classNum].chunkSize;
+}		/* -----  end of function dbArenaSize  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaUsableSize
+ *  Description:  Returns the bytes of memory from dbArenaAlloc which may be
+ *                used, at least the size asked for
+ * =============================================================================
+ */
+size_t dbArenaUsableSize (const void *ptr)
+{
+  unsigned int slabNum = getSlabNum(ptr);
+  if (slabNum == DB_ARENA_NONE)
+  {
+    return malloc_usable_size((void *)ptr);
+  }
+  return gArenaClasses[gArenaSlabs[slabNum].classNum].chunkSize;
+}		/* -----  end of function dbArenaUsableSize  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaForEachChunk
+ *  Description:  Calls keepFunc with every chunk in use which may be an item,
+ *                and frees the chunks it returns false for. The slabs from
+ *                dbArenaAllocData are freed unseen. Used to find the items of
+ *                the last run before any request is served
+ * =============================================================================
+ */
+void dbArenaForEachChunk (DbArenaChunkFunc keepFunc)
+{
+  for (unsigned int slabNum = 0; slabNum < gArenaSlabCount; slabNum++)
+  {
+    DbArenaSlab &slab = gArenaSlabs[slabNum];
+    if (slab.classNum < 0)
+    {
+      continue;
+    }
+    if (slab.isData)
+    {
+      dbArenaFree(getSlabData(slabNum));
+      continue;
+    }
+    unsigned int chunkSize = gArenaClasses[slab.classNum].chunkSize;
+    unsigned int carved = slab.carved;
+    char *data = getSlabData(slabNum);
+    vector<bool> isFree(carved / chunkSize, false);
+    for (unsigned int offset = slab.freeList; offset != DB_ARENA_NONE;
+        offset = *(unsigned int *)(data + offset))
+    {
+      isFree[offset / chunkSize] = true;
+    }
+    // The slab may be given back by the last free, so only the copies of its
+    // fields are used
+    for (unsigned int offset = 0; offset < carved; offset += chunkSize)
+    {
+      if (!isFree[offset / chunkSize] && !keepFunc(data + offset))
+      {
+        dbArenaFree(data + offset);
+      }
+    }
+  }
+}		/* -----  end of function dbArenaForEachChunk  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaClose
+ *  Description:  Writes the footer of a file backed arena and flushes it, so
+ *                that the next run picks the items up. The mutexes of the
+ *                arena are taken and kept, as the server is about to exit
+ * =============================================================================
+ */
+void dbArenaClose (unsigned long long int nonce, time_t clockStart)
+{
+  if (!gIsArenaFile || (gArenaBase == NULL))
+  {
+    return;
+  }
+  for (unsigned int classNum = 0; classNum < gArenaClassCount; classNum++)
+  {
+    gArenaClasses[classNum].classMutex.lock();
+  }
+  gArenaMutex.lock();
+
+  gArenaFooter->magic = DB_ARENA_MAGIC;
+  gArenaFooter->version = DB_ARENA_VERSION;
+  gArenaFooter->arenaSize = gArenaSize;
+  gArenaFooter->slabCount = gArenaSlabCount;
+  gArenaFooter->classCount = gArenaClassCount;
+  gArenaFooter->itemHeaderSize = offsetof(ItemStruct, data);
+  gArenaFooter->nonce = nonce;
+  gArenaFooter->clockStart = clockStart;
+  gArenaFooter->isClean = 1;
+  msync(gArenaBase, gArenaSize, MS_SYNC);
+}		/* -----  end of function dbArenaClose  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbArenaAppendStats
+ *  Description:  Appends the stats of the arena to the output of the stats
+ *                command
+ * =============================================================================
+ */
+void dbArenaAppendStats (string &output)
+{
+  if (gArenaBase == NULL)
+  {
+    return;
+  }
+  dbAppendStat(output, "arena_bytes", gArenaSize);
+  dbAppendStat(output, "arena_huge_pages", gIsArenaHuge ? 1 : 0);
+  dbAppendStat(output, "arena_locked", gIsArenaLocked ? 1 : 0);
+  dbAppendStat(output, "arena_restored", gIsArenaRestored ? 1 : 0);
+  dbAppendStat(output, "arena_slabs", gArenaSlabCount);
+  dbAppendStat(output, "arena_slabs_used", gArenaSlabsUsed);
+  dbAppendStat(output, "arena_slab_moves", gArenaSlabMoves);
+  dbAppendStat(output, "arena_fallbacks", gArenaFallbacks);
+}		/* -----  end of function dbArenaAppendStats  ----- */
@@ -0,0 +1,112 @@
+/*==============================================================================
+ *
+ *       Filename:  dbclock.cpp
+ *
+ *    Description:  Coarse clock of the server. A ticker thread keeps the time
+ *                  in seconds since startup, so that requests read a shared
+ *                  value instead of calling time()
+ *
+ * =============================================================================
+ */
+
+#include <thread>
+#include <chrono>
+
+#include "../inc/dbclock.h"
+
+atomic<RelTimeType> gClockNow(DB_CLOCK_BASE);
+// Absolute time of relative time 0
+static time_t gClockStart = 0;
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  clockTick
+ *  Description:  Reads the system clock into the relative time. The relative
+ *                time never goes back, even if the system clock does
+ * =============================================================================
+ */
+static void clockTick ()
+{
+  time_t curSystemTime;
+  time(&curSystemTime);
+  if (curSystemTime > gClockStart + (time_t)gClockNow.load())
+  {
+    gClockNow.store(curSystemTime - gClockStart, memory_order_relaxed);
+  }
+}		/* -----  end of function clockTick  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  clockMain
+ *  Description:  The ticker thread
+ * =============================================================================
+ */
+static void clockMain ()
+{
+  while (true)
+  {
+    this_thread::sleep_for(chrono::milliseconds(DB_CLOCK_TICK_MS));
+    clockTick();
+  }
+}		/* -----  end of function clockMain  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbClockInit
+ *  Description:  Starts the clock. Has to be called before anything reads it
+ * =============================================================================
+ */
+void dbClockInit ()
+{
+  time_t curSystemTime;
+  time(&curSystemTime);
+  gClockStart = curSystemTime - DB_CLOCK_BASE;
+  gClockNow = DB_CLOCK_BASE;
+  thread(clockMain).detach();
+}		/* -----  end of function dbClockInit  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbClockToAbsolute
+ *  Description:  Converts a relative time into seconds since the epoch
+ * =============================================================================
+ */
+time_t dbClockToAbsolute (RelTimeType relTime)
+{
+  return gClockStart + relTime;
+}		/* -----  end of function dbClockToAbsolute  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbClockFromAbsolute
+ *  Description:  Converts seconds since the epoch into a relative time. Times
+ *                before relative time 0 become 0, and times too far ahead to
+ *                be told from never become the last time before it
+ * =============================================================================
+ */
+RelTimeType dbClockFromAbsolute (time_t absTime)
+{
+  if (absTime <= gClockStart)
+  {
+    return 0;
+  }
+  if (absTime - gClockStart >= (time_t)(DB_CLOCK_NEVER - 1))
+  {
+    return DB_CLOCK_NEVER - 1;
+  }
+  return absTime - gClockStart;
+}		/* -----  end of function dbClockFromAbsolute  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbClockExpiry
+ *  Description:  Converts the expiry of a request, in seconds from now with 0
+ *                meaning never, into the relative time the item expires at
+ * =============================================================================
+ */
+RelTimeType dbClockExpiry (unsigned long int seconds, RelTimeType now)
+{
+  if (seconds == 0)
+  {
+    return DB_CLOCK_NEVER;
+  }
+  if (seconds >= (unsigned long int)(DB_CLOCK_NEVER - 1 - now))
+  {
+    return DB_CLOCK_NEVER - 1;
+  }
+  return now + seconds;
+}		/* -----  end of function dbClockExpiry  ----- */
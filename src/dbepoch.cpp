@@ -0,0 +1,222 @@
+/*==============================================================================
+ *
+ *       Filename:  dbepoch.cpp
+ *
+ *    Description:  Epoch based memory reclamation. Readers which do not take
+ *                  the shard locks announce the epoch they started in, and
+ *                  memory unlinked by writers is only freed once every such
+ *                  reader has moved past the epoch it was unlinked in
+ *
+ * =============================================================================
+ */
+
+#include "../inc/dbepoch.h"
+
+#define DB_EPOCH_INACTIVE (~0UL)
+
+// One slot per thread, padded so that readers never share a cache line
+typedef struct
+{
+  alignas(64) atomic<unsigned long int> epoch;
+} EpochSlotStruct;
+
+typedef struct
+{
+  void *ptr;
+  DbEpochFreeFunc freeFunc;
+  size_t bytes;
+  unsigned long int epoch;
+} RetiredStruct;
+
+// The blocks retired by the thread of a slot. The lock is only contended
+// when dbEpochReclaimAll frees them for an idle thread. count is the size
+// of the list, for checking it without the lock
+typedef struct
+{
+  mutex lock;
+  vector<RetiredStruct> list;
+  atomic<unsigned int> count;
+} RetiredListStruct;
+
+static atomic<unsigned long int> gEpoch(1);
+static atomic<unsigned int> gEpochSlotsUsed(0);
+static EpochSlotStruct gEpochSlots[DB_EPOCH_MAX_THREADS];
+// One list per slot, and a last one shared by the threads without a slot
+static RetiredListStruct gRetiredLists[DB_EPOCH_MAX_THREADS + 1];
+// Bytes of the blocks retired and not freed yet, over all the lists
+static atomic<size_t> gRetiredBytes(0);
+// -1 till the thread registers, -2 if there was no slot left for it
+static thread_local int tEpochSlot = -1;
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  getEpochSlot
+ *  Description:  Returns the slot of the calling thread, registering it on the
+ *                first call. Returns a negative value if all the slots are taken
+ * =============================================================================
+ */
+static int getEpochSlot ()
+{
+  if (tEpochSlot != -1)
+  {
+    return tEpochSlot;
+  }
+  unsigned int slot = gEpochSlotsUsed++;
+  if (slot >= DB_EPOCH_MAX_THREADS)
+  {
+    tEpochSlot = -2;
+    return tEpochSlot;
+  }
+  gEpochSlots[slot].epoch.store(DB_EPOCH_INACTIVE);
+  tEpochSlot = slot;
+  return tEpochSlot;
+}		/* -----  end of function getEpochSlot  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbEpochEnter
+ *  Description:  Starts a read section. Memory reachable from the shards when
+ *                the section starts stays valid till dbEpochExit. Returns 
+ *                false if the thread could not get a slot, in which case the
+ *                caller has to use the locks
+ * =============================================================================
+ */
+bool dbEpochEnter ()
+{
+  int slot = getEpochSlot();
+  if (slot < 0)
+  {
+    return false;
+  }
+  // The store has to be visible before any shared pointer is read
+  gEpochSlots[slot].epoch.store(gEpoch.load(), memory_order_seq_cst);
+  return true;
+}		/* -----  end of function dbEpochEnter  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  reclaimRetiredLocked
+ *  Description:  Frees the blocks in the retired list before the oldest epoch
+ *                any reader is still in. The global epoch is moved on once
+ *                every reader has seen it. The lock of the list must be held
+ * =============================================================================
+ */
+static void reclaimRetiredLocked (RetiredListStruct &retired)
+{
+  unsigned long int curEpoch = gEpoch.load();
+  unsigned long int minEpoch = curEpoch;
+  unsigned int slotsUsed = gEpochSlotsUsed.load();
+  if (slotsUsed > DB_EPOCH_MAX_THREADS)
+  {
+    slotsUsed = DB_EPOCH_MAX_THREADS;
+  }
+  for (unsigned int slot = 0; slot < slotsUsed; slot++)
+  {
+    unsigned long int epoch = gEpochSlots[slot].epoch.load();
+    if (epoch < minEpoch)
+    {
+      minEpoch = epoch;
+    }
+  }
+  if (minEpoch == curEpoch)
+  {
+    gEpoch.compare_exchange_strong(curEpoch, curEpoch + 1);
+  }
+
+  vector<RetiredStruct> &list = retired.list;
+  unsigned int kept = 0;
+  size_t freedBytes = 0;
+  for (unsigned int i = 0; i < list.size(); i++)
+  {
+    if (list[i].epoch < minEpoch)
+    {
+      list[i].freeFunc(list[i].ptr);
+      freedBytes += list[i].bytes;
+    }
+    else
+    {
+      list[kept++] = list[i];
+    }
+  }
+  list.resize(kept);
+  retired.count.store(kept, memory_order_relaxed);
+  gRetiredBytes -= freedBytes;
+}		/* -----  end of function reclaimRetiredLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbEpochExit
+ *  Description:  Ends the read section started by dbEpochEnter. Blocks the
+ *                thread retired are freed if they can be by now, so that they
+ *                do not wait for it to retire more
+ * =============================================================================
+ */
+void dbEpochExit ()
+{
+  gEpochSlots[tEpochSlot].epoch.store(DB_EPOCH_INACTIVE, memory_order_release);
+  RetiredListStruct &retired = gRetiredLists[tEpochSlot];
+  if (retired.count.load(memory_order_relaxed) > 0)
+  {
+    lock_guard<mutex> lock(retired.lock);
+    reclaimRetiredLocked(retired);
+  }
+}		/* -----  end of function dbEpochExit  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbEpochRetire
+ *  Description:  Hands over a block of the given bytes that has been unlinked
+ *                from the shards. It is freed with freeFunc once no reader can
+ *                still be using it
+ * =============================================================================
+ */
+void dbEpochRetire (void *ptr, DbEpochFreeFunc freeFunc, size_t bytes)
+{
+  RetiredStruct retired;
+  retired.ptr = ptr;
+  retired.freeFunc = freeFunc;
+  retired.bytes = bytes;
+  retired.epoch = gEpoch.load();
+  gRetiredBytes += bytes;
+  int slot = getEpochSlot();
+  RetiredListStruct &list = 
+    gRetiredLists[(slot < 0) ? DB_EPOCH_MAX_THREADS : slot];
+  lock_guard<mutex> lock(list.lock);
+  list.list.push_back(retired);
+  list.count.store(list.list.size(), memory_order_relaxed);
+  if (list.list.size() >= DB_EPOCH_RECLAIM_THRESHOLD)
+  {
+    reclaimRetiredLocked(list);
+  }
+}		/* -----  end of function dbEpochRetire  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbEpochReclaimAll
+ *  Description:  Frees what can be freed of the blocks retired by every
+ *                thread, so that those of a thread which went idle do not
+ *                stay allocated. Called periodically by the evictor
+ * =============================================================================
+ */
+void dbEpochReclaimAll ()
+{
+  unsigned int slotsUsed = gEpochSlotsUsed.load();
+  if (slotsUsed > DB_EPOCH_MAX_THREADS)
+  {
+    slotsUsed = DB_EPOCH_MAX_THREADS;
+  }
+  for (unsigned int slot = 0; slot <= slotsUsed; slot++)
+  {
+    RetiredListStruct &retired = 
+      gRetiredLists[(slot == slotsUsed) ? DB_EPOCH_MAX_THREADS : slot];
+    if (retired.count.load(memory_order_relaxed) > 0)
+    {
+      lock_guard<mutex> lock(retired.lock);
+      reclaimRetiredLocked(retired);
+    }
+  }
+}		/* -----  end of function dbEpochReclaimAll  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbEpochRetiredBytes
+ *  Description:  Returns the bytes of the blocks retired and not freed yet
+ * =============================================================================
+ */
+size_t dbEpochRetiredBytes ()
+{
+  return gRetiredBytes.load(memory_order_relaxed);
+}		/* -----  end of function dbEpochRetiredBytes  ----- */
@@ -0,0 +1,113 @@
+/*==============================================================================
+ *
+ *       Filename:  dbexpiry.cpp
+ *
+ *    Description:  Timer wheel indexing the items of a hash table by the 
+ *                  second they expire in
+ *
+ * =============================================================================
+ */
+
+#include "../inc/dbexpiry.h"
+
+DbExpiryWheel::DbExpiryWheel () : buckets(DB_EXPIRY_WHEEL_SIZE, NULL), 
+  cursor(0), count(0)
+{
+}
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbExpiryWheel::add
+ *  Description:  Links the item into the bucket of its expiry. Items which
+ *                never expire are not linked
+ * =============================================================================
+ */
+void DbExpiryWheel::add (ItemStruct *item)
+{
+  item->expiryPrev = NULL;
+  item->expiryNext = NULL;
+  if (item->expiry == DB_CLOCK_NEVER)
+  {
+    return;
+  }
+  ItemStruct *&head = buckets[item->expiry % DB_EXPIRY_WHEEL_SIZE];
+  item->expiryNext = head;
+  if (head != NULL)
+  {
+    head->expiryPrev = item;
+  }
+  head = item;
+  count++;
+}		/* -----  end of function DbExpiryWheel::add  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbExpiryWheel::remove
+ *  Description:  Unlinks the item. Its expiry must not have changed since it
+ *                was added
+ * =============================================================================
+ */
+void DbExpiryWheel::remove (ItemStruct *item)
+{
+  if (item->expiry == DB_CLOCK_NEVER)
+  {
+    return;
+  }
+  if (item->expiryPrev != NULL)
+  {
+    item->expiryPrev->expiryNext = item->expiryNext;
+  }
+  else
+  {
+    buckets[item->expiry % DB_EXPIRY_WHEEL_SIZE] = item->expiryNext;
+  }
+  if (item->expiryNext != NULL)
+  {
+    item->expiryNext->expiryPrev = item->expiryPrev;
+  }
+  item->expiryPrev = NULL;
+  item->expiryNext = NULL;
+  count--;
+}		/* -----  end of function DbExpiryWheel::remove  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbExpiryWheel::collectExpired
+ *  Description:  Appends the items which have expired by now to items, 
+ *                walking the buckets of the seconds since the last call. The
+ *                items stay linked: the caller removes them. At most maxItems
+ *                are collected; returns false if the walk stopped early, and 
+ *                the next call resumes it
+ * =============================================================================
+ */
+bool DbExpiryWheel::collectExpired (RelTimeType now, size_t maxItems,
+    vector<ItemStruct *> &items)
+{
+  if (count == 0)
+  {
+    // Nothing to walk
+    cursor = now;
+  }
+  else if (now - cursor > DB_EXPIRY_WHEEL_SIZE)
+  {
+    // A whole turn has gone by and every bucket is due
+    cursor = (now > DB_EXPIRY_WHEEL_SIZE) ? now - DB_EXPIRY_WHEEL_SIZE : 0;
+  }
+
+  size_t found = 0;
+  for (; cursor < now; cursor++)
+  {
+    ItemStruct *item = buckets[cursor % DB_EXPIRY_WHEEL_SIZE];
+    for (; item != NULL; item = item->expiryNext)
+    {
+      // Items of a later turn of the wheel stay
+      if (item->expiry < now)
+      {
+        if (found == maxItems)
+        {
+          return false;
+        }
+        items.push_back(item);
+        found++;
+      }
+    }
+  }
+  return true;
+}		/* -----  end of function DbExpiryWheel::collectExpired  ----- */
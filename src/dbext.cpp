@@ -0,0 +1,403 @@
+/*==============================================================================
+ *
+ *       Filename:  dbext.cpp
+ *
+ *    Description:  External storage for the values of cold items, in large
+ *                  append-only files on a local disk given with -E. The
+ *                  evictor stages values into a write buffer and writes the
+ *                  buffer out to the file being filled; a value is read back
+ *                  with pread, or from the buffer if it is not written yet. A
+ *                  file whose values have all been removed is free again, and
+ *                  files still holding some are compacted by the evictor
+ *
+ * =============================================================================
+ */
+
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../inc/sconst.h"
+#include "../inc/dblru.h"
+#include "../inc/dbext.h"
+
+// The files and the write buffer, guarded by gExtMutex. The buffer holds the
+// values staged for the file being filled from its flushedOffset on. Only the
+// evictor stages and flushes values
+static mutex gExtMutex;
+static vector<DbExtFile> gExtFiles;
+static unsigned long long int gExtFileSize = 0;
+static unsigned int gExtCurrent = DB_EXT_NONE;
+static string gExtPending;
+static bool gIsExtEnabled = false;
+static atomic<unsigned long int> gExtWrites(0);
+static atomic<unsigned long int> gExtWriteBytes(0);
+static atomic<unsigned long int> gExtWriteFailures(0);
+static atomic<unsigned long int> gExtReads(0);
+static atomic<unsigned long int> gExtReadBytes(0);
+static atomic<unsigned long int> gExtStaleReads(0);
+static atomic<unsigned long int> gExtCompactions(0);
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbExtInit
+ *  Description:  Creates the external storage files in the directory given
+ *                with -E. Without it, or if a file cannot be created, values
+ *                are kept in memory only
+ * =============================================================================
+ */
+void dbExtInit ()
+{
+  if (gServExtPath.empty())
+  {
+    return;
+  }
+  gExtFileSize = DB_EXT_FILE_SIZE;
+  if (gServExtSize / DB_EXT_MIN_FILES < gExtFileSize)
+  {
+    gExtFileSize = gServExtSize / DB_EXT_MIN_FILES;
+  }
+  if (gExtFileSize == 0)
+  {
+    cout<<"External storage is too small"<<endl;
+    return;
+  }
+  unsigned int fileCount = gServExtSize / gExtFileSize;
+  for (unsigned int fileNum = 0; fileNum < fileCount; fileNum++)
+  {
+    string fileName = gServExtPath + "/memstashed.ext." + to_string(fileNum);
+    DbExtFile file;
+    memset(&file, 0, sizeof(file));
+    file.state = DB_EXT_FILE_FREE;
+    file.fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (file.fd < 0)
+    {
+      perror("Could not create the external storage files");
+      for (auto &opened: gExtFiles)
+      {
+        close(opened.fd);
+      }
+      gExtFiles.clear();
+      return;
+    }
+    gExtFiles.push_back(file);
+  }
+  gIsExtEnabled = true;
+}		/* -----  end of function dbExtInit  ----- */
+
+bool dbExtIsEnabled ()
+{
+  return gIsExtEnabled;
+}
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  releaseFileLocked
+ *  Description:  Makes a file free. Its generation changes, so that values
+ *                still referring to it are no longer found. gExtMutex must be
+ *                held
+ * =============================================================================
+ */
+static void releaseFileLocked (unsigned int fileNum)
+{
+  DbExtFile &file = gExtFiles[fileNum];
+  file.generation++;
+  file.state = DB_EXT_FILE_FREE;
+  file.writeOffset = 0;
+  file.flushedOffset = 0;
+  file.liveBytes = 0;
+  file.liveItems = 0;
+}		/* -----  end of function releaseFileLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  openFileLocked
+ *  Description:  Marks the file being filled as full and starts filling a
+ *                free one with no reads left on it. gExtMutex must be held.
+ *                Returns false if there is none
+ * =============================================================================
+ */
+static bool openFileLocked ()
+{
+  if (gExtCurrent != DB_EXT_NONE)
+  {
+    gExtFiles[gExtCurrent].state = DB_EXT_FILE_FULL;
+    if (gExtFiles[gExtCurrent].liveItems == 0)
+    {
+      releaseFileLocked(gExtCurrent);
+    }
+    gExtCurrent = DB_EXT_NONE;
+  }
+  for (unsigned int fileNum = 0; fileNum < gExtFiles.size(); fileNum++)
+  {
+    if ((gExtFiles[fileNum].state == DB_EXT_FILE_FREE) &&
+        (gExtFiles[fileNum].readers == 0))
+    {
+      gExtFiles[fileNum].state = DB_EXT_FILE_WRITING;
+      gExtCurrent = fileNum;
+      return true;
+    }
+  }
+  return false;
+}		/* -----  end of function openFileLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbExtStage
+ *  Description:  Copies the value into the write buffer and sets ref to where
+ *                it goes in the file being filled. Returns false if the
+ *                buffer has to be flushed first, or there is no room left
+ * =============================================================================
+ */
+bool dbExtStage (const char *value, size_t len, DbExtRef &ref)
+{
+  lock_guard<mutex> lock(gExtMutex);
+  if (!gExtPending.empty() && (gExtPending.size() + len > DB_EXT_WRITE_BUFFER))
+  {
+    return false;
+  }
+  if ((gExtCurrent == DB_EXT_NONE) ||
+      (gExtFiles[gExtCurrent].writeOffset + len > gExtFileSize))
+  {
+    // The buffer only ever holds values of the file being filled
+    if (!gExtPending.empty() || (len > gExtFileSize) || !openFileLocked())
+    {
+      return false;
+    }
+  }
+  DbExtFile &file = gExtFiles[gExtCurrent];
+  ref.fileNum = gExtCurrent;
+  ref.generation = file.generation;
+  ref.offset = file.writeOffset;
+  gExtPending.append(value, len);
+  file.writeOffset += len;
+  file.liveBytes += len;
+  file.liveItems++;
+  gExtWrites++;
+  gExtWriteBytes += len;
+  return true;
+}		/* -----  end of function dbExtStage  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbExtFlush
+ *  Description:  Writes the write buffer out to the file being filled. The
+ *                buffer is read without gExtMutex, as only the caller adds to
+ *                it. If the write fails the values in the file are given up
+ * =============================================================================
+ */
+void dbExtFlush ()
+{
+  unique_lock<mutex> lock(gExtMutex);
+  if (gExtPending.empty())
+  {
+    return;
+  }
+  DbExtFile &file = gExtFiles[gExtCurrent];
+  int fd = file.fd;
+  const char *data = gExtPending.data();
+  size_t size = gExtPending.size();
+  off_t offset = file.flushedOffset;
+  lock.unlock();
+
+  size_t written = 0;
+  while (written < size)
+  {
+    ssize_t ret = pwrite(fd, data + written, size - written, offset + written);
+    if (ret < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      break;
+    }
+    written += ret;
+  }
+
+  lock.lock();
+  if (written < size)
+  {
+    perror("Could not write to external storage");
+    gExtWriteFailures++;
+    releaseFileLocked(gExtCurrent);
+    gExtCurrent = DB_EXT_NONE;
+  }
+  else
+  {
+    file.flushedOffset += size;
+  }
+  gExtPending.clear();
+}		/* -----  end of function dbExtFlush  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbExtRead
+ *  Description:  Reads the value at ref into value. The read from the file is
+ *                made without gExtMutex; the file is not written to again
+ *                while it is going on. Returns false if the file no longer
+ *                holds the value, or cannot be read
+ * =============================================================================
+ */
+bool dbExtRead (const DbExtRef &ref, size_t len, string &value)
+{
+  unique_lock<mutex> lock(gExtMutex);
+  DbExtFile &file = gExtFiles[ref.fileNum];
+  if (file.generation != ref.generation)
+  {
+    gExtStaleReads++;
+    return false;
+  }
+  gExtReads++;
+  gExtReadBytes += len;
+  if (ref.offset >= file.flushedOffset)
+  {
+    // Not written out yet
+    value.assign(gExtPending, ref.offset - file.flushedOffset, len);
+    return true;
+  }
+  file.readers++;
+  int fd = file.fd;
+  lock.unlock();
+
+  value.resize(len);
+  size_t done = 0;
+  while (done < len)
+  {
+    ssize_t ret = pread(fd, &value[done], len - done, ref.offset + done);
+    if (ret < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      break;
+    }
+    if (ret == 0)
+    {
+      break;
+    }
+    done += ret;
+  }
+
+  lock.lock();
+  file.readers--;
+  return (done == len);
+}		/* -----  end of function dbExtRead  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbExtRemove
+ *  Description:  Tells that the value at ref is no longer stored. A full file
+ *                with no values left is free again
+ * =============================================================================
+ */
+void dbExtRemove (const DbExtRef &ref, size_t len)
+{
+  lock_guard<mutex> lock(gExtMutex);
+  DbExtFile &file = gExtFiles[ref.fileNum];
+  if (file.generation != ref.generation)
+  {
+    return;
+  }
+  file.liveBytes -= len;
+  file.liveItems--;
+  if ((file.liveItems == 0) && (file.state == DB_EXT_FILE_FULL))
+  {
+    releaseFileLocked(ref.fileNum);
+  }
+}		/* -----  end of function dbExtRemove  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbExtPickCompaction
+ *  Description:  If too few files are free, picks the full file with the
+ *                fewest bytes still stored for compaction. isRescued tells
+ *                whether its values are to be written out again or dropped.
+ *                Returns false if there is nothing to compact
+ * =============================================================================
+ */
+bool dbExtPickCompaction (unsigned int &fileNum, bool &isRescued)
+{
+  lock_guard<mutex> lock(gExtMutex);
+  unsigned int freeCount = 0;
+  fileNum = DB_EXT_NONE;
+  for (unsigned int i = 0; i < gExtFiles.size(); i++)
+  {
+    if (gExtFiles[i].state == DB_EXT_FILE_FREE)
+    {
+      freeCount++;
+    }
+    else if ((gExtFiles[i].state == DB_EXT_FILE_FULL) &&
+        ((fileNum == DB_EXT_NONE) ||
+         (gExtFiles[i].liveBytes < gExtFiles[fileNum].liveBytes)))
+    {
+      fileNum = i;
+    }
+  }
+  if ((freeCount >= DB_EXT_SPARE_FILES) || (fileNum == DB_EXT_NONE))
+  {
+    return false;
+  }
+  gExtFiles[fileNum].state = DB_EXT_FILE_COMPACTING;
+  isRescued = (gExtFiles[fileNum].liveBytes * 100 <=
+      gExtFileSize * DB_EXT_RESCUE_PERCENT);
+  gExtCompactions++;
+  return true;
+}		/* -----  end of function dbExtPickCompaction  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbExtIsInFile
+ *  Description:  Checks whether the value at ref is still stored in the file
+ * =============================================================================
+ */
+bool dbExtIsInFile (const DbExtRef &ref, unsigned int fileNum)
+{
+  lock_guard<mutex> lock(gExtMutex);
+  return (ref.fileNum == fileNum) &&
+    (ref.generation == gExtFiles[fileNum].generation);
+}		/* -----  end of function dbExtIsInFile  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbExtReleaseFile
+ *  Description:  Frees a file once it has been compacted
+ * =============================================================================
+ */
+void dbExtReleaseFile (unsigned int fileNum)
+{
+  lock_guard<mutex> lock(gExtMutex);
+  releaseFileLocked(fileNum);
+}		/* -----  end of function dbExtReleaseFile  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbExtAppendStats
+ *  Description:  Appends the stats of external storage to the output of the
+ *                stats command
+ * =============================================================================
+ */
+void dbExtAppendStats (string &output)
+{
+  if (!gIsExtEnabled)
+  {
+    return;
+  }
+  unsigned long int freeFiles = 0;
+  unsigned long int items = 0;
+  unsigned long int bytes = 0;
+  gExtMutex.lock();
+  for (auto &file: gExtFiles)
+  {
+    if (file.state == DB_EXT_FILE_FREE)
+    {
+      freeFiles++;
+    }
+    items += file.liveItems;
+    bytes += file.liveBytes;
+  }
+  gExtMutex.unlock();
+
+  dbAppendStat(output, "ext_items", items);
+  dbAppendStat(output, "ext_bytes", bytes);
+  dbAppendStat(output, "ext_limit_bytes", gExtFiles.size() * gExtFileSize);
+  dbAppendStat(output, "ext_files", gExtFiles.size());
+  dbAppendStat(output, "ext_files_free", freeFiles);
+  dbAppendStat(output, "ext_writes", gExtWrites);
+  dbAppendStat(output, "ext_write_bytes", gExtWriteBytes);
+  dbAppendStat(output, "ext_write_failures", gExtWriteFailures);
+  dbAppendStat(output, "ext_reads", gExtReads);
+  dbAppendStat(output, "ext_read_bytes", gExtReadBytes);
+  dbAppendStat(output, "ext_stale_reads", gExtStaleReads);
+  dbAppendStat(output, "ext_compactions", gExtCompactions);
+}		/* -----  end of function dbExtAppendStats  ----- */
@@ -0,0 +1,561 @@
+/*==============================================================================
+ *
+ *       Filename:  dbindex.cpp
+ *
+ *    Description:  Open addressing hash index used by the shards of the
+ *                  database to go from a key to its item
+ *
+ * =============================================================================
+ */
+
+#include <chrono>
+#include <cstdlib>
+
+#include "../inc/dbindex.h"
+#include "../inc/dbepoch.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  groupMatch
+ *  Description:  Returns a bitmask of the control bytes in the group of 16
+ *                starting at grp which are equal to ctrlByte
+ * =============================================================================
+ */
+static inline unsigned int groupMatch (const signed char *grp,
+    signed char ctrlByte)
+{
+#ifdef __SSE2__
+  __m128i ctrlVec = _mm_loadu_si128((const __m128i *)grp);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(ctrlByte), ctrlVec));
+#else
+  unsigned int mask = 0;
+  for (unsigned int i = 0; i < DB_INDEX_GROUP_SIZE; i++)
+  {
+    if (grp[i] == ctrlByte)
+    {
+      mask |= (1 << i);
+    }
+  }
+  return mask;
+#endif
+}		/* -----  end of function groupMatch  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  groupMatchFree
+ *  Description:  Returns a bitmask of the empty or deleted slots in the group.
+ *                Both have the sign bit set, full slots never do
+ * =============================================================================
+ */
+static inline unsigned int groupMatchFree (const signed char *grp)
+{
+#ifdef __SSE2__
+  return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)grp));
+#else
+  unsigned int mask = 0;
+  for (unsigned int i = 0; i < DB_INDEX_GROUP_SIZE; i++)
+  {
+    if (grp[i] < 0)
+    {
+      mask |= (1 << i);
+    }
+  }
+  return mask;
+#endif
+}		/* -----  end of function groupMatchFree  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  hashFingerprint
+ *  Description:  The 7 bits of the hash stored in the control byte
+ * =============================================================================
+ */
+static inline signed char hashFingerprint (size_t hash)
+{
+  return (signed char)(hash & 0x7F);
+}		/* -----  end of function hashFingerprint  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  maxLoad
+ *  Description:  The number of slots that may be used before the table has to
+ *                be rehashed. Keeping 1/8 of the slots empty keeps probe
+ *                sequences short and guarantees that every probe terminates
+ * =============================================================================
+ */
+static inline size_t maxLoad (size_t capacity)
+{
+  return capacity - capacity / 8;
+}		/* -----  end of function maxLoad  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  getTableBytes
+ *  Description:  Returns the memory a table of the given capacity takes up
+ * =============================================================================
+ */
+static inline size_t getTableBytes (size_t capacity)
+{
+  return sizeof(DbIndexTable) + 
+    capacity * (sizeof(ItemStruct *) + sizeof(signed char));
+}		/* -----  end of function getTableBytes  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  allocTable
+ *  Description:  Allocates an empty table of the given capacity
+ * =============================================================================
+ */
+static DbIndexTable *allocTable (size_t capacity)
+{
+  DbIndexTable *table = (DbIndexTable *)malloc(getTableBytes(capacity));
+  if (table == NULL)
+  {
+    throw bad_alloc();
+  }
+  table->capacity = capacity;
+  table->count = 0;
+  table->slots = (ItemStruct **)(table + 1);
+  table->ctrl = (signed char *)(table->slots + capacity);
+  memset(table->ctrl, DB_INDEX_CTRL_EMPTY, capacity);
+  memset(table->slots, 0, capacity * sizeof(ItemStruct *));
+  return table;
+}		/* -----  end of function allocTable  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  freeTable
+ *  Description:  Frees a table. Used once no reader can still be looking at
+ *                it. Items are not freed
+ * =============================================================================
+ */
+static void freeTable (void *table)
+{
+  free(table);
+}		/* -----  end of function freeTable  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  tableProbe
+ *  Description:  Returns the slot of the table in the probe sequence of the
+ *                hash whose item isMatch accepts, or NULL if there is none.
+ *                Only items whose fingerprint matches are passed to isMatch.
+ *                As readers may race with writers, an empty slot with a 
+ *                matching fingerprint is skipped and the probe is bounded
+ * =============================================================================
+ */
+template <typename MatchType>
+static ItemStruct **tableProbe (const DbIndexTable *table, size_t hash,
+    MatchType isMatch)
+{
+  size_t groupMask = table->capacity / DB_INDEX_GROUP_SIZE - 1;
+  size_t group = (hash >> 7) & groupMask;
+  signed char fingerprint = hashFingerprint(hash);
+
+  for (size_t step = 1; step <= groupMask + 1; step++)
+  {
+    const signed char *grp = table->ctrl + group * DB_INDEX_GROUP_SIZE;
+    unsigned int mask = groupMatch(grp, fingerprint);
+    while (mask != 0)
+    {
+      size_t pos = group * DB_INDEX_GROUP_SIZE + __builtin_ctz(mask);
+      ItemStruct *item = table->slots[pos];
+      if ((item != NULL) && isMatch(item))
+      {
+        return &table->slots[pos];
+      }
+      mask &= mask - 1;
+    }
+    if (groupMatch(grp, DB_INDEX_CTRL_EMPTY) != 0)
+    {
+      // An empty slot ends every probe sequence going through this group
+      return NULL;
+    }
+    // Triangular probing visits every group when the group count is a power
+    // of two
+    group = (group + step) & groupMask;
+  }
+  return NULL;
+}		/* -----  end of function tableProbe  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  tableFindSlot
+ *  Description:  Returns the slot of the table holding the item for the key,
+ *                or NULL if the key is not present
+ * =============================================================================
+ */
+static ItemStruct **tableFindSlot (const DbIndexTable *table, 
+    const string &key, size_t hash)
+{
+  return tableProbe(table, hash, [&](const ItemStruct *item) {
+      return ((item->hash == hash) && dbItemKeyEquals(item, key));
+    });
+}		/* -----  end of function tableFindSlot  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  tableFindItemSlot
+ *  Description:  Returns the slot of the table holding the given item, or 
+ *                NULL if the item is not in the table
+ * =============================================================================
+ */
+static ItemStruct **tableFindItemSlot (const DbIndexTable *table, 
+    const ItemStruct *target)
+{
+  return tableProbe(table, target->hash, [&](const ItemStruct *item) {
+      return (item == target);
+    });
+}		/* -----  end of function tableFindItemSlot  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  tableFindInsertPos
+ *  Description:  Returns the first empty or deleted slot in the probe sequence
+ *                of the hash
+ * =============================================================================
+ */
+static size_t tableFindInsertPos (const DbIndexTable *table, size_t hash)
+{
+  size_t groupMask = table->capacity / DB_INDEX_GROUP_SIZE - 1;
+  size_t group = (hash >> 7) & groupMask;
+
+  for (size_t step = 1; ; step++)
+  {
+    unsigned int mask = groupMatchFree(table->ctrl + 
+        group * DB_INDEX_GROUP_SIZE);
+    if (mask != 0)
+    {
+      return group * DB_INDEX_GROUP_SIZE + __builtin_ctz(mask);
+    }
+    group = (group + step) & groupMask;
+  }
+}		/* -----  end of function tableFindInsertPos  ----- */
+
+DbHashIndex::DbHashIndex () : table(NULL), oldTable(NULL), growthLeft(0), 
+  migratePos(0), resizeCount(0), resizeUsec(0)
+{
+  table = allocTable(DB_INDEX_MIN_CAPACITY);
+  growthLeft = maxLoad(DB_INDEX_MIN_CAPACITY);
+}
+
+DbHashIndex::~DbHashIndex ()
+{
+  freeTable(table.load());
+  freeTable(oldTable.load());
+}
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbHashIndex::findSlot
+ *  Description:  Returns the slot holding the item for the key, or NULL if the
+ *                key is not present. While resizing, keys not yet moved are 
+ *                still in the old table
+ * =============================================================================
+ */
+ItemStruct **DbHashIndex::findSlot (const string &key, size_t hash) const
+{
+  ItemStruct **slot = tableFindSlot(table.load(memory_order_acquire), key, 
+      hash);
+  if (slot == NULL)
+  {
+    const DbIndexTable *old = oldTable.load(memory_order_acquire);
+    if ((old != NULL) && (old->count != 0))
+    {
+      slot = tableFindSlot(old, key, hash);
+    }
+  }
+  return slot;
+}		/* -----  end of function DbHashIndex::findSlot  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbHashIndex::findItemSlot
+ *  Description:  Returns the slot holding the given item, or NULL if it is no
+ *                longer in the index. Must be called with the lock held
+ * =============================================================================
+ */
+ItemStruct **DbHashIndex::findItemSlot (const ItemStruct *item) const
+{
+  ItemStruct **slot = tableFindItemSlot(table.load(), item);
+  const DbIndexTable *old = oldTable.load();
+  if ((slot == NULL) && (old != NULL) && (old->count != 0))
+  {
+    slot = tableFindItemSlot(old, item);
+  }
+  return slot;
+}		/* -----  end of function DbHashIndex::findItemSlot  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbHashIndex::find
+ *  Description:  Returns the item for the key, or NULL if it is not present
+ * =============================================================================
+ */
+ItemStruct *DbHashIndex::find (const string &key, size_t hash) const
+{
+  ItemStruct **slot = findSlot(key, hash);
+  if (slot == NULL)
+  {
+    return NULL;
+  }
+  return *slot;
+}		/* -----  end of function DbHashIndex::find  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbHashIndex::insert
+ *  Description:  Inserts an item whose key is not already in the index
+ * =============================================================================
+ */
+void DbHashIndex::insert (ItemStruct *item)
+{
+  if ((growthLeft == 0) && isResizing())
+  {
+    // Should not happen as the old table is always moved out first, but 
+    // finish the move before starting another one
+    migrate(oldTable.load()->capacity);
+  }
+  if (growthLeft == 0)
+  {
+    DbIndexTable *cur = table.load();
+    if (cur->count <= cur->capacity * 25 / 32)
+    {
+      // Mostly tombstones. Clean them up without growing
+      startResize(cur->capacity);
+    }
+    else
+    {
+      startResize(cur->capacity * 2);
+    }
+  }
+
+  DbIndexTable *cur = table.load();
+  size_t pos = tableFindInsertPos(cur, item->hash);
+  if (cur->ctrl[pos] == DB_INDEX_CTRL_EMPTY)
+  {
+    growthLeft--;
+  }
+  // The slot is filled before the control byte so that a reader matching the
+  // fingerprint finds the item
+  cur->slots[pos] = item;
+  cur->ctrl[pos] = hashFingerprint(item->hash);
+  cur->count++;
+
+  if (isResizing())
+  {
+    migrate(DB_INDEX_MIGRATE_GROUPS);
+  }
+}		/* -----  end of function DbHashIndex::insert  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbHashIndex::eraseSlot
+ *  Description:  Removes the item in the slot from the index. The item itself
+ *                is not freed
+ * =============================================================================
+ */
+void DbHashIndex::eraseSlot (ItemStruct **slot)
+{
+  DbIndexTable *cur = table.load();
+  if ((slot < cur->slots) || (slot >= cur->slots + cur->capacity))
+  {
+    // Not moved yet. The old table is thrown away once moved, so a tombstone
+    // is all that is needed
+    DbIndexTable *old = oldTable.load();
+    size_t pos = slot - old->slots;
+    old->ctrl[pos] = DB_INDEX_CTRL_DELETED;
+    old->slots[pos] = NULL;
+    old->count--;
+  }
+  else
+  {
+    size_t pos = slot - cur->slots;
+    const signed char *grp = cur->ctrl + 
+      (pos & ~(size_t)(DB_INDEX_GROUP_SIZE - 1));
+
+    // If the group already has an empty slot, no probe sequence continues
+    // past this group, and the slot can be made empty again instead of a
+    // tombstone
+    if (groupMatch(grp, DB_INDEX_CTRL_EMPTY) != 0)
+    {
+      cur->ctrl[pos] = DB_INDEX_CTRL_EMPTY;
+      growthLeft++;
+    }
+    else
+    {
+      cur->ctrl[pos] = DB_INDEX_CTRL_DELETED;
+    }
+    cur->slots[pos] = NULL;
+    cur->count--;
+  }
+
+  if (isResizing())
+  {
+    migrate(DB_INDEX_MIGRATE_GROUPS);
+  }
+}		/* -----  end of function DbHashIndex::eraseSlot  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbHashIndex::size
+ *  Description:  Returns the number of items in the index
+ * =============================================================================
+ */
+size_t DbHashIndex::size () const
+{
+  size_t count = table.load()->count;
+  const DbIndexTable *old = oldTable.load();
+  if (old != NULL)
+  {
+    count += old->count;
+  }
+  return count;
+}		/* -----  end of function DbHashIndex::size  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbHashIndex::sample
+ *  Description:  Returns an item picked at random, or NULL if the index is
+ *                empty. The random value chooses the table and the slot the
+ *                scan for a full slot starts at. Must be called with the lock
+ *                held
+ * =============================================================================
+ */
+ItemStruct *DbHashIndex::sample (size_t randomValue) const
+{
+  const DbIndexTable *current = table.load();
+  const DbIndexTable *old = oldTable.load();
+  size_t count = size();
+  if (count == 0)
+  {
+    return NULL;
+  }
+  if ((old != NULL) && ((randomValue % count) < old->count))
+  {
+    current = old;
+  }
+  if (current->count == 0)
+  {
+    return NULL;
+  }
+
+  size_t mask = current->capacity - 1;
+  size_t pos = (randomValue >> 7) & mask;
+  for (size_t i = 0; i < current->capacity; i++)
+  {
+    if (current->ctrl[pos] >= 0)
+    {
+      return current->slots[pos];
+    }
+    pos = (pos + 1) & mask;
+  }
+  return NULL;
+}		/* -----  end of function DbHashIndex::sample  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbHashIndex::scan
+ *  Description:  Appends the items in the next count slots from the cursor to
+ *                items, and returns the cursor to continue from. The slots of
+ *                the old table come first while resizing. 0 is returned once
+ *                the end is reached. A resize in between scans may make a
+ *                pass skip or repeat some items. Must be called with the lock
+ *                held
+ * =============================================================================
+ */
+size_t DbHashIndex::scan (size_t cursor, size_t count, 
+    vector<ItemStruct *> &items) const
+{
+  const DbIndexTable *current = table.load();
+  const DbIndexTable *old = oldTable.load();
+  size_t oldCapacity = (old != NULL) ? old->capacity : 0;
+
+  for (size_t i = 0; i < count; i++, cursor++)
+  {
+    const DbIndexTable *scanned = old;
+    size_t pos = cursor;
+    if (pos >= oldCapacity)
+    {
+      scanned = current;
+      pos -= oldCapacity;
+      if (pos >= current->capacity)
+      {
+        return 0;
+      }
+    }
+    if (scanned->ctrl[pos] >= 0)
+    {
+      items.push_back(scanned->slots[pos]);
+    }
+  }
+  return cursor;
+}		/* -----  end of function DbHashIndex::scan  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbHashIndex::getBytes
+ *  Description:  Returns the memory used by the tables of the index
+ * =============================================================================
+ */
+size_t DbHashIndex::getBytes () const
+{
+  size_t bytes = getTableBytes(table.load()->capacity);
+  const DbIndexTable *old = oldTable.load();
+  if (old != NULL)
+  {
+    bytes += getTableBytes(old->capacity);
+  }
+  return bytes;
+}		/* -----  end of function DbHashIndex::getBytes  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbHashIndex::startResize
+ *  Description:  Makes the current table the old one and starts with an empty
+ *                table of the given capacity. The items are moved over by
+ *                later inserts and erases
+ * =============================================================================
+ */
+void DbHashIndex::startResize (size_t newCapacity)
+{
+  DbIndexTable *newTable = allocTable(newCapacity);
+
+  oldTable.store(table.load(), memory_order_release);
+  table.store(newTable, memory_order_release);
+  growthLeft = maxLoad(newCapacity);
+  migratePos = 0;
+  resizeCount++;
+}		/* -----  end of function DbHashIndex::startResize  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbHashIndex::migrate
+ *  Description:  Moves the items in the next few groups of the old table into
+ *                the current table. The hash kept in the item is used, so no
+ *                key is rehashed. Moved slots become tombstones so that probe
+ *                sequences in the old table still reach the items after them
+ * =============================================================================
+ */
+void DbHashIndex::migrate (size_t groups)
+{
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  DbIndexTable *cur = table.load();
+  DbIndexTable *old = oldTable.load();
+  size_t end = migratePos + groups * DB_INDEX_GROUP_SIZE;
+  if (end > old->capacity)
+  {
+    end = old->capacity;
+  }
+
+  for (; migratePos < end; migratePos++)
+  {
+    if (old->ctrl[migratePos] < 0)
+    {
+      continue;
+    }
+    ItemStruct *item = old->slots[migratePos];
+    size_t pos = tableFindInsertPos(cur, item->hash);
+    if (cur->ctrl[pos] == DB_INDEX_CTRL_EMPTY)
+    {
+      growthLeft--;
+    }
+    cur->slots[pos] = item;
+    cur->ctrl[pos] = old->ctrl[migratePos];
+    cur->count++;
+    old->ctrl[migratePos] = DB_INDEX_CTRL_DELETED;
+    old->slots[migratePos] = NULL;
+    old->count--;
+  }
+
+  if (migratePos == old->capacity)
+  {
+    // Readers may still be probing the old table
+    oldTable.store(NULL, memory_order_release);
+    dbEpochRetire(old, freeTable, getTableBytes(old->capacity));
+  }
+  resizeUsec += chrono::duration_cast<chrono::microseconds>(
+      chrono::steady_clock::now() - start).count();
+}		/* -----  end of function DbHashIndex::migrate  ----- */
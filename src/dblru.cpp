@@ -2,34 +2,121 @@
  *
  *       Filename:  dblru.cc
  *
- *    Description:  This file is the plug-in for the LRU cache replacement
- *                  strategy for memstashed
+ *    Description:  This file is the storage engine of memstashed. The items
+ *                  of each hash table are evicted by the cache replacement
+ *                  policy chosen at startup (see dbpolicy.h)
  *
  * =============================================================================
  */
 
 #include "../inc/sconst.h"
 #include "../inc/dblru.h"
+#include "../inc/dbepoch.h"
 
-// Compare function for timestampToKey
-static bool timestampToKeyCompare (TimestampToKeyStruct first,
-                                   TimestampToKeyStruct second) {
-  return (first.timestamp < second.timestamp);
-}
-static bool (*timestampToKeyComparePtr)(TimestampToKeyStruct, 
-                                 TimestampToKeyStruct) = timestampToKeyCompare;
+// The data structures for the map, the replacement policy and the expiry
+// index. The policy and the wheel of a hash table are guarded by the lock of
+// the table
+static KeyToValueType gKeyToValueIndex[DB_MAX_HASH_TABLES];
+static DbEvictPolicy *gEvictPolicy[DB_MAX_HASH_TABLES];
+static DbExpiryWheel gExpiryWheel[DB_MAX_HASH_TABLES];
 
-// The data structures for the set and the map
-static vector<TimestampToKeyType> gTimestampToKeySet(DB_MAX_HASH_TABLES, TimestampToKeyType(timestampToKeyComparePtr));
-static KeyToValueType gKeyToValueHashMap[DB_MAX_HASH_TABLES];
-
-static mutex gTimestampToKeyMutex[DB_MAX_HASH_TABLES];
 static mutex gKeyToValueMutex[DB_MAX_HASH_TABLES];
-static atomic<unsigned long int> gStoredSize(0);
-static atomic<unsigned long int> gTimestamp(0);
+static ShardSeqStruct gKeyToValueSeq[DB_MAX_HASH_TABLES];
+// Accesses which could not be reported to the policy by the thread that
+// queued them. They are applied by the next thread holding the table to
+// store, delete, evict or crawl. gBumpQueueLen is the length of the queue,
+// for checking it without the mutex
+static vector<KeyType> gBumpQueue[DB_MAX_HASH_TABLES];
+static mutex gBumpQueueMutex[DB_MAX_HASH_TABLES];
+static atomic<unsigned int> gBumpQueueLen[DB_MAX_HASH_TABLES];
+static atomic<unsigned long int> gBumpsDropped(0);
+// Accesses seen by this thread, applied a batch at a time, and when the
+// first of them was buffered
+static thread_local vector<KeyType> tBumpBuffer[DB_MAX_HASH_TABLES];
+static thread_local RelTimeType tBumpBufferTime[DB_MAX_HASH_TABLES];
+// Bytes of the items of each hash table. They are added to the total in
+// gStoredSize in steps of gStoredSizeSlack, so the memory limit check reads a
+// total that is off by less than a step per table, and writers do not all
+// update one cache line
+static ShardSizeStruct gShardSize[DB_MAX_HASH_TABLES];
+static atomic<long int> gStoredSize(0);
+static long int gStoredSizeSlack = DB_STORED_SIZE_SLACK;
+// Items written before the last flush_all have a lower flush generation.
+// Only flush_all changes it, so reading it costs no cache line transfer
 static atomic <unsigned long int> gFlushAllTimestamp(0);
 static atomic <unsigned long int> gFlushAllTime(0);
 static atomic<bool> gIsFlushAllSet(false);
+// Expired and flushed items freed by the crawler
+static atomic<unsigned long int> gCrawlerReclaimed(0);
+static atomic<unsigned long int> gCrawlerReclaimedBytes(0);
+// The background evictor keeps each hash table under the low watermark of its
+// budget, and rebalances the budgets. It sleeps on gEvictorCond till woken by
+// a store going over the watermark
+static mutex gEvictorMutex;
+static condition_variable gEvictorCond;
+static atomic<bool> gIsEvictorWanted(false);
+static atomic<unsigned long int> gEvictions(0);
+static atomic<unsigned long int> gEvictionsInline(0);
+static atomic<unsigned long int> gEvictionsClass(0);
+static atomic<unsigned long int> gBudgetMoves(0);
+// Values the evictor moved to external storage, and the ones compaction
+// wrote out again or dropped
+static atomic<unsigned long int> gExtMoved(0);
+static atomic<unsigned long int> gExtRescued(0);
+static atomic<unsigned long int> gExtDropped(0);
+// Values of -z bytes or more which were stored uncompressed, as compressing
+// them did not make them smaller
+static atomic<unsigned long int> gCompressSkipped(0);
+// Counters striped because their incrs contended, and folded back into one
+// number
+static atomic<unsigned long int> gCountersStriped(0);
+static atomic<unsigned long int> gCountersFolded(0);
+// Compressed or decompressed values of this thread, kept to save allocations
+static thread_local string tCompressBuffer;
+static long int gBudgetStep = 0;
+static long int gBudgetMin = 0;
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  lockShard
+ *  Description:  Takes the lock of the hash table for changing it. The 
+ *                sequence count is odd while the lock is held, which tells the
+ *                readers not taking the lock to try again
+ * =============================================================================
+ */
+static void lockShard (unsigned int hashTblNum)
+{
+  gKeyToValueMutex[hashTblNum].lock();
+  gKeyToValueSeq[hashTblNum].seq.fetch_add(1);
+}		/* -----  end of function lockShard  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  lockShardContended
+ *  Description:  Takes the lock like lockShard, and returns whether another
+ *                thread held it, which tells a hot counter is incremented
+ *                from several threads
+ * =============================================================================
+ */
+static bool lockShardContended (unsigned int hashTblNum)
+{
+  bool isContended = !gKeyToValueMutex[hashTblNum].try_lock();
+  if (isContended)
+  {
+    gKeyToValueMutex[hashTblNum].lock();
+  }
+  gKeyToValueSeq[hashTblNum].seq.fetch_add(1);
+  return isContended;
+}		/* -----  end of function lockShardContended  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  unlockShard
+ *  Description:  Releases the lock taken by lockShard
+ * =============================================================================
+ */
+static void unlockShard (unsigned int hashTblNum)
+{
+  gKeyToValueSeq[hashTblNum].seq.fetch_add(1);
+  gKeyToValueMutex[hashTblNum].unlock();
+}		/* -----  end of function unlockShard  ----- */
 
 /* ===  FUNCTION  ==============================================================
  *         Name:  dbSetFlushAll
@@ -40,10 +127,9 @@ static atomic<bool> gIsFlushAllSet(false);
 void dbSetFlushAll (unsigned long int expiry)
 {
   gIsFlushAllSet = true;
-  time_t curSystemTime;
-  time(&curSystemTime);
+  RelTimeType now = dbClockNow();
 
-  gFlushAllTime = curSystemTime + expiry;
+  gFlushAllTime = now + expiry;
 }		/* -----  end of function dbSetFlushAll  ----- */
 
 /* ===  FUNCTION  ==============================================================
@@ -59,15 +145,22 @@ void dbHandleFlushAll ()
     return;
   }
 
-  time_t curSystemTime;
-  time(&curSystemTime);
+  RelTimeType now = dbClockNow();
 
-  if (gFlushAllTime <= (unsigned long int)curSystemTime)
+  if (gFlushAllTime <= now)
   {
-    // Time to do a flush all
-    unsigned long int tempTimestamp = ++gTimestamp;
-    gFlushAllTimestamp = tempTimestamp;
-    gIsFlushAllSet = false;
+    // Time to do a flush all. Only one thread should do it
+    bool isSet = true;
+    if (!gIsFlushAllSet.compare_exchange_strong(isSet, false))
+    {
+      return;
+    }
+    gFlushAllTimestamp++;
+    if (gServStorageEngine == DB_ENGINE_SEGMENT)
+    {
+      // The segment engine drops its items right away
+      dbSegFlushAll();
+    }
   }
 }		/* -----  end of function dbHandleFlushAll  ----- */
 
@@ -99,565 +192,3142 @@ inline unsigned int getHashTblNbrFromKey (const string &key)
 }		/* -----  end of function getHashTblNbrFromKey  ----- */
 
 /* ===  FUNCTION  ==============================================================
- *         Name:  getValueFromMap
- *  Description:  Returns the value from the iterator
+ *         Name:  getHashFromKey
+ *  Description:  Hash of the whole key, used inside the shard's index
  * =============================================================================
  */
-static string getValueFromMap (const KeyToValueType::iterator &it)
+inline size_t getHashFromKey (const string &key)
 {
-  return (get<0>((it->second))).value;
-}		/* -----  end of function getValueFromMap  ----- */
+  return hash<string>()(key);
+}		/* -----  end of function getHashFromKey  ----- */
 
 /* ===  FUNCTION  ==============================================================
- *         Name:  getExpiryFromMap
- *  Description:  Returns the value from the iterator
+ *         Name:  dbGetNewCas
+ *  Description:  Returns a new random cas value. Each thread has its own
+ *                generator, so no lock is needed
  * =============================================================================
  */
-static TimestampType getExpiryFromMap (const KeyToValueType::iterator &it)
+unsigned long long int dbGetNewCas ()
 {
-  return (get<0>((it->second))).expiry;
-}		/* -----  end of function getExpiryFromMap  ----- */
+  // mt19937_64 is a mersenne_twister_engine
+  static thread_local mt19937_64 generator (random_device{}() ^ time(NULL));
+  return generator();
+}		/* -----  end of function dbGetNewCas  ----- */
 
 /* ===  FUNCTION  ==============================================================
- *         Name:  getCasFromMap
- *  Description:  Returns the value from the iterator
+ *         Name:  compressValue
+ *  Description:  Compresses a value of -z bytes or more into tCompressBuffer.
+ *                Returns false if compression is off, the value is smaller,
+ *                or it does not get any smaller
  * =============================================================================
  */
-static string getCasFromMap (const KeyToValueType::iterator &it)
+static bool compressValue (const string &value)
 {
-  return (get<0>(it->second)).casUniq;
-}		/* -----  end of function getCasFromMap  ----- */
+  if ((gServCompressMin == 0) || (value.size() < gServCompressMin))
+  {
+    return false;
+  }
+  uLongf len = compressBound(value.size());
+  tCompressBuffer.resize(len);
+  if ((compress2((Bytef *)&tCompressBuffer[0], &len, 
+          (const Bytef *)value.data(), value.size(), DB_COMPRESS_LEVEL) != 
+        Z_OK) || (len >= value.size()))
+  {
+    gCompressSkipped++;
+    return false;
+  }
+  tCompressBuffer.resize(len);
+  return true;
+}		/* -----  end of function compressValue  ----- */
 
 /* ===  FUNCTION  ==============================================================
- *         Name:  getFlagsFromMap
- *  Description:  Returns the value from the iterator
+ *         Name:  decompressValue
+ *  Description:  Replaces a compressed value by the rawLen bytes it was made
+ *                from. Returns false if it cannot be decompressed
  * =============================================================================
  */
-static string getFlagsFromMap (const KeyToValueType::iterator &it)
+static bool decompressValue (string &value, unsigned int rawLen)
 {
-  return (get<0>(it->second)).flags;
-}		/* -----  end of function getFlagsFromMap  ----- */
+  uLongf len = rawLen;
+  tCompressBuffer.resize(rawLen);
+  if ((uncompress((Bytef *)&tCompressBuffer[0], &len, 
+          (const Bytef *)value.data(), value.size()) != Z_OK) || 
+      (len != rawLen))
+  {
+    return false;
+  }
+  value.swap(tCompressBuffer);
+  return true;
+}		/* -----  end of function decompressValue  ----- */
 
 /* ===  FUNCTION  ==============================================================
- *         Name:  getTimestampFromMap
- *  Description:  Returns the value from the iterator
+ *         Name:  freeChunks
+ *  Description:  Releases the chunks linked from the given one on
  * =============================================================================
  */
-static TimestampType getTimestampFromMap (const KeyToValueType::iterator &it)
+static void freeChunks (ItemChunk *chunk)
 {
-  return (get<1>((it->second)));
-}		/* -----  end of function getTimestampFromMap  ----- */
+  while (chunk != NULL)
+  {
+    ItemChunk *next = chunk->next;
+    dbArenaFree(chunk);
+    chunk = next;
+  }
+}		/* -----  end of function freeChunks  ----- */
 
 /* ===  FUNCTION  ==============================================================
- *         Name:  setValueToMap
- *  Description:  Returns the value from the iterator
+ *         Name:  appendChunks
+ *  Description:  Adds len bytes to the end of the chain: the last chunk is
+ *                filled up, then chunks are taken off spare and linked on.
+ *                Readers not holding the lock may be following the chain, so
+ *                a chunk is only linked once it is filled
  * =============================================================================
  */
-static void setValueToMap (const KeyToValueType::iterator &it, 
-    const string &value)
+static void appendChunks (ItemChunkChain *chain, const char *data, 
+    size_t len, ItemChunk *&spare)
 {
-  (get<0>((it->second))).value.assign(value);
-}		/* -----  end of function setValueToMap  ----- */
+  ItemChunk *tail = chain->tail;
+  if (tail != NULL)
+  {
+    size_t room = DB_ITEM_CHUNK_DATA - tail->start - tail->used;
+    size_t part = (len < room) ? len : room;
+    memcpy(tail->data + tail->start + tail->used, data, part);
+    tail->used += part;
+    data += part;
+    len -= part;
+  }
+  while (len > 0)
+  {
+    ItemChunk *chunk = spare;
+    spare = chunk->next;
+    size_t part = (len < DB_ITEM_CHUNK_DATA) ? len : DB_ITEM_CHUNK_DATA;
+    memcpy(chunk->data, data, part);
+    chunk->start = 0;
+    chunk->used = part;
+    chunk->next = NULL;
+    chain->allocated += dbArenaSize(chunk);
+    if (tail == NULL)
+    {
+      __atomic_store_n(&chain->head, chunk, __ATOMIC_RELEASE);
+    }
+    else
+    {
+      __atomic_store_n(&tail->next, chunk, __ATOMIC_RELEASE);
+    }
+    tail = chunk;
+    chain->tail = tail;
+    data += part;
+    len -= part;
+  }
+}		/* -----  end of function appendChunks  ----- */
 
 /* ===  FUNCTION  ==============================================================
- *         Name:  setCasToMap
- *  Description:  Returns the value from the iterator
+ *         Name:  prependChunks
+ *  Description:  Adds len bytes to the start of the chain, like appendChunks
+ *                does to the end. New chunks are filled from the back
  * =============================================================================
  */
-static void setCasToMap (const KeyToValueType::iterator &it, 
-    const string &cas)
+static void prependChunks (ItemChunkChain *chain, const char *data, 
+    size_t len, ItemChunk *&spare)
 {
-  (get<0>(it->second)).casUniq.assign(cas);
-}		/* -----  end of function setCasToMap  ----- */
+  ItemChunk *head = chain->head;
+  size_t part = (len < head->start) ? len : head->start;
+  memcpy(head->data + head->start - part, data + len - part, part);
+  head->start -= part;
+  head->used += part;
+  len -= part;
+  while (len > 0)
+  {
+    ItemChunk *chunk = spare;
+    spare = chunk->next;
+    part = (len < DB_ITEM_CHUNK_DATA) ? len : DB_ITEM_CHUNK_DATA;
+    chunk->start = DB_ITEM_CHUNK_DATA - part;
+    chunk->used = part;
+    memcpy(chunk->data + chunk->start, data + len - part, part);
+    chunk->next = head;
+    chain->allocated += dbArenaSize(chunk);
+    __atomic_store_n(&chain->head, chunk, __ATOMIC_RELEASE);
+    head = chunk;
+    len -= part;
+  }
+}		/* -----  end of function prependChunks  ----- */
 
 /* ===  FUNCTION  ==============================================================
- *         Name:  setFlagsToMap
- *  Description:  Returns the value from the iterator
+ *         Name:  copyChunks
+ *  Description:  Copies the value of a chunked item. Readers not holding the
+ *                lock may see a chain being changed, so whatever does not add
+ *                up to the length of the value makes it return false
  * =============================================================================
  */
-static void setFlagsToMap (const KeyToValueType::iterator &it, 
-    const string &flags)
+static bool copyChunks (const ItemStruct *item, string &value)
 {
-  (get<0>(it->second)).flags.assign(flags);
-}		/* -----  end of function setFlagsToMap  ----- */
+  size_t len = item->valueLen;
+  value.clear();
+  value.reserve(len);
+  ItemChunk *chunk = __atomic_load_n(&dbItemChain(item)->head, 
+      __ATOMIC_ACQUIRE);
+  while (chunk != NULL)
+  {
+    size_t start = chunk->start;
+    size_t used = chunk->used;
+    if ((start + used > DB_ITEM_CHUNK_DATA) || (value.size() + used > len))
+    {
+      return false;
+    }
+    value.append(chunk->data + start, used);
+    chunk = __atomic_load_n(&chunk->next, __ATOMIC_ACQUIRE);
+  }
+  return (value.size() == len);
+}		/* -----  end of function copyChunks  ----- */
 
 /* ===  FUNCTION  ==============================================================
- *         Name:  setExpiryToMap
- *  Description:  Returns the value from the iterator
+ *         Name:  foldStripes
+ *  Description:  Returns the number a striped counter stands for. Threads not
+ *                holding the lock add to the stripes, so each is read
+ *                atomically
  * =============================================================================
  */
-static void setExpiryToMap (const KeyToValueType::iterator &it, 
-    const TimestampType &exp)
+static uint64_t foldStripes (const ItemStripes *stripes)
 {
-  (get<0>(it->second)).expiry = exp;
-}		/* -----  end of function setExpiryToMap  ----- */
+  uint64_t number = 0;
+  for (unsigned int stripeNum = 0; stripeNum < DB_ITEM_STRIPES; stripeNum++)
+  {
+    number += __atomic_load_n(&stripes->stripe[stripeNum].sum, 
+        __ATOMIC_ACQUIRE);
+  }
+  return number;
+}		/* -----  end of function foldStripes  ----- */
 
 /* ===  FUNCTION  ==============================================================
- *         Name:  setTimestampToMap
- *  Description:  Returns the value from the iterator
+ *         Name:  getItemNumber
+ *  Description:  Returns the number a numeric item stands for, folding the
+ *                stripes of a striped counter
  * =============================================================================
  */
-static void setTimestampToMap (const KeyToValueType::iterator &it, 
-    const TimestampType &time)
+static uint64_t getItemNumber (ItemStruct *item)
 {
-  (get<1>((it->second))) = time;
-}		/* -----  end of function setTimestampToMap  ----- */
+  if (item->isStriped)
+  {
+    return foldStripes(__atomic_load_n(dbItemStripes(item), 
+          __ATOMIC_ACQUIRE));
+  }
+  return dbItemNumber(item);
+}		/* -----  end of function getItemNumber  ----- */
 
 /* ===  FUNCTION  ==============================================================
- *         Name:  removeLRUElement
- *  Description:  Removes the least recently used element
+ *         Name:  getItemCas
+ *  Description:  Returns the cas value of an item. The incrs of a striped
+ *                counter do not give it a new one, as they do not take the
+ *                lock, so its number is added in. The cas value is to be
+ *                read before the value, so that an incr in between makes it
+ *                stale rather than the value
  * =============================================================================
  */
-static void removeLRUElement (unsigned int hashTblNum)
+static unsigned long long int getItemCas (ItemStruct *item)
 {
-  time_t curSystemTime;
-  time(&curSystemTime);
-  gTimestampToKeyMutex[hashTblNum].lock();
-  gKeyToValueMutex[hashTblNum].lock();
-  auto timestampKeyOne = gTimestampToKeySet[hashTblNum].end();
-  auto timestampKeyTwo = gTimestampToKeySet[hashTblNum].end();
-  auto timestampKeyIter = gTimestampToKeySet[hashTblNum].begin();
-  KeyToValueType::iterator valueIter;
-  KeyToValueType::iterator valueOne;
-  KeyToValueType::iterator valueTwo;
-
-  while (timestampKeyIter != gTimestampToKeySet[hashTblNum].end())
-  {
-    TimestampToKeyStruct tempTimestampKey = *timestampKeyIter;
-    valueIter = gKeyToValueHashMap[hashTblNum].find(tempTimestampKey.key);
-    if (valueIter == gKeyToValueHashMap[hashTblNum].end())
-    {
-      // value has already been deleted
-      TimestampToKeyType::iterator tempTimestampKeyIter = timestampKeyIter;
-      timestampKeyIter++;
-      gStoredSize -= (*tempTimestampKeyIter).key.size() + 
-        sizeof((*tempTimestampKeyIter).timestamp);
-      gTimestampToKeySet[hashTblNum].erase(tempTimestampKeyIter);
-      gKeyToValueMutex[hashTblNum].unlock();
-      gTimestampToKeyMutex[hashTblNum].unlock();
-      return;
-    }
-    if ((getExpiryFromMap(valueIter) < (TimestampType)curSystemTime) ||
-        (getTimestampFromMap(valueIter) < gFlushAllTimestamp))
-    {
-      // value has expired. Can be deleted
-      TimestampToKeyType::iterator tempTimestampKeyIter = timestampKeyIter;
-      timestampKeyIter++;
-      gStoredSize -= 2 * (*tempTimestampKeyIter).key.size() + 
-        2 * sizeof((*tempTimestampKeyIter).timestamp) + 
-        (getCasFromMap(valueIter)).size() + 
-        (getFlagsFromMap(valueIter)).size() +
-        (getValueFromMap(valueIter)).size();
-      gKeyToValueHashMap[hashTblNum].erase(valueIter);
-      gTimestampToKeySet[hashTblNum].erase(tempTimestampKeyIter);
-      gKeyToValueMutex[hashTblNum].unlock();
-      gTimestampToKeyMutex[hashTblNum].unlock();
-      return;
-    }
-
-    if (timestampKeyOne == gTimestampToKeySet[hashTblNum].end())
-    {
-      timestampKeyOne = timestampKeyIter;
-      timestampKeyIter++;
-      // We still need to fill the second one
-      continue;
-    }
-    else
-    {
-      // Earlier iterations have filled the first position
-      timestampKeyTwo = timestampKeyIter;
-    }
-    valueOne = gKeyToValueHashMap[hashTblNum].find((*timestampKeyOne).key);
-    valueTwo = gKeyToValueHashMap[hashTblNum].find((*timestampKeyTwo).key);
-    if (getValueFromMap(valueOne).size() < getValueFromMap(valueTwo).size())
-    {
-      valueIter = valueTwo;
-      timestampKeyIter = timestampKeyTwo;
-    }
-    else
-    {
-      valueIter = valueOne;
-      timestampKeyIter = timestampKeyOne;
-    }
-    break;
-  }
-
-  if (timestampKeyTwo == gTimestampToKeySet[hashTblNum].end())
+  if (item->isStriped)
   {
-    // Only one element. Delete that.
-    valueIter = valueOne;
-    timestampKeyIter = timestampKeyOne;
+    return item->casUniq + getItemNumber(item);
   }
-  if (valueIter == gKeyToValueHashMap[hashTblNum].end())
-  {
-    return;
-  }
-  gStoredSize -= 2 * (*timestampKeyIter).key.size() + 
-    2 * sizeof((*timestampKeyIter).timestamp) + 
-    (getCasFromMap(valueIter)).size() + 
-    (getFlagsFromMap(valueIter)).size() +
-    (getValueFromMap(valueIter)).size();
-  gKeyToValueHashMap[hashTblNum].erase(valueIter);
-  gTimestampToKeySet[hashTblNum].erase(timestampKeyIter);
-
-  gKeyToValueMutex[hashTblNum].unlock();
-  gTimestampToKeyMutex[hashTblNum].unlock();
-  return;
-}		/* -----  end of function removeLRUElement  ----- */
+  return item->casUniq;
+}		/* -----  end of function getItemCas  ----- */
 
 /* ===  FUNCTION  ==============================================================
- *         Name:  dbInsertElement
- *  Description:  This function inserts an element into the data structures.
- *                Expiry should be in seconds. Flags and casUniq have to be 
- *                filled if they exist
+ *         Name:  copyValue
+ *  Description:  Copies what an item keeps of its value: the value itself,
+ *                the whole of it for a chunked item, the number in decimal
+ *                for a numeric one, or where it is in external storage.
+ *                Returns false if a chain did not add up
  * =============================================================================
  */
-int dbInsertElement (const string &key, const string &flags, 
-    const string &casUniq, const string &value, const unsigned long int &expiry)
+static bool copyValue (ItemStruct *item, string &value)
 {
-  // For expiry time
-  time_t curSystemTime;
-  time(&curSystemTime);
-  unsigned int hashTblNum = getHashTblNbrFromKey(key);
-  unsigned int origHashTblNum = hashTblNum;
-
-  ValueStruct valueStr;
-  TimestampType timestamp = gTimestamp++;
-  valueStr.value.assign(value);
-  if (expiry != 0)
+  if (item->isChunked)
   {
-    valueStr.expiry = curSystemTime + expiry;
+    return copyChunks(item, value);
   }
-  else
+  if (item->isNumeric)
   {
-    valueStr.expiry = ULONG_MAX;
+    value.assign(to_string(getItemNumber(item)));
+    return true;
   }
-  bool casCheck = true;
-  static unsigned seed = curSystemTime;
-  static mt19937_64 generator (seed);// mt19937_64 is a mersenne_twister_engine
-  valueStr.casUniq.assign (to_string(generator()));
-  if (casUniq.empty())
+  value.assign(dbItemValue(item), 
+      item->isExternal ? sizeof(DbExtRef) : item->valueLen);
+  return true;
+}		/* -----  end of function copyValue  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  parseNumber
+ *  Description:  Reads a value made up only of decimal digits into number.
+ *                Returns false if it is anything else or does not fit in 64
+ *                bits
+ * =============================================================================
+ */
+static bool parseNumber (const char *value, size_t len, uint64_t &number)
+{
+  if (len == 0)
   {
-    casCheck = false;
+    return false;
   }
-  valueStr.flags.assign(flags);
-  
-  while (true) 
+  number = 0;
+  for (size_t pos = 0; pos < len; pos++)
   {
-    if ((gStoredSize + 2 * key.size() + 2 * sizeof(timestamp) + flags.size() +
-          valueStr.casUniq.size() + sizeof(valueStr.expiry) + value.size()) 
-        < gServMemLimit) 
-    {
-      break;
-    }
-    // If heap is used to maximum capacity, delete elements till we can fit in
-    // new element
-    
-    gTimestampToKeyMutex[hashTblNum].lock();
-    if (gTimestampToKeySet[hashTblNum].size() <= 0)
+    if (!isdigit((unsigned char)value[pos]))
     {
-      gTimestampToKeyMutex[hashTblNum].unlock();
-      if (hashTblNum != DB_MAX_HASH_TABLES - 1)
-      {
-        hashTblNum++;
-      }
-      else
-      {
-        hashTblNum = 0;
-      }
-      if (origHashTblNum == hashTblNum)
-      {
-        cout<<"Not enough memory to store even one element"<<endl;
-        return MEMORY_FULL;
-      }
-      continue;
+      return false;
     }
-    else
+    uint64_t digit = value[pos] - '0';
+    if (number > (UINT64_MAX - digit) / 10)
     {
-      gTimestampToKeyMutex[hashTblNum].unlock();
+      return false;
     }
-
-    removeLRUElement(hashTblNum);
+    number = number * 10 + digit;
   }
-  hashTblNum = origHashTblNum;
+  return true;
+}		/* -----  end of function parseNumber  ----- */
 
-  gKeyToValueMutex[hashTblNum].lock();
-  pair<KeyToValueType::iterator, bool> notAlreadyExists;
-  try
+/* ===  FUNCTION  ==============================================================
+ *         Name:  isNumericValue
+ *  Description:  Checks whether a value is kept as a number: a decimal number
+ *                which reads back the same, so without leading zeros
+ * =============================================================================
+ */
+static bool isNumericValue (const string &value, uint64_t &number)
+{
+  return parseNumber(value.data(), value.size(), number) &&
+    ((value.size() == 1) || (value[0] != '0'));
+}		/* -----  end of function isNumericValue  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  releaseItem
+ *  Description:  Releases the memory of an item and of its chunks or
+ *                stripes
+ * =============================================================================
+ */
+static void releaseItem (void *ptr)
+{
+  ItemStruct *item = (ItemStruct *)ptr;
+  if (item->isChunked)
   {
-    notAlreadyExists = gKeyToValueHashMap[hashTblNum].emplace(
-        key, pair<ValueStruct, TimestampType> (valueStr, timestamp));
+    freeChunks(dbItemChain(item)->head);
   }
-  catch (const bad_alloc& ba)
+  if (item->isStriped)
   {
-    return MEMORY_FULL;
+    free(*dbItemStripes(item));
   }
+  dbArenaFree(item);
+}		/* -----  end of function releaseItem  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  freeItem
+ *  Description:  Releases the memory of an item that never made it into the
+ *                index
+ * =============================================================================
+ */
+static void freeItem (ItemStruct *item)
+{
+  releaseItem(item);
+}		/* -----  end of function freeItem  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  getItemRef
+ *  Description:  Returns where the value of an item in external storage is
+ * =============================================================================
+ */
+static DbExtRef getItemRef (ItemStruct *item)
+{
+  DbExtRef ref;
+  memcpy(&ref, dbItemValue(item), sizeof(ref));
+  return ref;
+}		/* -----  end of function getItemRef  ----- */
 
-  TimestampToKeyStruct timestampToKeyDS;
-  timestampToKeyDS.key.assign(key);
-  if (get<1>(notAlreadyExists) != true)
+/* ===  FUNCTION  ==============================================================
+ *         Name:  getItemSize
+ *  Description:  Returns the number of bytes the item is charged for against
+ *                the memory limit: what the allocator really handed out for
+ *                it and its chunks or stripes, the arena chunk or malloc's
+ *                rounding and header
+ * =============================================================================
+ */
+static unsigned long int getItemSize (const ItemStruct *item)
+{
+  if (item->isChunked)
   {
-    // The entry already exists
-    timestampToKeyDS.timestamp = getTimestampFromMap(get<0>(notAlreadyExists));
-    int sizeDiff = sizeof(getExpiryFromMap(get<0>(notAlreadyExists))) - 
-      sizeof(expiry) + getCasFromMap(get<0>(notAlreadyExists)).size() -
-      valueStr.casUniq.size() + getFlagsFromMap(get<0>(notAlreadyExists)).size() -
-      flags.size() + getValueFromMap(get<0>(notAlreadyExists)).size() -
-      value.size();
-    if (casCheck == true)
-    {
-      if ((getCasFromMap(get<0>(notAlreadyExists)).compare(casUniq) 
-            != 0))
-      {
-        gKeyToValueMutex[hashTblNum].unlock();
-        return EXIST;
-      }
-    }
-    setExpiryToMap((get<0>(notAlreadyExists)), curSystemTime + expiry);
-    setCasToMap((get<0>(notAlreadyExists)), valueStr.casUniq);
-    setValueToMap((get<0>(notAlreadyExists)), value);
-    setFlagsToMap((get<0>(notAlreadyExists)), flags);
-    gKeyToValueMutex[hashTblNum].unlock();
-    gTimestampToKeyMutex[hashTblNum].lock();
-    gTimestampToKeySet[hashTblNum].erase(timestampToKeyDS);
-    gTimestampToKeyMutex[hashTblNum].unlock();
-    gStoredSize -= sizeDiff;
+    return dbArenaSize(item) + dbItemChain(item)->allocated;
   }
-  else
+  if (item->isStriped)
   {
-    // New element was created
-    if (casCheck == true)
-    {
-      // Element should not have been created
-      gKeyToValueHashMap[hashTblNum].erase(key);
-      gKeyToValueMutex[hashTblNum].unlock();
-      return NOT_EXIST;
-    }
-    gKeyToValueMutex[hashTblNum].unlock();
-    gStoredSize += 2 * key.size() + 2 * sizeof(timestamp) + 
-      valueStr.casUniq.size() + valueStr.flags.size() + 
-      sizeof(valueStr.expiry) + value.size();
+    return dbArenaSize(item) + sizeof(ItemStripes);
   }
-
-  timestampToKeyDS.timestamp = timestamp;
-  gTimestampToKeyMutex[hashTblNum].lock();
-  gTimestampToKeySet[hashTblNum].insert(timestampToKeyDS);
-  gTimestampToKeyMutex[hashTblNum].unlock();
-  return SUCCESS;
-}		/* -----  end of function dbInsertElement  ----- */
+  return dbArenaSize(item);
+}		/* -----  end of function getItemSize  ----- */
 
 /* ===  FUNCTION  ==============================================================
- *         Name:  dbAddElement
- *  Description:  This function adds an element if it doesn't already exist
- *                Expiry should be in seconds.
+ *         Name:  retireItem
+ *  Description:  Releases the memory of an item which has been removed from
+ *                the index, once no reader can still be copying it. Its value
+ *                in external storage is given up at once
  * =============================================================================
  */
-int dbAddElement (const string &key, const string &flags, const string &casUniq,
-    const string &value, const unsigned long int &expiry)
+static void retireItem (ItemStruct *item)
 {
-  // For expiry time
-  time_t curSystemTime;
-  time(&curSystemTime);
-  unsigned int hashTblNum = getHashTblNbrFromKey(key);
-  unsigned int origHashTblNum = hashTblNum;
-
-  ValueStruct valueStr;
-  TimestampType timestamp = gTimestamp++;
-  valueStr.value.assign(value);
-  if (expiry != 0)
+  if (item->isExternal)
   {
-    valueStr.expiry = curSystemTime + expiry;
+    dbExtRemove(getItemRef(item), item->valueLen);
   }
-  else
+  dbEpochRetire(item, releaseItem, getItemSize(item));
+}		/* -----  end of function retireItem  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  getItemPayload
+ *  Description:  Returns the bytes of the key, flags and value of the item
+ *                kept in memory
+ * =============================================================================
+ */
+static unsigned long int getItemPayload (const ItemStruct *item)
+{
+  if (item->isExternal)
   {
-    valueStr.expiry = ULONG_MAX;
+    return item->keyLen + item->flagsLen;
   }
-  unsigned seed = curSystemTime;
+  return item->keyLen + item->flagsLen + item->valueLen;
+}		/* -----  end of function getItemPayload  ----- */
 
-  mt19937_64 generator (seed);// mt19937_64 is a mersenne_twister_engine
-  valueStr.casUniq.assign (to_string(generator()));
-  valueStr.flags.assign(flags);
+/* ===  FUNCTION  ==============================================================
+ *         Name:  isItemExpired
+ *  Description:  Checks if the item has expired or has been flushed
+ * =============================================================================
+ */
+static bool isItemExpired (const ItemStruct *item, RelTimeType now)
+{
+  return ((item->expiry < now) ||
+      (item->timestamp < gFlushAllTimestamp));
+}		/* -----  end of function isItemExpired  ----- */
 
-  while (true) 
+/* ===  FUNCTION  ==============================================================
+ *         Name:  publishStoredSizeLocked
+ *  Description:  Adds the bytes the hash table has gained or lost since it
+ *                last did so to the total. The lock of the table must be held
+ * =============================================================================
+ */
+static void publishStoredSizeLocked (unsigned int hashTblNum)
+{
+  if (gShardSize[hashTblNum].unpublished != 0)
   {
-    if ((gStoredSize + 2 * key.size() + 2 * sizeof(timestamp) + 
-          sizeof(valueStr.expiry) + value.size()) < gServMemLimit) 
-    {
-      break;
-    }
-    // If heap is used to maximum capacity, delete elements till we can fit in
-    // new element
-    
-    gTimestampToKeyMutex[hashTblNum].lock();
-    if (gTimestampToKeySet[hashTblNum].size() <= 0)
-    {
-      gTimestampToKeyMutex[hashTblNum].unlock();
-      if (hashTblNum != DB_MAX_HASH_TABLES - 1)
-      {
-        hashTblNum++;
-      }
-      else
-      {
-        hashTblNum = 0;
-      }
-      if (origHashTblNum == hashTblNum)
-      {
-        cout<<"Not enough memory to store even one element"<<endl;
-        return MEMORY_FULL;
-      }
-    }
-    else
-    {
-      gTimestampToKeyMutex[hashTblNum].unlock();
-    }
-
-    removeLRUElement(hashTblNum);
+    gStoredSize += gShardSize[hashTblNum].unpublished;
+    gShardSize[hashTblNum].unpublished = 0;
   }
-  hashTblNum = origHashTblNum;
+}		/* -----  end of function publishStoredSizeLocked  ----- */
 
-  gKeyToValueMutex[hashTblNum].lock();
-  pair<KeyToValueType::iterator, bool> notAlreadyExists;
-  try
+/* ===  FUNCTION  ==============================================================
+ *         Name:  changeStoredSizeLocked
+ *  Description:  Accounts for items added to or removed from the hash table.
+ *                The total is only updated once the change is a whole step.
+ *                The lock of the table must be held
+ * =============================================================================
+ */
+static void changeStoredSizeLocked (unsigned int hashTblNum, long int bytes)
+{
+  gShardSize[hashTblNum].storedSize += bytes;
+  gShardSize[hashTblNum].unpublished += bytes;
+  if (labs(gShardSize[hashTblNum].unpublished) >= gStoredSizeSlack)
   {
-    notAlreadyExists = gKeyToValueHashMap[hashTblNum].emplace(
-        key, pair<ValueStruct, TimestampType> (valueStr, timestamp));
+    publishStoredSizeLocked(hashTblNum);
   }
-  catch (const bad_alloc& ba)
+}		/* -----  end of function changeStoredSizeLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  chargeItemLocked
+ *  Description:  Accounts for an item put into or taken out of the hash
+ *                table. The lock of the table must be held
+ * =============================================================================
+ */
+static void chargeItemLocked (unsigned int hashTblNum, const ItemStruct *item,
+    bool isAdded)
+{
+  long int sign = isAdded ? 1 : -1;
+  gShardSize[hashTblNum].payloadSize += sign * (long int)getItemPayload(item);
+  if (item->rawLen > 0)
   {
-    return MEMORY_FULL;
+    gShardSize[hashTblNum].compressedItems += sign;
+    gShardSize[hashTblNum].compressedSize += sign * (long int)item->valueLen;
+    gShardSize[hashTblNum].rawSize += sign * (long int)item->rawLen;
   }
-
-  TimestampToKeyStruct timestampToKeyDS;
-  timestampToKeyDS.key.assign(key);
-  if (get<1>(notAlreadyExists) != true)
+  if (item->isChunked)
   {
-    // The entry already exists
-    timestampToKeyDS.timestamp = getTimestampFromMap(get<0>(notAlreadyExists));
-    if ((getExpiryFromMap(get<0>(notAlreadyExists)) 
-          < (TimestampType)curSystemTime) ||
-        (getTimestampFromMap(get<0>(notAlreadyExists)) < gFlushAllTimestamp))
-    {
-      // Expired
-      setExpiryToMap((get<0>(notAlreadyExists)), curSystemTime + expiry);
-      setCasToMap((get<0>(notAlreadyExists)), valueStr.casUniq);
-      setValueToMap((get<0>(notAlreadyExists)), value);
-      setFlagsToMap((get<0>(notAlreadyExists)), flags);
-      gKeyToValueMutex[hashTblNum].unlock();
-      gTimestampToKeyMutex[hashTblNum].lock();
-      gTimestampToKeySet[hashTblNum].erase(timestampToKeyDS);
-      timestampToKeyDS.timestamp = timestamp;
-      gTimestampToKeySet[hashTblNum].insert(timestampToKeyDS);
-      gTimestampToKeyMutex[hashTblNum].unlock();
-      return SUCCESS;
-    }
-    gKeyToValueMutex[hashTblNum].unlock();
-    return EXIST;
+    gShardSize[hashTblNum].chunkedItems += sign;
+    gShardSize[hashTblNum].chunkedSize += 
+      sign * (long int)dbItemChain(item)->allocated;
   }
-  
-  // New element was created
-  gKeyToValueMutex[hashTblNum].unlock();
-  gStoredSize += 2 * key.size() + 2 * sizeof(timestamp) + 
-    valueStr.casUniq.size() + valueStr.flags.size() + 
-    sizeof(valueStr.expiry) + value.size();
-
-  timestampToKeyDS.timestamp = timestamp;
-  gTimestampToKeyMutex[hashTblNum].lock();
-  gTimestampToKeySet[hashTblNum].insert(timestampToKeyDS);
-  gTimestampToKeyMutex[hashTblNum].unlock();
-  return SUCCESS;
-}		/* -----  end of function dbInsertElement  ----- */
+  changeStoredSizeLocked(hashTblNum, sign * (long int)getItemSize(item));
+}		/* -----  end of function chargeItemLocked  ----- */
 
 /* ===  FUNCTION  ==============================================================
- *         Name:  dbDeleteElement
- *  Description:  This function invalidates the entry in the database based on
- *                the expiry supplied
+ *         Name:  chargeStructuresLocked
+ *  Description:  Accounts for the change in the memory the index, the policy
+ *                and the bump queue of the hash table take up since it was
+ *                last measured. Keys in the queue too long to be kept inside
+ *                their string are not counted. The lock of the table must be
+ *                held
  * =============================================================================
  */
-int dbDeleteElement (const string &key, const unsigned long int expiry)
+static void chargeStructuresLocked (unsigned int hashTblNum)
 {
-  time_t curSystemTime;
-  time(&curSystemTime);
-  unsigned int hashTblNum = getHashTblNbrFromKey(key);
+  long int bytes = gKeyToValueIndex[hashTblNum].getBytes() + 
+    gEvictPolicy[hashTblNum]->getBytes();
+  gBumpQueueMutex[hashTblNum].lock();
+  bytes += gBumpQueue[hashTblNum].capacity() * sizeof(KeyType);
+  gBumpQueueMutex[hashTblNum].unlock();
+  changeStoredSizeLocked(hashTblNum, bytes - gShardSize[hashTblNum].structSize);
+  gShardSize[hashTblNum].structSize = bytes;
+}		/* -----  end of function chargeStructuresLocked  ----- */
 
-  gKeyToValueMutex[hashTblNum].lock();
-  KeyToValueType::iterator it;
-  if ((it = gKeyToValueHashMap[hashTblNum].find(key)) != 
-      gKeyToValueHashMap[hashTblNum].end()) 
+/* ===  FUNCTION  ==============================================================
+ *         Name:  getLowWatermarkLocked
+ *  Description:  Returns the bytes the evictor keeps the hash table under. The
+ *                lock of the table must be held
+ * =============================================================================
+ */
+static long int getLowWatermarkLocked (unsigned int hashTblNum)
+{
+  if (gServEvictWatermark >= 100)
   {
-    // Value exists
-    if ((getExpiryFromMap(it) < (TimestampType)curSystemTime) ||
-        (getTimestampFromMap(it) < gFlushAllTimestamp))
-    {
-      // Already deleted or expired
-      gKeyToValueMutex[hashTblNum].unlock();
-      return NOT_EXIST;
-    }
-    // Value has not already expired. Set new expiry
-    if (expiry == 0)
-    {
-      // We delete only from this list. The timestamptokey entry will be 
-      // deleted when inserting
-      gKeyToValueHashMap[hashTblNum].erase(key);
-      gKeyToValueMutex[hashTblNum].unlock();
-      return SUCCESS;
-    }
-    setExpiryToMap(it, curSystemTime + expiry);
-    gKeyToValueMutex[hashTblNum].unlock();
-    return SUCCESS;
+    return gShardSize[hashTblNum].budget;
   }
-  // Trying to delete a missing entry
-  gKeyToValueMutex[hashTblNum].unlock();
-  return NOT_EXIST;
-}		/* -----  end of function dbDeleteElement  ----- */
+  return gShardSize[hashTblNum].budget / 100 * gServEvictWatermark;
+}		/* -----  end of function getLowWatermarkLocked  ----- */
 
+/* ===  FUNCTION  ==============================================================
+ *         Name:  linkItemLocked
+ *  Description:  Hands an item which has just been put into the index to the
+ *                replacement policy and the expiry wheel. The lock of the hash
+ *                table must be held
+ * =============================================================================
+ */
+static void linkItemLocked (unsigned int hashTblNum, ItemStruct *item)
+{
+  gEvictPolicy[hashTblNum]->onInsert(item);
+  gExpiryWheel[hashTblNum].add(item);
+}		/* -----  end of function linkItemLocked  ----- */
 
 /* ===  FUNCTION  ==============================================================
- *         Name:  dbGetElement
- *  Description:  This function gets the element from the map if it exists.
+ *         Name:  unlinkItemLocked
+ *  Description:  Takes an item which has just been removed from the index off
+ *                the replacement policy and the expiry wheel. The lock of the
+ *                hash table must be held
  * =============================================================================
  */
-int dbGetElement (const string &key, string &flags, string &cas, string &value,
-    unsigned long int &expiry)
+static void unlinkItemLocked (unsigned int hashTblNum, ItemStruct *item, 
+    bool isEvicted)
 {
-  time_t curSystemTime;
-  time(&curSystemTime);
-  unsigned int hashTblNum = getHashTblNbrFromKey(key);
+  gEvictPolicy[hashTblNum]->onRemove(item, isEvicted);
+  gExpiryWheel[hashTblNum].remove(item);
+}		/* -----  end of function unlinkItemLocked  ----- */
 
-  TimestampType timestamp = gTimestamp++;
-  TimestampToKeyStruct timestampToKeyDS;
-  timestampToKeyDS.key.assign(key);
+/* ===  FUNCTION  ==============================================================
+ *         Name:  applyBumpsLocked
+ *  Description:  Reports an access of the given keys to the replacement policy.
+ *                The lock of the hash table must be held
+ * =============================================================================
+ */
+static void applyBumpsLocked (unsigned int hashTblNum, 
+    const vector<KeyType> &keys)
+{
+  RelTimeType now = dbClockNow();
 
-  gKeyToValueMutex[hashTblNum].lock();
-  KeyToValueType::iterator it;
-  if ((it = gKeyToValueHashMap[hashTblNum].find(key)) != 
-      gKeyToValueHashMap[hashTblNum].end()) 
+  for (auto &key: keys)
   {
-    // Value exists
-    if ((getExpiryFromMap(it) < (TimestampType)curSystemTime) ||
-        (getTimestampFromMap(it) < gFlushAllTimestamp))
+    ItemStruct *item = gKeyToValueIndex[hashTblNum].find(key, 
+        getHashFromKey(key));
+    if ((item == NULL) || isItemExpired(item, now))
     {
-      // Value expired
-      gKeyToValueHashMap[hashTblNum].erase(key);
-      gKeyToValueMutex[hashTblNum].unlock();
-      return NOT_EXIST;
+      // Gone or flushed since the bump was queued
+      continue;
     }
-    timestampToKeyDS.timestamp = getTimestampFromMap(it);
-    value.assign(getValueFromMap(it));
-    flags.assign(getFlagsFromMap(it));
-    cas.assign(getCasFromMap(it));
-    expiry = getExpiryFromMap(it) - (TimestampType)curSystemTime;
-    // Updating new timestamp in map
-    setTimestampToMap (it, timestamp);
-    gKeyToValueMutex[hashTblNum].unlock();
-    // Updating the timestamp so that the cache entry doesn't become stale soon
-    gTimestampToKeyMutex[hashTblNum].lock();
-    gTimestampToKeySet[hashTblNum].erase(timestampToKeyDS);
-    timestampToKeyDS.timestamp = timestamp;
-    gTimestampToKeySet[hashTblNum].insert(timestampToKeyDS);
-    gTimestampToKeyMutex[hashTblNum].unlock();
-    return SUCCESS;
+    dbItemTouch(item, now);
+    gEvictPolicy[hashTblNum]->onAccess(item);
+  }
+}		/* -----  end of function applyBumpsLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  applyQueuedBumpsLocked
+ *  Description:  Applies the bumps this thread has buffered and those other
+ *                threads left in the queue of the hash table. The lock of the
+ *                hash table must be held
+ * =============================================================================
+ */
+static void applyQueuedBumpsLocked (unsigned int hashTblNum)
+{
+  vector<KeyType> &buffer = tBumpBuffer[hashTblNum];
+  if (!buffer.empty())
+  {
+    applyBumpsLocked(hashTblNum, buffer);
+    buffer.clear();
+  }
+  if (gBumpQueueLen[hashTblNum].load(memory_order_relaxed) == 0)
+  {
+    return;
+  }
+  vector<KeyType> keys;
+  gBumpQueueMutex[hashTblNum].lock();
+  keys.swap(gBumpQueue[hashTblNum]);
+  gBumpQueueLen[hashTblNum].store(0, memory_order_relaxed);
+  gBumpQueueMutex[hashTblNum].unlock();
+  applyBumpsLocked(hashTblNum, keys);
+}		/* -----  end of function applyQueuedBumpsLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  queueBump
+ *  Description:  Queues an access of the key for the replacement policy. Keys
+ *                are buffered per thread and applied a batch at a time, so a
+ *                get does not touch the policy. A batch is also applied once
+ *                its first key is DB_BUMP_MAX_AGE old. If the hash table is
+ *                busy, the batch is left for whoever holds it, or dropped if
+ *                the queue is full. Only the policy lists and the access time
+ *                change, which the readers without the lock do not depend on,
+ *                so the sequence count is left alone
+ * =============================================================================
+ */
+static void queueBump (unsigned int hashTblNum, const KeyType &key)
+{
+  vector<KeyType> &buffer = tBumpBuffer[hashTblNum];
+  RelTimeType now = dbClockNow();
+  if (buffer.empty())
+  {
+    tBumpBufferTime[hashTblNum] = now;
+  }
+  buffer.push_back(key);
+  if ((buffer.size() < DB_BUMP_BATCH) && 
+      (tBumpBufferTime[hashTblNum] + DB_BUMP_MAX_AGE > now))
+  {
+    return;
+  }
+
+  if (gKeyToValueMutex[hashTblNum].try_lock())
+  {
+    applyBumpsLocked(hashTblNum, buffer);
+    gKeyToValueMutex[hashTblNum].unlock();
+  }
+  else
+  {
+    gBumpQueueMutex[hashTblNum].lock();
+    if (gBumpQueue[hashTblNum].size() + buffer.size() <= DB_BUMP_QUEUE_MAX)
+    {
+      gBumpQueue[hashTblNum].insert(gBumpQueue[hashTblNum].end(), 
+          buffer.begin(), buffer.end());
+      gBumpQueueLen[hashTblNum].store(gBumpQueue[hashTblNum].size(), 
+          memory_order_relaxed);
+    }
+    else
+    {
+      gBumpsDropped += buffer.size();
+    }
+    gBumpQueueMutex[hashTblNum].unlock();
+  }
+  buffer.clear();
+}		/* -----  end of function queueBump  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  isBumpNeeded
+ *  Description:  Items bumped within the bump window are not bumped again
+ * =============================================================================
+ */
+static bool isBumpNeeded (const ItemStruct *item, RelTimeType now)
+{
+  return (item->accessTime + gServBumpWindow <= now);
+}		/* -----  end of function isBumpNeeded  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  recordAccess
+ *  Description:  Notes a read of the item. A policy keeping no order only needs
+ *                the access time, which is set right away. Returns true if the
+ *                access has to be queued for the policy
+ * =============================================================================
+ */
+static bool recordAccess (unsigned int hashTblNum, ItemStruct *item, 
+    RelTimeType now)
+{
+  if (!isBumpNeeded(item, now))
+  {
+    return false;
+  }
+  if (gEvictPolicy[hashTblNum]->isAccessOrdered())
+  {
+    return true;
+  }
+  dbItemTouch(item, now);
+  return false;
+}		/* -----  end of function recordAccess  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  evictElementsLocked
+ *  Description:  Evicts elements from the hash table, stopping once count of
+ *                them or the given bytes have gone, and hands them back in
+ *                evicted to be retired after the lock is let go. The lock of
+ *                the table must be held. Returns the number evicted, 0 if the
+ *                hash table is empty
+ * =============================================================================
+ */
+static unsigned int evictElementsLocked (unsigned int hashTblNum, 
+    unsigned int count, unsigned long int bytes, ItemStruct **evicted)
+{
+  unsigned int evictedCount = 0;
+  unsigned long int evictedBytes = 0;
+
+  // Order has to be up to date before picking a victim
+  applyQueuedBumpsLocked(hashTblNum);
+  while ((evictedCount < count) && (evictedBytes < bytes))
+  {
+    ItemStruct *item = gEvictPolicy[hashTblNum]->chooseVictim();
+    if (item == NULL)
+    {
+      break;
+    }
+    ItemStruct **slot = gKeyToValueIndex[hashTblNum].findItemSlot(item);
+    gKeyToValueIndex[hashTblNum].eraseSlot(slot);
+    unlinkItemLocked(hashTblNum, item, true);
+    evictedBytes += getItemSize(item);
+    chargeItemLocked(hashTblNum, item, false);
+    gShardSize[hashTblNum].victimAccess = item->accessTime;
+    evicted[evictedCount++] = item;
+  }
+  gShardSize[hashTblNum].evictedBytes += evictedBytes;
+  return evictedCount;
+}		/* -----  end of function evictElementsLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  externalizeElementsLocked
+ *  Description:  Moves the values of the items the policy would evict next
+ *                to external storage till about bytes are freed or count
+ *                items are moved. An item keeping only its key, flags and
+ *                where the value is takes the place of each in the policy,
+ *                keeping its access time, so that it is not taken for a
+ *                recently used item. Victims with a value under -V bytes,
+ *                numeric, chunked or already moved are passed over, up to
+ *                DB_EXT_MAX_SKIPPED of them, and left to be evicted. The items
+ *                replaced are put into moved, and their number is returned
+ * =============================================================================
+ */
+static unsigned int externalizeElementsLocked (unsigned int hashTblNum,
+    unsigned int count, unsigned long int bytes, ItemStruct **moved)
+{
+  unsigned int movedCount = 0;
+  unsigned int skippedCount = 0;
+  unsigned long int movedBytes = 0;
+
+  applyQueuedBumpsLocked(hashTblNum);
+  ItemStruct *item = gEvictPolicy[hashTblNum]->chooseVictim();
+  while ((item != NULL) && (movedCount < count) && (movedBytes < bytes))
+  {
+    if (item->isExternal || item->isChunked || item->isNumeric ||
+        (item->valueLen < gServExtMinValue))
+    {
+      if (++skippedCount > DB_EXT_MAX_SKIPPED)
+      {
+        break;
+      }
+      item = gEvictPolicy[hashTblNum]->nextVictim(item);
+      continue;
+    }
+    ItemStruct *stub = (ItemStruct *)dbArenaAlloc(dbItemSize(item->keyLen,
+          item->flagsLen, sizeof(DbExtRef)));
+    if (stub == NULL)
+    {
+      break;
+    }
+    DbExtRef ref;
+    if (!dbExtStage(dbItemValue(item), item->valueLen, ref))
+    {
+      freeItem(stub);
+      break;
+    }
+    memcpy(stub, item, dbItemSize(item->keyLen, item->flagsLen, 0));
+    stub->isExternal = 1;
+    memcpy(dbItemValue(stub), &ref, sizeof(ref));
+
+    *gKeyToValueIndex[hashTblNum].findItemSlot(item) = stub;
+    gEvictPolicy[hashTblNum]->onSwap(item, stub);
+    gExpiryWheel[hashTblNum].remove(item);
+    gExpiryWheel[hashTblNum].add(stub);
+    chargeItemLocked(hashTblNum, item, false);
+    chargeItemLocked(hashTblNum, stub, true);
+    movedBytes += getItemSize(item) - getItemSize(stub);
+    moved[movedCount++] = item;
+    item = gEvictPolicy[hashTblNum]->nextVictim(stub);
+  }
+  return movedCount;
+}		/* -----  end of function externalizeElementsLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  makeRoomForElement
+ *  Description:  Evicts elements of the hash table till an element of the
+ *                given size fits in the table's budget, which the index and
+ *                policy of the table are charged to as well. Only the
+ *                element's own table is touched. If the table has nothing
+ *                left to evict the element may still go over the budget while
+ *                the memory limit, less what is retired and not freed yet, is
+ *                not reached; the next rebalance takes budget from the other
+ *                tables
+ * =============================================================================
+ */
+static int makeRoomForElement (unsigned int hashTblNum, unsigned long int size)
+{
+  ItemStruct *evicted[DB_EVICT_BATCH];
+  ShardSizeStruct &shard = gShardSize[hashTblNum];
+
+  while (true)
+  {
+    lockShard(hashTblNum);
+    chargeStructuresLocked(hashTblNum);
+    long int excess = shard.storedSize + (long int)size - shard.budget;
+    bool isWakeNeeded = 
+      (shard.storedSize + (long int)size > getLowWatermarkLocked(hashTblNum));
+    unsigned int evictedCount = 0;
+    if (excess > 0)
+    {
+      evictedCount = evictElementsLocked(hashTblNum, DB_EVICT_BATCH, excess,
+          evicted);
+      // The total is checked below and by other tables borrowing
+      publishStoredSizeLocked(hashTblNum);
+    }
+    unlockShard(hashTblNum);
+
+    for (unsigned int i = 0; i < evictedCount; i++)
+    {
+      retireItem(evicted[i]);
+    }
+    gEvictionsInline += evictedCount;
+    if (isWakeNeeded)
+    {
+      // The evictor normally keeps the inline eviction from happening
+      dbWakeEvictor();
+    }
+    if (excess <= 0)
+    {
+      return SUCCESS;
+    }
+    if (evictedCount == 0)
+    {
+      if (gStoredSize + (long int)dbEpochRetiredBytes() + (long int)size < 
+          (long int)gServMemLimit)
+      {
+        return SUCCESS;
+      }
+      cout<<"Not enough memory to store even one element"<<endl;
+      return MEMORY_FULL;
+    }
+  }
+}		/* -----  end of function makeRoomForElement  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  evictSizeClassLocked
+ *  Description:  Evicts up to DB_EVICT_BATCH of the items the policy would
+ *                evict next whose memory is an arena chunk of the given size,
+ *                or which hold a chain of chunks if it is the size of a slab,
+ *                looking at no more than DB_CLASS_EVICT_SCAN victims. They are
+ *                handed back in evicted to be retired after the lock is let
+ *                go. The lock of the table must be held. Returns the number
+ *                evicted
+ * =============================================================================
+ */
+static unsigned int evictSizeClassLocked (unsigned int hashTblNum, 
+    size_t chunkSize, ItemStruct **evicted)
+{
+  unsigned int evictedCount = 0;
+  unsigned int scannedCount = 0;
+
+  applyQueuedBumpsLocked(hashTblNum);
+  ItemStruct *item = gEvictPolicy[hashTblNum]->chooseVictim();
+  while ((item != NULL) && (evictedCount < DB_EVICT_BATCH) && 
+      (scannedCount++ < DB_CLASS_EVICT_SCAN))
+  {
+    ItemStruct *next = gEvictPolicy[hashTblNum]->nextVictim(item);
+    if ((dbArenaSize(item) == chunkSize) || 
+        (item->isChunked && (chunkSize == DB_ARENA_SLAB_SIZE)))
+    {
+      ItemStruct **slot = gKeyToValueIndex[hashTblNum].findItemSlot(item);
+      gKeyToValueIndex[hashTblNum].eraseSlot(slot);
+      unlinkItemLocked(hashTblNum, item, true);
+      chargeItemLocked(hashTblNum, item, false);
+      evicted[evictedCount++] = item;
+    }
+    item = next;
+  }
+  return evictedCount;
+}		/* -----  end of function evictSizeClassLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  evictSlabLocked
+ *  Description:  Evicts the items of the hash table whose memory is a chunk
+ *                of the given size in the slab, adding them to evicted to be
+ *                retired after the lock is let go. A chunk not in the index is
+ *                free or belongs to another table. The lock of the table must
+ *                be held
+ * =============================================================================
+ */
+static void evictSlabLocked (unsigned int hashTblNum, char *slab, 
+    size_t chunkSize, vector<ItemStruct *> &evicted)
+{
+  for (size_t offset = 0; offset + chunkSize <= DB_ARENA_SLAB_SIZE; 
+      offset += chunkSize)
+  {
+    ItemStruct *item = (ItemStruct *)(slab + offset);
+    ItemStruct **slot = gKeyToValueIndex[hashTblNum].findItemSlot(item);
+    if (slot == NULL)
+    {
+      continue;
+    }
+    gKeyToValueIndex[hashTblNum].eraseSlot(slot);
+    unlinkItemLocked(hashTblNum, item, true);
+    chargeItemLocked(hashTblNum, item, false);
+    evicted.push_back(item);
+  }
+}		/* -----  end of function evictSlabLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  allocFromMovedSlab
+ *  Description:  Evicts every item in the slab the arena picks out of the
+ *                other size classes, so that it goes back to the arena for
+ *                the class of the size, and allocates like allocItemMemory
+ *                once the items are freed. Returns NULL if no slab could be
+ *                freed in time
+ * =============================================================================
+ */
+static void *allocFromMovedSlab (size_t size, bool isData)
+{
+  size_t slabChunkSize;
+  char *slab = (char *)dbArenaDrainSlab(isData ? DB_ARENA_SLAB_SIZE : size, 
+      slabChunkSize);
+  if (slab == NULL)
+  {
+    return NULL;
+  }
+
+  vector<ItemStruct *> evicted;
+  for (unsigned int tblNum = 0; tblNum < DB_MAX_HASH_TABLES; tblNum++)
+  {
+    lockShard(tblNum);
+    evictSlabLocked(tblNum, slab, slabChunkSize, evicted);
+    publishStoredSizeLocked(tblNum);
+    unlockShard(tblNum);
+  }
+  for (unsigned int i = 0; i < evicted.size(); i++)
+  {
+    retireItem(evicted[i]);
+  }
+  gEvictionsClass += evicted.size();
+
+  void *ptr = NULL;
+  for (unsigned int tries = 0; (ptr == NULL) && 
+      (tries < DB_CLASS_RECLAIM_TRIES); tries++)
+  {
+    dbEpochReclaimAll();
+    ptr = isData ? dbArenaTryAllocData(size) : dbArenaTryAlloc(size);
+  }
+  dbArenaUndrainSlab(slab, slabChunkSize);
+  return ptr;
+}		/* -----  end of function allocFromMovedSlab  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  allocItemMemory
+ *  Description:  Allocates the memory of an item of the hash table, or of a
+ *                piece of a chunked value if isData is set. When the arena
+ *                has no chunk of the size, its slabs having gone to other
+ *                size classes, items holding chunks of that size are evicted,
+ *                from the item's own table first, and the arena is tried
+ *                again once they are freed. If the class has none near the
+ *                end of the eviction order, a slab is moved to it from
+ *                another class. Only then does the memory come from malloc.
+ *                No lock of a table may be held. Returns NULL if there is no
+ *                memory
+ * =============================================================================
+ */
+static void *allocItemMemory (unsigned int hashTblNum, size_t size, 
+    bool isData)
+{
+  void *ptr = isData ? dbArenaTryAllocData(size) : dbArenaTryAlloc(size);
+  size_t chunkSize = dbArenaGetChunkSize(isData ? DB_ARENA_SLAB_SIZE : size);
+  ItemStruct *evicted[DB_EVICT_BATCH];
+
+  for (unsigned int i = 0; 
+      (ptr == NULL) && (chunkSize > 0) && (i < DB_MAX_HASH_TABLES); i++)
+  {
+    unsigned int tblNum = (hashTblNum + i) % DB_MAX_HASH_TABLES;
+    lockShard(tblNum);
+    unsigned int evictedCount = evictSizeClassLocked(tblNum, chunkSize, 
+        evicted);
+    publishStoredSizeLocked(tblNum);
+    unlockShard(tblNum);
+
+    for (unsigned int j = 0; j < evictedCount; j++)
+    {
+      retireItem(evicted[j]);
+    }
+    gEvictionsClass += evictedCount;
+    // The epoch has to move on before the evicted items are freed
+    for (unsigned int tries = 0; (evictedCount > 0) && (ptr == NULL) && 
+        (tries < DB_CLASS_RECLAIM_TRIES); tries++)
+    {
+      dbEpochReclaimAll();
+      ptr = isData ? dbArenaTryAllocData(size) : dbArenaTryAlloc(size);
+    }
+  }
+  if ((ptr == NULL) && (chunkSize > 0))
+  {
+    ptr = allocFromMovedSlab(size, isData);
+  }
+  if (ptr == NULL)
+  {
+    ptr = isData ? dbArenaAllocData(size) : dbArenaAlloc(size);
+  }
+  return ptr;
+}		/* -----  end of function allocItemMemory  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  allocChunks
+ *  Description:  Allocates count chunks linked through next for an item of
+ *                the hash table. Returns NULL if there is no memory
+ * =============================================================================
+ */
+static ItemChunk *allocChunks (unsigned int hashTblNum, size_t count)
+{
+  ItemChunk *chunks = NULL;
+  for (size_t chunkNum = 0; chunkNum < count; chunkNum++)
+  {
+    ItemChunk *chunk = (ItemChunk *)allocItemMemory(hashTblNum, 
+        DB_ITEM_CHUNK_SIZE, true);
+    if (chunk == NULL)
+    {
+      freeChunks(chunks);
+      return NULL;
+    }
+    chunk->next = chunks;
+    chunks = chunk;
+  }
+  return chunks;
+}		/* -----  end of function allocChunks  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  createItem
+ *  Description:  Allocates an item and copies the key, flags and value into it.
+ *                Decimal numbers are kept as numbers. Values of more than -C
+ *                bytes go into a chain of chunks, and values of -z bytes or
+ *                more are compressed first, outside any lock. Returns NULL if
+ *                there is no memory
+ * =============================================================================
+ */
+static ItemStruct *createItem (const string &key, size_t hash, 
+    const string &flags, const string &value, RelTimeType expiry,
+    TimestampType timestamp, RelTimeType now, unsigned int cost)
+{
+  uint64_t number;
+  bool isNumeric = isNumericValue(value, number);
+  bool isChunked = (!isNumeric && (gServChunkMin > 0) && 
+      (value.size() > gServChunkMin));
+  bool isCompressed = !isNumeric && !isChunked && compressValue(value);
+  const string &stored = isCompressed ? tCompressBuffer : value;
+  size_t valueLen = stored.size();
+  if (isNumeric)
+  {
+    valueLen = sizeof(number);
+  }
+  else if (isChunked)
+  {
+    valueLen = DB_ITEM_CHAIN_SIZE;
+  }
+  unsigned int hashTblNum = getHashTblNbrFromKey(key);
+  ItemStruct *item = (ItemStruct *)allocItemMemory(hashTblNum, 
+      dbItemSize(key.size(), flags.size(), valueLen), false);
+  if (item == NULL)
+  {
+    return NULL;
+  }
+  item->timestamp = timestamp;
+  item->accessTime = now;
+  item->expiry = expiry;
+  item->casUniq = dbGetNewCas();
+  item->hash = hash;
+  item->priority = 0;
+  item->cost = (cost == DB_ITEM_COST_KEEP) ? DB_DEF_ITEM_COST : cost;
+  item->frequency = 0;
+  item->keyLen = key.size();
+  item->flagsLen = flags.size();
+  item->valueLen = stored.size();
+  item->rawLen = isCompressed ? value.size() : 0;
+  item->isExternal = 0;
+  item->isChunked = isChunked ? 1 : 0;
+  item->isNumeric = isNumeric ? 1 : 0;
+  item->isStriped = 0;
+  item->contention = 0;
+  item->incrCount = 0;
+  memcpy(item->data, key.data(), key.size());
+  memcpy(item->data + key.size(), flags.data(), flags.size());
+  if (isNumeric)
+  {
+    item->valueLen = sizeof(number);
+    memcpy(dbItemValue(item), &number, sizeof(number));
+    return item;
+  }
+  if (!isChunked)
+  {
+    memcpy(dbItemValue(item), stored.data(), stored.size());
+    return item;
+  }
+
+  ItemChunkChain *chain = dbItemChain(item);
+  chain->head = NULL;
+  chain->tail = NULL;
+  chain->allocated = 0;
+  ItemChunk *spare = allocChunks(hashTblNum, 
+      (value.size() + DB_ITEM_CHUNK_DATA - 1) / DB_ITEM_CHUNK_DATA);
+  if (spare == NULL)
+  {
+    dbArenaFree(item);
+    return NULL;
+  }
+  appendChunks(chain, value.data(), value.size(), spare);
+  return item;
+}		/* -----  end of function createItem  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  getStripeNum
+ *  Description:  Returns the stripe of a striped counter the calling thread
+ *                adds to, the one of the core it runs on, so that threads on
+ *                different cores add to different cache lines
+ * =============================================================================
+ */
+static unsigned int getStripeNum ()
+{
+  int cpu = sched_getcpu();
+  return (cpu < 0) ? 0 : ((unsigned int)cpu % DB_ITEM_STRIPES);
+}		/* -----  end of function getStripeNum  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  addToStripe
+ *  Description:  Adds delta to the stripe of the calling thread, without the
+ *                lock. The add is counted in inflight while it is made, for
+ *                sealStripes to wait for. Returns false, adding nothing, if
+ *                the stripes have been sealed
+ * =============================================================================
+ */
+static bool addToStripe (ItemStripes *stripes, uint64_t delta)
+{
+  ItemStripe *stripe = &stripes->stripe[getStripeNum()];
+  __atomic_fetch_add(&stripe->inflight, 1, __ATOMIC_SEQ_CST);
+  bool isSealed = (__atomic_load_n(&stripes->sealed, __ATOMIC_SEQ_CST) != 0);
+  if (!isSealed)
+  {
+    __atomic_fetch_add(&stripe->sum, delta, __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_sub(&stripe->inflight, 1, __ATOMIC_RELEASE);
+  return !isSealed;
+}		/* -----  end of function addToStripe  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  sealStripes
+ *  Description:  Stops the adds to the stripes of a striped counter, waits
+ *                for those already being made and returns the number they
+ *                stand for. An add either sees the seal or is waited for, so
+ *                none is lost. The lock of the hash table must be held
+ * =============================================================================
+ */
+static uint64_t sealStripes (ItemStripes *stripes)
+{
+  __atomic_store_n(&stripes->sealed, 1, __ATOMIC_SEQ_CST);
+  for (unsigned int stripeNum = 0; stripeNum < DB_ITEM_STRIPES; stripeNum++)
+  {
+    while (__atomic_load_n(&stripes->stripe[stripeNum].inflight, 
+          __ATOMIC_SEQ_CST) != 0)
+    {
+      this_thread::yield();
+    }
+  }
+  return foldStripes(stripes);
+}		/* -----  end of function sealStripes  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  unstripeLocked
+ *  Description:  Folds a striped counter back into a numeric item, in place.
+ *                It keeps the cas value it was last read with. The stripes
+ *                are freed once no thread can still be reading them. The
+ *                lock of the hash table must be held
+ * =============================================================================
+ */
+static void unstripeLocked (unsigned int hashTblNum, ItemStruct *item)
+{
+  ItemStripes *stripes = *dbItemStripes(item);
+  uint64_t number = sealStripes(stripes);
+  chargeItemLocked(hashTblNum, item, false);
+  item->casUniq += number;
+  item->isStriped = 0;
+  item->contention = 0;
+  item->incrCount = 0;
+  memcpy(dbItemValue(item), &number, sizeof(number));
+  chargeItemLocked(hashTblNum, item, true);
+  dbEpochRetire(stripes, free, sizeof(ItemStripes));
+  gCountersFolded++;
+}		/* -----  end of function unstripeLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  storeElement
+ *  Description:  Puts an element into the data structures, under a single hold
+ *                of the lock. If casUniq is given, or isReplace set, the
+ *                element must already exist and has to be live for a replace
+ * =============================================================================
+ */
+static int storeElement (const string &key, const string &flags, 
+    const string &casUniq, const string &value, const unsigned long int &expiry,
+    unsigned int cost, bool isReplace)
+{
+  // For expiry time
+  RelTimeType now = dbClockNow();
+  unsigned int hashTblNum = getHashTblNbrFromKey(key);
+  size_t hash = getHashFromKey(key);
+
+  TimestampType timestamp = gFlushAllTimestamp;
+  RelTimeType itemExpiry = dbClockExpiry(expiry, now);
+  bool casCheck = true;
+  if (casUniq.empty())
+  {
+    casCheck = false;
+  }
+  ItemStruct *newItem = createItem(key, hash, flags, value, itemExpiry, 
+      timestamp, now, cost);
+  if (newItem == NULL)
+  {
+    return MEMORY_FULL;
+  }
+  
+  if (makeRoomForElement(hashTblNum, getItemSize(newItem)) != SUCCESS)
+  {
+    freeItem(newItem);
+    return MEMORY_FULL;
+  }
+
+  lockShard(hashTblNum);
+  applyQueuedBumpsLocked(hashTblNum);
+  ItemStruct **slot = gKeyToValueIndex[hashTblNum].findSlot(key, hash);
+  if ((slot != NULL) && isReplace && isItemExpired(*slot, now))
+  {
+    // Left for the crawler, as if it were gone already
+    slot = NULL;
+  }
+
+  if (slot != NULL)
+  {
+    // The entry already exists
+    ItemStruct *oldItem = *slot;
+    if (casCheck == true)
+    {
+      if (oldItem->isStriped)
+      {
+        // An incr not taking the lock after the check would be lost
+        unstripeLocked(hashTblNum, oldItem);
+      }
+      if (to_string(oldItem->casUniq).compare(casUniq) != 0)
+      {
+        unlockShard(hashTblNum);
+        freeItem(newItem);
+        return EXIST;
+      }
+    }
+    if (cost == DB_ITEM_COST_KEEP)
+    {
+      newItem->cost = oldItem->cost;
+    }
+    *slot = newItem;
+    gEvictPolicy[hashTblNum]->onReplace(oldItem, newItem);
+    gExpiryWheel[hashTblNum].remove(oldItem);
+    gExpiryWheel[hashTblNum].add(newItem);
+    chargeItemLocked(hashTblNum, oldItem, false);
+    chargeItemLocked(hashTblNum, newItem, true);
+    unlockShard(hashTblNum);
+    retireItem(oldItem);
+  }
+  else
+  {
+    // New element has to be created
+    if ((casCheck == true) || isReplace)
+    {
+      // Element should not have been created
+      unlockShard(hashTblNum);
+      freeItem(newItem);
+      return NOT_EXIST;
+    }
+    try
+    {
+      gKeyToValueIndex[hashTblNum].insert(newItem);
+    }
+    catch (const bad_alloc& ba)
+    {
+      unlockShard(hashTblNum);
+      freeItem(newItem);
+      return MEMORY_FULL;
+    }
+    linkItemLocked(hashTblNum, newItem);
+    chargeItemLocked(hashTblNum, newItem, true);
+    unlockShard(hashTblNum);
+  }
+  return SUCCESS;
+}		/* -----  end of function storeElement  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbInsertElement
+ *  Description:  This function inserts an element into the data structures.
+ *                Expiry should be in seconds. Flags and casUniq have to be 
+ *                filled if they exist. A cost of DB_ITEM_COST_KEEP keeps the
+ *                cost of the element being replaced
+ * =============================================================================
+ */
+int dbInsertElement (const string &key, const string &flags, 
+    const string &casUniq, const string &value, const unsigned long int &expiry,
+    unsigned int cost)
+{
+  if (gServStorageEngine == DB_ENGINE_SEGMENT)
+  {
+    return dbSegInsertElement(key, flags, casUniq, value, expiry);
+  }
+  return storeElement(key, flags, casUniq, value, expiry, cost, false);
+}		/* -----  end of function dbInsertElement  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbReplaceElement
+ *  Description:  Stores an element only if it already exists, checking for
+ *                it under the same hold of the lock as the store. Expiry
+ *                should be in seconds
+ * =============================================================================
+ */
+int dbReplaceElement (const string &key, const string &flags, 
+    const string &casUniq, const string &value, const unsigned long int &expiry,
+    unsigned int cost)
+{
+  if (gServStorageEngine == DB_ENGINE_SEGMENT)
+  {
+    return dbSegReplaceElement(key, flags, value, expiry);
+  }
+  return storeElement(key, flags, casUniq, value, expiry, cost, true);
+}		/* -----  end of function dbReplaceElement  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbAddElement
+ *  Description:  This function adds an element if it doesn't already exist
+ *                Expiry should be in seconds.
+ * =============================================================================
+ */
+int dbAddElement (const string &key, const string &flags, const string &casUniq,
+    const string &value, const unsigned long int &expiry, unsigned int cost)
+{
+  if (gServStorageEngine == DB_ENGINE_SEGMENT)
+  {
+    return dbSegAddElement(key, flags, value, expiry);
+  }
+  // For expiry time
+  RelTimeType now = dbClockNow();
+  unsigned int hashTblNum = getHashTblNbrFromKey(key);
+  size_t hash = getHashFromKey(key);
+
+  TimestampType timestamp = gFlushAllTimestamp;
+  RelTimeType itemExpiry = dbClockExpiry(expiry, now);
+  ItemStruct *newItem = createItem(key, hash, flags, value, itemExpiry, 
+      timestamp, now, cost);
+  if (newItem == NULL)
+  {
+    return MEMORY_FULL;
+  }
+
+  if (makeRoomForElement(hashTblNum, getItemSize(newItem)) != SUCCESS)
+  {
+    freeItem(newItem);
+    return MEMORY_FULL;
+  }
+
+  lockShard(hashTblNum);
+  applyQueuedBumpsLocked(hashTblNum);
+  ItemStruct **slot = gKeyToValueIndex[hashTblNum].findSlot(key, hash);
+
+  if (slot != NULL)
+  {
+    // The entry already exists
+    ItemStruct *oldItem = *slot;
+    if (isItemExpired(oldItem, now))
+    {
+      // Expired. The new item is not an access of the old one
+      *slot = newItem;
+      unlinkItemLocked(hashTblNum, oldItem, false);
+      linkItemLocked(hashTblNum, newItem);
+      chargeItemLocked(hashTblNum, oldItem, false);
+      chargeItemLocked(hashTblNum, newItem, true);
+      unlockShard(hashTblNum);
+      retireItem(oldItem);
+      return SUCCESS;
+    }
+    unlockShard(hashTblNum);
+    freeItem(newItem);
+    return EXIST;
+  }
+  
+  // New element has to be created
+  try
+  {
+    gKeyToValueIndex[hashTblNum].insert(newItem);
+  }
+  catch (const bad_alloc& ba)
+  {
+    unlockShard(hashTblNum);
+    freeItem(newItem);
+    return MEMORY_FULL;
+  }
+  linkItemLocked(hashTblNum, newItem);
+  chargeItemLocked(hashTblNum, newItem, true);
+  unlockShard(hashTblNum);
+  return SUCCESS;
+}		/* -----  end of function dbAddElement  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  addToValueLocked
+ *  Description:  Adds data to the end of the value of an item, or to its
+ *                start if isPrepend is set, where the item is: into the
+ *                slack of its allocation, or for a chunked value into its
+ *                last or first chunk and the chunks taken off spare. The
+ *                lock of the hash table must be held
+ * =============================================================================
+ */
+static void addToValueLocked (unsigned int hashTblNum, ItemStruct *item,
+    const string &data, bool isPrepend, ItemChunk *&spare)
+{
+  chargeItemLocked(hashTblNum, item, false);
+  if (item->isChunked && isPrepend)
+  {
+    prependChunks(dbItemChain(item), data.data(), data.size(), spare);
+  }
+  else if (item->isChunked)
+  {
+    appendChunks(dbItemChain(item), data.data(), data.size(), spare);
+  }
+  else if (isPrepend)
+  {
+    char *value = dbItemValue(item);
+    memmove(value + data.size(), value, item->valueLen);
+    memcpy(value, data.data(), data.size());
+  }
+  else
+  {
+    memcpy(dbItemValue(item) + item->valueLen, data.data(), data.size());
+  }
+  item->valueLen += data.size();
+  item->casUniq = dbGetNewCas();
+  chargeItemLocked(hashTblNum, item, true);
+}		/* -----  end of function addToValueLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  replaceItemLocked
+ *  Description:  Puts newItem in the place of the item in the slot, in the
+ *                index, the policy and the expiry wheel. The lock of the hash
+ *                table must be held, and the item replaced is left to be
+ *                retired
+ * =============================================================================
+ */
+static void replaceItemLocked (unsigned int hashTblNum, ItemStruct **slot,
+    ItemStruct *newItem)
+{
+  ItemStruct *item = *slot;
+  *slot = newItem;
+  gEvictPolicy[hashTblNum]->onReplace(item, newItem);
+  gExpiryWheel[hashTblNum].remove(item);
+  gExpiryWheel[hashTblNum].add(newItem);
+  chargeItemLocked(hashTblNum, item, false);
+  chargeItemLocked(hashTblNum, newItem, true);
+}		/* -----  end of function replaceItemLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  growItemLocked
+ *  Description:  Copies the item in the slot into grown, a larger allocation,
+ *                adding data to its value like addToValueLocked, and puts
+ *                grown in its place. The lock of the hash table must be
+ *                held, and the item replaced is left to be retired
+ * =============================================================================
+ */
+static void growItemLocked (unsigned int hashTblNum, ItemStruct **slot,
+    ItemStruct *grown, const string &data, bool isPrepend)
+{
+  ItemStruct *item = *slot;
+  memcpy(grown, item, dbItemSize(item->keyLen, item->flagsLen, 0));
+  char *value = dbItemValue(grown);
+  memcpy(value + (isPrepend ? data.size() : 0), dbItemValue(item), 
+      item->valueLen);
+  memcpy(value + (isPrepend ? 0 : item->valueLen), data.data(), data.size());
+  grown->valueLen += data.size();
+  grown->casUniq = dbGetNewCas();
+  replaceItemLocked(hashTblNum, slot, grown);
+}		/* -----  end of function growItemLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbAppendElement
+ *  Description:  Adds data to the end of the value of an element, or to its
+ *                start if isPrepend is set, under a single hold of the lock.
+ *                The flags, expiry and cost are kept and a new cas value
+ *                given. The value grows in place if its allocation has room,
+ *                and a chunked value by linking chunks; otherwise the item is
+ *                copied into an allocation with room to spare. Memory is
+ *                allocated with the lock let go and the element looked up
+ *                again. Returns FAILURE for a value which has to be stored
+ *                again as a whole: compressed, numeric, in external storage,
+ *                or growing past -C bytes
+ * =============================================================================
+ */
+int dbAppendElement (const string &key, const string &data, bool isPrepend)
+{
+  if (gServStorageEngine == DB_ENGINE_SEGMENT)
+  {
+    return FAILURE;
+  }
+  RelTimeType now = dbClockNow();
+  unsigned int hashTblNum = getHashTblNbrFromKey(key);
+  size_t hash = getHashFromKey(key);
+
+  ItemChunk *spare = NULL;
+  size_t spareCount = 0;
+  ItemStruct *grown = NULL;
+  ItemStruct *replaced = NULL;
+  int ret;
+  bool bumpNeeded = false;
+  while (true)
+  {
+    lockShard(hashTblNum);
+    ItemStruct **slot = gKeyToValueIndex[hashTblNum].findSlot(key, hash);
+    if ((slot == NULL) || isItemExpired(*slot, now))
+    {
+      ret = NOT_EXIST;
+      break;
+    }
+    ItemStruct *item = *slot;
+    size_t len = (size_t)item->valueLen + data.size();
+    if (item->isExternal || (item->rawLen > 0) || item->isNumeric ||
+        (!item->isChunked && (gServChunkMin > 0) && (len > gServChunkMin)))
+    {
+      ret = FAILURE;
+      break;
+    }
+    if (len > UINT_MAX)
+    {
+      ret = MEMORY_FULL;
+      break;
+    }
+    // Chunks to link, or the bytes of a larger allocation
+    size_t needed = 0;
+    size_t size = 0;
+    if (item->isChunked)
+    {
+      ItemChunkChain *chain = dbItemChain(item);
+      size_t room = isPrepend ? chain->head->start : 
+        (DB_ITEM_CHUNK_DATA - chain->tail->start - chain->tail->used);
+      needed = (data.size() <= room) ? 0 : ((data.size() - room + 
+            DB_ITEM_CHUNK_DATA - 1) / DB_ITEM_CHUNK_DATA);
+    }
+    else if (dbItemSize(item->keyLen, item->flagsLen, len) > 
+        dbArenaUsableSize(item))
+    {
+      size = dbItemSize(item->keyLen, item->flagsLen, len);
+    }
+
+    if ((size == 0) && (needed <= spareCount))
+    {
+      addToValueLocked(hashTblNum, item, data, isPrepend, spare);
+      bumpNeeded = recordAccess(hashTblNum, item, now);
+      ret = SUCCESS;
+      break;
+    }
+    if ((size > 0) && (grown != NULL) && 
+        (size <= dbArenaUsableSize(grown)))
+    {
+      growItemLocked(hashTblNum, slot, grown, data, isPrepend);
+      bumpNeeded = recordAccess(hashTblNum, grown, now);
+      replaced = item;
+      grown = NULL;
+      ret = SUCCESS;
+      break;
+    }
+    unlockShard(hashTblNum);
+
+    if (size > 0)
+    {
+      if (grown != NULL)
+      {
+        dbArenaFree(grown);
+      }
+      size_t allocSize = size + size / DB_APPEND_SLACK_DIV;
+      if ((size <= DB_ARENA_SLAB_SIZE) && (allocSize > DB_ARENA_SLAB_SIZE))
+      {
+        allocSize = DB_ARENA_SLAB_SIZE;
+      }
+      grown = (ItemStruct *)allocItemMemory(hashTblNum, allocSize, false);
+      if ((grown != NULL) && (makeRoomForElement(hashTblNum, 
+              dbArenaSize(grown)) == SUCCESS))
+      {
+        continue;
+      }
+    }
+    else
+    {
+      ItemChunk *chunks = allocChunks(hashTblNum, needed - spareCount);
+      if ((chunks != NULL) && (makeRoomForElement(hashTblNum, 
+              needed * DB_ITEM_CHUNK_SIZE) == SUCCESS))
+      {
+        ItemChunk *last = chunks;
+        while (last->next != NULL)
+        {
+          last = last->next;
+        }
+        last->next = spare;
+        spare = chunks;
+        spareCount = needed;
+        continue;
+      }
+      freeChunks(chunks);
+    }
+    freeChunks(spare);
+    if (grown != NULL)
+    {
+      dbArenaFree(grown);
+    }
+    return MEMORY_FULL;
+  }
+  unlockShard(hashTblNum);
+  freeChunks(spare);
+  if (grown != NULL)
+  {
+    dbArenaFree(grown);
+  }
+  if (replaced != NULL)
+  {
+    retireItem(replaced);
+  }
+  if (bumpNeeded)
+  {
+    queueBump(hashTblNum, key);
+  }
+  return ret;
+}		/* -----  end of function dbAppendElement  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  applyDelta
+ *  Description:  Returns the number after an incr by delta, which wraps
+ *                around, or a decr if isDecr is set, which stops at 0
+ * =============================================================================
+ */
+static uint64_t applyDelta (uint64_t number, uint64_t delta, bool isDecr)
+{
+  if (!isDecr)
+  {
+    return number + delta;
+  }
+  return (number <= delta) ? 0 : (number - delta);
+}		/* -----  end of function applyDelta  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  incrByStoring
+ *  Description:  Does an incr or decr in the segment engine, which keeps no
+ *                numbers: the value is read, and the result stored with the
+ *                cas value read, again till no other client got in between
+ * =============================================================================
+ */
+static int incrByStoring (const string &key, uint64_t delta, bool isDecr,
+    unsigned long long int &result)
+{
+  while (true)
+  {
+    string flags, cas, value;
+    unsigned long int expiry;
+    if (dbSegGetElement(key, flags, cas, value, expiry) != SUCCESS)
+    {
+      return NOT_EXIST;
+    }
+    uint64_t number;
+    if (!parseNumber(value.data(), value.size(), number))
+    {
+      return FAILURE;
+    }
+    result = applyDelta(number, delta, isDecr);
+    int ret = dbSegInsertElement(key, flags, cas, to_string(result), expiry);
+    if (ret != EXIST)
+    {
+      return ret;
+    }
+  }
+}		/* -----  end of function incrByStoring  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  isShardUnchanged
+ *  Description:  Checks that no writer has locked the hash table since the
+ *                sequence count seq was read
+ * =============================================================================
+ */
+static bool isShardUnchanged (unsigned int hashTblNum, unsigned long int seq)
+{
+  atomic_thread_fence(memory_order_acquire);
+  return (gKeyToValueSeq[hashTblNum].seq.load(memory_order_relaxed) == seq);
+}		/* -----  end of function isShardUnchanged  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  isCounterHot
+ *  Description:  Counts the incrs of a numeric item in the current clock
+ *                tick. Returns true once there are -H of them and any found
+ *                the lock held by another thread, for the counter to be
+ *                striped. The lock is shared by the keys of the hash table,
+ *                so the rate of the counter itself decides and contention
+ *                only tells that it is incremented from several threads
+ * =============================================================================
+ */
+static bool isCounterHot (ItemStruct *item, RelTimeType now, bool isContended)
+{
+  if (gServStripeRate == 0)
+  {
+    return false;
+  }
+  if (item->incrTick != (unsigned char)now)
+  {
+    item->incrTick = (unsigned char)now;
+    item->incrCount = 0;
+    item->contention = 0;
+  }
+  if (item->incrCount < USHRT_MAX)
+  {
+    item->incrCount++;
+  }
+  if (isContended && (item->contention < UCHAR_MAX))
+  {
+    item->contention++;
+  }
+  return ((item->incrCount >= gServStripeRate) && (item->contention > 0));
+}		/* -----  end of function isCounterHot  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  stripeItemLocked
+ *  Description:  Puts a striped counter standing for number in the place of
+ *                the numeric item in the slot. The lock of the hash table
+ *                must be held. Returns the item replaced, to be retired, or
+ *                NULL if there is no memory, the item then staying as it is
+ * =============================================================================
+ */
+static ItemStruct *stripeItemLocked (unsigned int hashTblNum, 
+    ItemStruct **slot, uint64_t number)
+{
+  ItemStruct *item = *slot;
+  void *stripes;
+  if (posix_memalign(&stripes, alignof(ItemStripes), 
+        sizeof(ItemStripes)) != 0)
+  {
+    return NULL;
+  }
+  ItemStruct *striped = (ItemStruct *)dbArenaAlloc(dbItemSize(item->keyLen, 
+        item->flagsLen, DB_ITEM_STRIPED_SIZE));
+  if (striped == NULL)
+  {
+    free(stripes);
+    return NULL;
+  }
+  memset(stripes, 0, sizeof(ItemStripes));
+  ((ItemStripes *)stripes)->stripe[0].sum = number;
+  memcpy(striped, item, dbItemSize(item->keyLen, item->flagsLen, 0));
+  memcpy(dbItemValue(striped), &number, sizeof(number));
+  *dbItemStripes(striped) = (ItemStripes *)stripes;
+  striped->isStriped = 1;
+  striped->contention = 0;
+  striped->incrCount = 0;
+  striped->casUniq = dbGetNewCas();
+  replaceItemLocked(hashTblNum, slot, striped);
+  gCountersStriped++;
+  return item;
+}		/* -----  end of function stripeItemLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  incrStriped
+ *  Description:  Adds delta to a striped counter without taking the lock of
+ *                the hash table, found the way getElementOptimistic finds an
+ *                element, and sets result to its number after the add.
+ *                Returns FAILURE if the locked path has to be taken: the
+ *                element is no striped counter, or has been sealed
+ * =============================================================================
+ */
+static int incrStriped (unsigned int hashTblNum, const string &key,
+    size_t hash, RelTimeType now, uint64_t delta, 
+    unsigned long long int &result)
+{
+  if (!dbEpochEnter())
+  {
+    return FAILURE;
+  }
+  int ret = FAILURE;
+  bool bumpNeeded = false;
+  for (unsigned int tries = 0; tries < DB_OPTIMISTIC_READ_TRIES; tries++)
+  {
+    unsigned long int seq = 
+      gKeyToValueSeq[hashTblNum].seq.load(memory_order_acquire);
+    if ((seq & 1) != 0)
+    {
+      // A writer has the table
+      continue;
+    }
+    ItemStruct *item = gKeyToValueIndex[hashTblNum].find(key, hash);
+    if ((item == NULL) || !item->isStriped || isItemExpired(item, now))
+    {
+      break;
+    }
+    ItemStripes *stripes = __atomic_load_n(dbItemStripes(item), 
+        __ATOMIC_ACQUIRE);
+    if (!isShardUnchanged(hashTblNum, seq))
+    {
+      continue;
+    }
+    if (addToStripe(stripes, delta))
+    {
+      result = foldStripes(stripes);
+      bumpNeeded = recordAccess(hashTblNum, item, now);
+      ret = SUCCESS;
+    }
+    break;
+  }
+  dbEpochExit();
+  if (bumpNeeded)
+  {
+    queueBump(hashTblNum, key);
+  }
+  return ret;
+}		/* -----  end of function incrStriped  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbIncrElement
+ *  Description:  Adds delta to the number stored under the key, or takes it
+ *                away if isDecr is set, under a single hold of the lock, and
+ *                sets result to the new number. The number is changed where
+ *                it is kept. A number still kept in decimal is turned into a
+ *                numeric item, in place if its allocation is large enough.
+ *                A counter whose incrs keep finding the lock held is
+ *                striped, and incrs of it add to a stripe without the lock.
+ *                A decr folds it back first, as it must not go below 0.
+ *                Returns FAILURE if the value is not a decimal number
+ * =============================================================================
+ */
+int dbIncrElement (const string &key, unsigned long long int delta, 
+    bool isDecr, unsigned long long int &result)
+{
+  if (gServStorageEngine == DB_ENGINE_SEGMENT)
+  {
+    return incrByStoring(key, delta, isDecr, result);
+  }
+  RelTimeType now = dbClockNow();
+  unsigned int hashTblNum = getHashTblNbrFromKey(key);
+  size_t hash = getHashFromKey(key);
+  if (!isDecr && 
+      (incrStriped(hashTblNum, key, hash, now, delta, result) == SUCCESS))
+  {
+    return SUCCESS;
+  }
+
+  ItemStruct *numeric = NULL;
+  ItemStruct *replaced = NULL;
+  int ret;
+  bool bumpNeeded = false;
+  while (true)
+  {
+    bool isContended = lockShardContended(hashTblNum);
+    ItemStruct **slot = gKeyToValueIndex[hashTblNum].findSlot(key, hash);
+    if ((slot == NULL) || isItemExpired(*slot, now))
+    {
+      ret = NOT_EXIST;
+      break;
+    }
+    ItemStruct *item = *slot;
+    if (item->isStriped && !isDecr)
+    {
+      // Stripes are only sealed under the lock, so the add is made
+      addToStripe(*dbItemStripes(item), delta);
+      result = getItemNumber(item);
+      bumpNeeded = recordAccess(hashTblNum, item, now);
+      ret = SUCCESS;
+      break;
+    }
+    if (item->isStriped)
+    {
+      unstripeLocked(hashTblNum, item);
+    }
+    uint64_t number;
+    if (item->isNumeric)
+    {
+      number = dbItemNumber(item);
+    }
+    else if (item->isExternal || (item->rawLen > 0) || item->isChunked ||
+        !parseNumber(dbItemValue(item), item->valueLen, number))
+    {
+      ret = FAILURE;
+      break;
+    }
+    number = applyDelta(number, delta, isDecr);
+    result = number;
+
+    size_t size = dbItemSize(item->keyLen, item->flagsLen, sizeof(number));
+    if (item->isNumeric || (size <= dbArenaUsableSize(item)))
+    {
+      chargeItemLocked(hashTblNum, item, false);
+      item->isNumeric = 1;
+      item->valueLen = sizeof(number);
+      memcpy(dbItemValue(item), &number, sizeof(number));
+      item->casUniq = dbGetNewCas();
+      chargeItemLocked(hashTblNum, item, true);
+      if (!isDecr && isCounterHot(item, now, isContended))
+      {
+        replaced = stripeItemLocked(hashTblNum, slot, number);
+      }
+      bumpNeeded = recordAccess(hashTblNum, *slot, now);
+      ret = SUCCESS;
+      break;
+    }
+    if ((numeric != NULL) && (size <= dbArenaUsableSize(numeric)))
+    {
+      memcpy(numeric, item, dbItemSize(item->keyLen, item->flagsLen, 0));
+      numeric->isNumeric = 1;
+      numeric->valueLen = sizeof(number);
+      memcpy(dbItemValue(numeric), &number, sizeof(number));
+      numeric->casUniq = dbGetNewCas();
+      replaceItemLocked(hashTblNum, slot, numeric);
+      bumpNeeded = recordAccess(hashTblNum, numeric, now);
+      replaced = item;
+      numeric = NULL;
+      ret = SUCCESS;
+      break;
+    }
+    unlockShard(hashTblNum);
+
+    if (numeric != NULL)
+    {
+      dbArenaFree(numeric);
+    }
+    numeric = (ItemStruct *)allocItemMemory(hashTblNum, size, false);
+    if ((numeric == NULL) || 
+        (makeRoomForElement(hashTblNum, dbArenaSize(numeric)) != SUCCESS))
+    {
+      if (numeric != NULL)
+      {
+        dbArenaFree(numeric);
+      }
+      return MEMORY_FULL;
+    }
+  }
+  unlockShard(hashTblNum);
+  if (numeric != NULL)
+  {
+    dbArenaFree(numeric);
+  }
+  if (replaced != NULL)
+  {
+    retireItem(replaced);
+  }
+  if (bumpNeeded)
+  {
+    queueBump(hashTblNum, key);
+  }
+  return ret;
+}		/* -----  end of function dbIncrElement  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbTouchElement
+ *  Description:  Gives the element a new expiry, in seconds, and counts it as
+ *                an access. Only the item header changes; the value is not
+ *                copied and the cas value is kept
+ * =============================================================================
+ */
+int dbTouchElement (const string &key, const unsigned long int expiry)
+{
+  if (gServStorageEngine == DB_ENGINE_SEGMENT)
+  {
+    return dbSegTouchElement(key, expiry);
+  }
+  RelTimeType now = dbClockNow();
+  unsigned int hashTblNum = getHashTblNbrFromKey(key);
+
+  lockShard(hashTblNum);
+  applyQueuedBumpsLocked(hashTblNum);
+  ItemStruct **slot = gKeyToValueIndex[hashTblNum].findSlot(key, 
+      getHashFromKey(key));
+  if ((slot == NULL) || isItemExpired(*slot, now))
+  {
+    unlockShard(hashTblNum);
+    return NOT_EXIST;
+  }
+  // The item moves to the bucket of its new expiry
+  ItemStruct *item = *slot;
+  gExpiryWheel[hashTblNum].remove(item);
+  item->expiry = dbClockExpiry(expiry, now);
+  gExpiryWheel[hashTblNum].add(item);
+  bool bumpNeeded = recordAccess(hashTblNum, item, now);
+  unlockShard(hashTblNum);
+  if (bumpNeeded)
+  {
+    queueBump(hashTblNum, key);
+  }
+  return SUCCESS;
+}		/* -----  end of function dbTouchElement  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbDeleteElement
+ *  Description:  This function invalidates the entry in the database based on
+ *                the expiry supplied
+ * =============================================================================
+ */
+int dbDeleteElement (const string &key, const unsigned long int expiry)
+{
+  if (gServStorageEngine == DB_ENGINE_SEGMENT)
+  {
+    return dbSegDeleteElement(key, expiry);
+  }
+  RelTimeType now = dbClockNow();
+  unsigned int hashTblNum = getHashTblNbrFromKey(key);
+
+  lockShard(hashTblNum);
+  applyQueuedBumpsLocked(hashTblNum);
+  ItemStruct **slot = gKeyToValueIndex[hashTblNum].findSlot(key, 
+      getHashFromKey(key));
+  if (slot != NULL) 
+  {
+    // Value exists
+    ItemStruct *item = *slot;
+    if (isItemExpired(item, now))
+    {
+      // Already deleted or expired
+      unlockShard(hashTblNum);
+      return NOT_EXIST;
+    }
+    // Value has not already expired. Set new expiry
+    if (expiry == 0)
+    {
+      gKeyToValueIndex[hashTblNum].eraseSlot(slot);
+      unlinkItemLocked(hashTblNum, item, false);
+      chargeItemLocked(hashTblNum, item, false);
+      unlockShard(hashTblNum);
+      retireItem(item);
+      return SUCCESS;
+    }
+    // The item moves to the bucket of its new expiry
+    gExpiryWheel[hashTblNum].remove(item);
+    item->expiry = dbClockExpiry(expiry, now);
+    gExpiryWheel[hashTblNum].add(item);
+    unlockShard(hashTblNum);
+    return SUCCESS;
+  }
+  // Trying to delete a missing entry
+  unlockShard(hashTblNum);
+  return NOT_EXIST;
+}		/* -----  end of function dbDeleteElement  ----- */
+
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  getElementOptimistic
+ *  Description:  Looks up the element without taking the hash table lock. The
+ *                caller must be inside an epoch, so that the item stays valid
+ *                even if a writer removes it. Whatever is copied out is only
+ *                used if the sequence count shows that no writer ran in
+ *                between. Returns FAILURE if the locked path has to be taken.
+ *                For a value in external storage, where it is is copied and
+ *                externalLen set to its length. rawLen is set to the length
+ *                of a compressed value once decompressed
+ * =============================================================================
+ */
+static int getElementOptimistic (unsigned int hashTblNum, const string &key,
+    size_t hash, RelTimeType now, string &flags, string &cas, 
+    string &value, unsigned long int &expiry, ItemStruct *&item,
+    size_t &externalLen, unsigned int &rawLen)
+{
+  for (unsigned int tries = 0; tries < DB_OPTIMISTIC_READ_TRIES; tries++)
+  {
+    unsigned long int seq = 
+      gKeyToValueSeq[hashTblNum].seq.load(memory_order_acquire);
+    if ((seq & 1) != 0)
+    {
+      // A writer has the table
+      continue;
+    }
+    item = gKeyToValueIndex[hashTblNum].find(key, hash);
+    if (item == NULL)
+    {
+      if (isShardUnchanged(hashTblNum, seq))
+      {
+        return NOT_EXIST;
+      }
+      continue;
+    }
+    if (isItemExpired(item, now))
+    {
+      // Removing it needs the lock
+      return FAILURE;
+    }
+    RelTimeType itemExpiry = item->expiry;
+    unsigned long long int casUniq = getItemCas(item);
+    rawLen = item->rawLen;
+    externalLen = item->isExternal ? item->valueLen : 0;
+    bool isCopied = copyValue(item, value);
+    flags.assign(dbItemFlags(item), item->flagsLen);
+    if (!isShardUnchanged(hashTblNum, seq) || !isCopied)
+    {
+      continue;
+    }
+    cas.assign(to_string(casUniq));
+    expiry = dbClockSecondsLeft(itemExpiry, now);
+    return SUCCESS;
+  }
+  return FAILURE;
+}		/* -----  end of function getElementOptimistic  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  readExternalValue
+ *  Description:  Replaces where a value in external storage is, as copied
+ *                into value, by the value read from there. No lock is held
+ *                while it is read. If the file has been reused since, the
+ *                item is removed and NOT_EXIST returned
+ * =============================================================================
+ */
+static int readExternalValue (unsigned int hashTblNum, const string &key,
+    size_t hash, size_t len, string &value)
+{
+  DbExtRef ref;
+  memcpy(&ref, value.data(), sizeof(ref));
+  if (dbExtRead(ref, len, value))
+  {
+    return SUCCESS;
+  }
+
+  ItemStruct *stale = NULL;
+  lockShard(hashTblNum);
+  ItemStruct **slot = gKeyToValueIndex[hashTblNum].findSlot(key, hash);
+  if ((slot != NULL) && (*slot)->isExternal &&
+      (memcmp(dbItemValue(*slot), &ref, sizeof(ref)) == 0))
+  {
+    stale = *slot;
+    gKeyToValueIndex[hashTblNum].eraseSlot(slot);
+    unlinkItemLocked(hashTblNum, stale, false);
+    chargeItemLocked(hashTblNum, stale, false);
+  }
+  unlockShard(hashTblNum);
+  if (stale != NULL)
+  {
+    retireItem(stale);
+  }
+  value.clear();
+  return NOT_EXIST;
+}		/* -----  end of function readExternalValue  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  finishValue
+ *  Description:  Turns the value copied out of an item into the value stored:
+ *                it is read from external storage if externalLen is set, and
+ *                decompressed if rawLen is
+ * =============================================================================
+ */
+static int finishValue (unsigned int hashTblNum, const string &key,
+    size_t hash, size_t externalLen, unsigned int rawLen, string &value)
+{
+  if (externalLen > 0)
+  {
+    int ret = readExternalValue(hashTblNum, key, hash, externalLen, value);
+    if (ret != SUCCESS)
+    {
+      return ret;
+    }
+  }
+  if ((rawLen > 0) && !decompressValue(value, rawLen))
+  {
+    cout<<"Could not decompress the value of "<<key<<endl;
+    value.clear();
+    return NOT_EXIST;
+  }
+  return SUCCESS;
+}		/* -----  end of function finishValue  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbGetElement
+ *  Description:  This function gets the element from the map if it exists.
+ *                The lock of the hash table is only taken if the optimistic
+ *                read fails or the element has to be removed
+ * =============================================================================
+ */
+int dbGetElement (const string &key, string &flags, string &cas, string &value,
+    unsigned long int &expiry)
+{
+  if (gServStorageEngine == DB_ENGINE_SEGMENT)
+  {
+    return dbSegGetElement(key, flags, cas, value, expiry);
+  }
+  RelTimeType now = dbClockNow();
+  unsigned int hashTblNum = getHashTblNbrFromKey(key);
+  size_t hash = getHashFromKey(key);
+
+  size_t externalLen = 0;
+  unsigned int rawLen = 0;
+  if (dbEpochEnter())
+  {
+    ItemStruct *item = NULL;
+    int ret = getElementOptimistic(hashTblNum, key, hash, now, 
+        flags, cas, value, expiry, item, externalLen, rawLen);
+    bool bumpNeeded = ((ret == SUCCESS) && 
+        recordAccess(hashTblNum, item, now));
+    dbEpochExit();
+    if (bumpNeeded)
+    {
+      // Updating the timestamp so that the cache entry doesn't become stale
+      // soon
+      queueBump(hashTblNum, key);
+    }
+    if (ret == SUCCESS)
+    {
+      return finishValue(hashTblNum, key, hash, externalLen, rawLen, value);
+    }
+    if (ret != FAILURE)
+    {
+      return ret;
+    }
+  }
+
+  lockShard(hashTblNum);
+  ItemStruct **slot = gKeyToValueIndex[hashTblNum].findSlot(key, hash);
+  if (slot != NULL) 
+  {
+    // Value exists
+    ItemStruct *item = *slot;
+    if (isItemExpired(item, now))
+    {
+      // Value expired
+      gKeyToValueIndex[hashTblNum].eraseSlot(slot);
+      unlinkItemLocked(hashTblNum, item, false);
+      chargeItemLocked(hashTblNum, item, false);
+      unlockShard(hashTblNum);
+      retireItem(item);
+      return NOT_EXIST;
+    }
+    rawLen = item->rawLen;
+    externalLen = item->isExternal ? item->valueLen : 0;
+    cas.assign(to_string(getItemCas(item)));
+    copyValue(item, value);
+    flags.assign(dbItemFlags(item), item->flagsLen);
+    expiry = dbClockSecondsLeft(item->expiry, now);
+    bool bumpNeeded = recordAccess(hashTblNum, item, now);
+    unlockShard(hashTblNum);
+    if (bumpNeeded)
+    {
+      // Updating the timestamp so that the cache entry doesn't become stale
+      // soon
+      queueBump(hashTblNum, key);
+    }
+    return finishValue(hashTblNum, key, hash, externalLen, rawLen, value);
   }
   // Value does not exist
+  unlockShard(hashTblNum);
+  return NOT_EXIST;
+}		/* -----  end of function dbGetElement  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  reclaimItemsLocked
+ *  Description:  Frees the expired items the crawler found in the hash table.
+ *                The mutex of the table must be held, so that the items are
+ *                still in the index, and is released. The readers are only
+ *                disturbed if there is something to free
+ * =============================================================================
+ */
+static void reclaimItemsLocked (unsigned int hashTblNum, 
+    const vector<ItemStruct *> &expired)
+{
+  if (expired.empty())
+  {
+    gKeyToValueMutex[hashTblNum].unlock();
+    return;
+  }
+
+  gKeyToValueSeq[hashTblNum].seq.fetch_add(1);
+  unsigned long int bytes = 0;
+  for (auto item: expired)
+  {
+    gKeyToValueIndex[hashTblNum].eraseSlot(
+        gKeyToValueIndex[hashTblNum].findItemSlot(item));
+    unlinkItemLocked(hashTblNum, item, false);
+    bytes += getItemSize(item);
+    chargeItemLocked(hashTblNum, item, false);
+  }
+  unlockShard(hashTblNum);
+
+  for (auto item: expired)
+  {
+    retireItem(item);
+  }
+  gCrawlerReclaimed += expired.size();
+  gCrawlerReclaimedBytes += bytes;
+}		/* -----  end of function reclaimItemsLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  crawlShard
+ *  Description:  Frees the expired and flushed items in the next slots of the
+ *                hash table from the cursor. Returns the cursor to continue 
+ *                from, 0 at the end
+ * =============================================================================
+ */
+static size_t crawlShard (unsigned int hashTblNum, size_t cursor)
+{
+  RelTimeType now = dbClockNow();
+  vector<ItemStruct *> items;
+  vector<ItemStruct *> expired;
+
+  gKeyToValueMutex[hashTblNum].lock();
+  applyQueuedBumpsLocked(hashTblNum);
+  cursor = gKeyToValueIndex[hashTblNum].scan(cursor, DB_CRAWL_BATCH, items);
+  for (auto item: items)
+  {
+    if (isItemExpired(item, now))
+    {
+      expired.push_back(item);
+    }
+  }
+  reclaimItemsLocked(hashTblNum, expired);
+  return cursor;
+}		/* -----  end of function crawlShard  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  crawlExpiryWheel
+ *  Description:  Frees the next batch of items which expired since the last
+ *                walk of the expiry wheel of the hash table. Returns true once
+ *                the wheel has caught up
+ * =============================================================================
+ */
+static bool crawlExpiryWheel (unsigned int hashTblNum)
+{
+  RelTimeType now = dbClockNow();
+  vector<ItemStruct *> expired;
+
+  gKeyToValueMutex[hashTblNum].lock();
+  applyQueuedBumpsLocked(hashTblNum);
+  bool isDone = gExpiryWheel[hashTblNum].collectExpired(now, 
+      DB_CRAWL_BATCH, expired);
+  reclaimItemsLocked(hashTblNum, expired);
+  return isDone;
+}		/* -----  end of function crawlExpiryWheel  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  crawlerThrottle
+ *  Description:  Sleeps after a batch which took busy, long enough for the
+ *                crawler to stay within its share of a CPU
+ * =============================================================================
+ */
+static void crawlerThrottle (chrono::steady_clock::duration busy)
+{
+  unsigned int budget = gServCrawlerBudget;
+  if (budget < 100)
+  {
+    this_thread::sleep_for(busy * (100 - budget) / budget);
+  }
+}		/* -----  end of function crawlerThrottle  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  crawlSegments
+ *  Description:  A pass of the crawler over the segment engine, which frees
+ *                the segments whose items have all expired
+ * =============================================================================
+ */
+static void crawlSegments ()
+{
+  bool isDone = false;
+  while (!isDone)
+  {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    isDone = dbSegCrawl();
+    crawlerThrottle(chrono::steady_clock::now() - start);
+  }
+}		/* -----  end of function crawlSegments  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  crawlerMain
+ *  Description:  The crawler thread. Frees the expired and flushed items, so
+ *                that their memory goes to live items instead of waiting for
+ *                eviction. Expired items are found through the expiry wheels,
+ *                whose walk costs only as much as there is to free. Flushed
+ *                items are not on the wheels, so after a flush_all the hash
+ *                tables are scanned a batch of slots at a time instead. Work
+ *                is done in batches, and the thread rests between passes
+ * =============================================================================
+ */
+static void crawlerMain ()
+{
+  unsigned long int scannedFlushTimestamp = gFlushAllTimestamp;
+
+  while (true)
+  {
+    // A delayed flush_all is due even if no request comes in
+    dbHandleFlushAll();
+    if (gServStorageEngine == DB_ENGINE_SEGMENT)
+    {
+      crawlSegments();
+      this_thread::sleep_for(chrono::milliseconds(DB_CRAWL_PASS_INTERVAL));
+      continue;
+    }
+    unsigned long int flushTimestamp = gFlushAllTimestamp;
+    bool isScanNeeded = (flushTimestamp != scannedFlushTimestamp);
+
+    for (unsigned int hashTblNum = 0; hashTblNum < DB_MAX_HASH_TABLES; 
+        hashTblNum++)
+    {
+      size_t cursor = 0;
+      bool isDone = false;
+      while (!isDone)
+      {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (isScanNeeded)
+        {
+          // The scan frees the expired items on the way
+          cursor = crawlShard(hashTblNum, cursor);
+          isDone = (cursor == 0);
+        }
+        else
+        {
+          isDone = crawlExpiryWheel(hashTblNum);
+        }
+        crawlerThrottle(chrono::steady_clock::now() - start);
+      }
+    }
+    scannedFlushTimestamp = flushTimestamp;
+    this_thread::sleep_for(chrono::milliseconds(DB_CRAWL_PASS_INTERVAL));
+  }
+}		/* -----  end of function crawlerMain  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbWakeEvictor
+ *  Description:  Asks the evictor to bring memory use down to the low
+ *                watermark. Cheap when it has already been asked
+ * =============================================================================
+ */
+void dbWakeEvictor ()
+{
+  if (gIsEvictorWanted.load(memory_order_relaxed) || 
+      gIsEvictorWanted.exchange(true))
+  {
+    return;
+  }
+  // Taking the mutex makes sure the evictor is either waiting or has not
+  // yet checked the flag
+  lock_guard<mutex> lock(gEvictorMutex);
+  gEvictorCond.notify_one();
+}		/* -----  end of function dbWakeEvictor  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  evictToWatermark
+ *  Description:  Evicts batches of elements from each hash table over the low
+ *                watermark of its budget till it is under it or empty. With
+ *                external storage, large values are moved there rather than
+ *                evicted. The lock is let go between batches
+ * =============================================================================
+ */
+static void evictToWatermark ()
+{
+  ItemStruct *evicted[DB_EVICT_BATCH];
+
+  for (unsigned int hashTblNum = 0; hashTblNum < DB_MAX_HASH_TABLES; 
+      hashTblNum++)
+  {
+    unsigned int evictedCount = 0;
+    unsigned int movedCount = 0;
+    do
+    {
+      lockShard(hashTblNum);
+      chargeStructuresLocked(hashTblNum);
+      long int excess = gShardSize[hashTblNum].storedSize - 
+        getLowWatermarkLocked(hashTblNum);
+      evictedCount = 0;
+      movedCount = 0;
+      if ((excess > 0) && dbExtIsEnabled())
+      {
+        movedCount = externalizeElementsLocked(hashTblNum, DB_EVICT_BATCH,
+            excess, evicted);
+      }
+      if ((excess > 0) && (movedCount == 0))
+      {
+        evictedCount = evictElementsLocked(hashTblNum, DB_EVICT_BATCH, excess,
+            evicted);
+      }
+      unlockShard(hashTblNum);
+
+      if (movedCount > 0)
+      {
+        // Reads of the moved values are served from the write buffer till
+        // this is done
+        dbExtFlush();
+      }
+      for (unsigned int i = 0; i < evictedCount + movedCount; i++)
+      {
+        retireItem(evicted[i]);
+      }
+      gEvictions += evictedCount;
+      gExtMoved += movedCount;
+    } while ((evictedCount > 0) || (movedCount > 0));
+  }
+}		/* -----  end of function evictToWatermark  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  rescueExternalItem
+ *  Description:  Writes the value of an item found in a file being compacted
+ *                out again, if the item is still stored with it. The value is
+ *                read with no lock held. If it cannot be written the item is
+ *                evicted
+ * =============================================================================
+ */
+static void rescueExternalItem (unsigned int hashTblNum, const string &key, 
+    const DbExtRef &ref, size_t len)
+{
+  string value;
+  if (!dbExtRead(ref, len, value))
+  {
+    return;
+  }
+  size_t hash = getHashFromKey(key);
+  ItemStruct *dropped = NULL;
+
+  lockShard(hashTblNum);
+  ItemStruct **slot = gKeyToValueIndex[hashTblNum].findSlot(key, hash);
+  if ((slot != NULL) && (*slot)->isExternal &&
+      (memcmp(dbItemValue(*slot), &ref, sizeof(ref)) == 0))
+  {
+    ItemStruct *item = *slot;
+    DbExtRef newRef;
+    if (dbExtStage(value.data(), len, newRef))
+    {
+      memcpy(dbItemValue(item), &newRef, sizeof(newRef));
+      dbExtRemove(ref, len);
+      gExtRescued++;
+    }
+    else
+    {
+      gKeyToValueIndex[hashTblNum].eraseSlot(slot);
+      unlinkItemLocked(hashTblNum, item, true);
+      chargeItemLocked(hashTblNum, item, false);
+      dropped = item;
+    }
+  }
+  unlockShard(hashTblNum);
+  dbExtFlush();
+  if (dropped != NULL)
+  {
+    retireItem(dropped);
+    gExtDropped++;
+  }
+}		/* -----  end of function rescueExternalItem  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  compactShard
+ *  Description:  Finds the items in the next slots of the hash table from
+ *                the cursor whose values are in the file being compacted. If
+ *                they are rescued their values are written out again, and
+ *                otherwise the items are evicted. Returns the cursor to
+ *                continue from, 0 at the end
+ * =============================================================================
+ */
+static size_t compactShard (unsigned int hashTblNum, size_t cursor,
+    unsigned int fileNum, bool isRescued)
+{
+  vector<ItemStruct *> items;
+  vector<ItemStruct *> dropped;
+  vector<pair<KeyType, DbExtRef> > rescued;
+  vector<size_t> rescuedLen;
+
+  gKeyToValueMutex[hashTblNum].lock();
+  cursor = gKeyToValueIndex[hashTblNum].scan(cursor, DB_CRAWL_BATCH, items);
+  for (auto item: items)
+  {
+    if (!item->isExternal || !dbExtIsInFile(getItemRef(item), fileNum))
+    {
+      continue;
+    }
+    if (isRescued)
+    {
+      rescued.push_back(make_pair(KeyType(dbItemKey(item), item->keyLen), 
+            getItemRef(item)));
+      rescuedLen.push_back(item->valueLen);
+    }
+    else
+    {
+      dropped.push_back(item);
+    }
+  }
+  if (dropped.empty())
+  {
+    gKeyToValueMutex[hashTblNum].unlock();
+  }
+  else
+  {
+    gKeyToValueSeq[hashTblNum].seq.fetch_add(1);
+    for (auto item: dropped)
+    {
+      gKeyToValueIndex[hashTblNum].eraseSlot(
+          gKeyToValueIndex[hashTblNum].findItemSlot(item));
+      unlinkItemLocked(hashTblNum, item, true);
+      chargeItemLocked(hashTblNum, item, false);
+    }
+    unlockShard(hashTblNum);
+    for (auto item: dropped)
+    {
+      retireItem(item);
+    }
+    gExtDropped += dropped.size();
+  }
+
+  for (size_t i = 0; i < rescued.size(); i++)
+  {
+    rescueExternalItem(hashTblNum, rescued[i].first, rescued[i].second,
+        rescuedLen[i]);
+  }
+  return cursor;
+}		/* -----  end of function compactShard  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  compactExternal
+ *  Description:  Frees external storage files while too few are free. The
+ *                hash tables are walked a batch at a time for the items with
+ *                values in the file being compacted. The file is free once
+ *                the walk is done; values the walk missed are no longer
+ *                found
+ * =============================================================================
+ */
+static void compactExternal ()
+{
+  unsigned int fileNum;
+  bool isRescued;
+  while (dbExtPickCompaction(fileNum, isRescued))
+  {
+    for (unsigned int hashTblNum = 0; hashTblNum < DB_MAX_HASH_TABLES; 
+        hashTblNum++)
+    {
+      size_t cursor = 0;
+      do
+      {
+        cursor = compactShard(hashTblNum, cursor, fileNum, isRescued);
+      } while (cursor != 0);
+    }
+    dbExtReleaseFile(fileNum);
+  }
+}		/* -----  end of function compactExternal  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  moveBudget
+ *  Description:  Moves a step of budget from one hash table to another
+ * =============================================================================
+ */
+static void moveBudget (unsigned int fromHashTblNum, unsigned int toHashTblNum)
+{
+  lockShard(fromHashTblNum);
+  gShardSize[fromHashTblNum].budget -= gBudgetStep;
+  unlockShard(fromHashTblNum);
+  lockShard(toHashTblNum);
+  gShardSize[toHashTblNum].budget += gBudgetStep;
+  unlockShard(toHashTblNum);
+  gBudgetMoves++;
+}		/* -----  end of function moveBudget  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  rebalanceBudgets
+ *  Description:  Moves budget to the hash tables under pressure, those which
+ *                evicted since the last rebalance, the ones evicting the most
+ *                recently used elements first. Budget is taken from a table
+ *                not using all of its own, else from the table with the
+ *                coldest tail, whose evicted elements have gone unused longest.
+ *                A table gives or gets at most one step per rebalance. Only
+ *                the evictor thread changes budgets
+ * =============================================================================
+ */
+static void rebalanceBudgets ()
+{
+  RelTimeType now = dbClockNow();
+  long int unused[DB_MAX_HASH_TABLES];
+  long int budget[DB_MAX_HASH_TABLES];
+  bool isEvicting[DB_MAX_HASH_TABLES];
+  bool isMoved[DB_MAX_HASH_TABLES];
+  RelTimeType tailAge[DB_MAX_HASH_TABLES];
+  vector<unsigned int> receivers;
+
+  for (unsigned int hashTblNum = 0; hashTblNum < DB_MAX_HASH_TABLES; 
+      hashTblNum++)
+  {
+    ShardSizeStruct &shard = gShardSize[hashTblNum];
+    gKeyToValueMutex[hashTblNum].lock();
+    budget[hashTblNum] = shard.budget;
+    unused[hashTblNum] = shard.budget - shard.storedSize;
+    isEvicting[hashTblNum] = (shard.evictedBytes > 0);
+    tailAge[hashTblNum] = (now > shard.victimAccess) ? 
+      (now - shard.victimAccess) : 0;
+    shard.evictedBytes = 0;
+    gKeyToValueMutex[hashTblNum].unlock();
+    isMoved[hashTblNum] = false;
+    if (isEvicting[hashTblNum])
+    {
+      receivers.push_back(hashTblNum);
+    }
+  }
+  sort(receivers.begin(), receivers.end(), 
+      [&tailAge] (unsigned int a, unsigned int b) 
+      { return tailAge[a] < tailAge[b]; });
+
+  for (unsigned int receiver : receivers)
+  {
+    if (isMoved[receiver])
+    {
+      continue;
+    }
+    int donor = -1;
+    for (unsigned int hashTblNum = 0; hashTblNum < DB_MAX_HASH_TABLES; 
+        hashTblNum++)
+    {
+      if ((hashTblNum == receiver) || isMoved[hashTblNum] ||
+          (budget[hashTblNum] - gBudgetStep < gBudgetMin))
+      {
+        continue;
+      }
+      if (unused[hashTblNum] >= gBudgetStep)
+      {
+        // Spare budget beats any tail
+        if ((donor < 0) || (isEvicting[donor]) || 
+            (unused[hashTblNum] > unused[donor]))
+        {
+          donor = hashTblNum;
+        }
+      }
+      else if (isEvicting[hashTblNum] && 
+          (tailAge[hashTblNum] > DB_BUDGET_AGE_RATIO * tailAge[receiver]) &&
+          ((donor < 0) || 
+           (isEvicting[donor] && (tailAge[hashTblNum] > tailAge[donor]))))
+      {
+        donor = hashTblNum;
+      }
+    }
+    if (donor < 0)
+    {
+      continue;
+    }
+    moveBudget(donor, receiver);
+    isMoved[donor] = true;
+    isMoved[receiver] = true;
+  }
+}		/* -----  end of function rebalanceBudgets  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  evictorMain
+ *  Description:  The evictor thread. Evicts in batches, off the request
+ *                threads, whenever it is woken and every DB_EVICT_INTERVAL
+ *                milliseconds, so that stores rarely have to evict inline.
+ *                Every DB_BUDGET_INTERVAL seconds it rebalances the budgets of
+ *                the hash tables
+ * =============================================================================
+ */
+static void evictorMain ()
+{
+  RelTimeType rebalanceTime = dbClockNow();
+
+  while (true)
+  {
+    {
+      unique_lock<mutex> lock(gEvictorMutex);
+      gEvictorCond.wait_for(lock, chrono::milliseconds(DB_EVICT_INTERVAL),
+          [] { return gIsEvictorWanted.load(); });
+    }
+    // Stores going over the watermark from here on wake it again
+    gIsEvictorWanted = false;
+    dbEpochReclaimAll();
+    if (gServStorageEngine == DB_ENGINE_SEGMENT)
+    {
+      dbSegEvict();
+      continue;
+    }
+    RelTimeType now = dbClockNow();
+    if (now - rebalanceTime >= DB_BUDGET_INTERVAL)
+    {
+      rebalanceBudgets();
+      rebalanceTime = now;
+    }
+    if (gServEvictWatermark < 100)
+    {
+      evictToWatermark();
+    }
+    if (dbExtIsEnabled())
+    {
+      compactExternal();
+    }
+  }
+}		/* -----  end of function evictorMain  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  restoreItem
+ *  Description:  Puts an item of the last run found in the arena back into
+ *                the index, the policy and the expiry wheel. Its times are
+ *                moved over to the clock of this run. Returns false if it was
+ *                not live at the shutdown or has expired since
+ * =============================================================================
+ */
+static bool restoreItem (void *chunk)
+{
+  ItemStruct *item = (ItemStruct *)chunk;
+  const DbArenaFooter *footer = dbArenaGetFooter();
+  // External storage starts out empty on every run, and a chunked item
+  // links its chunks by address. Both are dropped, and the chunks are freed
+  // by the arena. Striped counters were folded back on shutdown. An item
+  // has to fit in its chunk, whatever the chunk holds
+  if ((item->timestamp != footer->nonce) || item->isExternal || 
+      item->isChunked || item->isStriped || 
+      (dbItemSize(item->keyLen, item->flagsLen, item->valueLen) > 
+       dbArenaUsableSize(item)))
+  {
+    return false;
+  }
+  RelTimeType now = dbClockNow();
+  if (item->expiry != DB_CLOCK_NEVER)
+  {
+    item->expiry = dbClockFromAbsolute(footer->clockStart + item->expiry);
+  }
+  item->accessTime = dbClockFromAbsolute(footer->clockStart + 
+      item->accessTime);
+  item->timestamp = gFlushAllTimestamp;
+  if (isItemExpired(item, now))
+  {
+    return false;
+  }
+  string key(dbItemKey(item), item->keyLen);
+  unsigned int hashTblNum = getHashTblNbrFromKey(key);
+  item->hash = getHashFromKey(key);
+
+  lockShard(hashTblNum);
+  try
+  {
+    gKeyToValueIndex[hashTblNum].insert(item);
+  }
+  catch (const bad_alloc& ba)
+  {
+    unlockShard(hashTblNum);
+    return false;
+  }
+  linkItemLocked(hashTblNum, item);
+  chargeItemLocked(hashTblNum, item, true);
+  unlockShard(hashTblNum);
+  return true;
+}		/* -----  end of function restoreItem  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbSnapshotScan
+ *  Description:  Appends the live items in the next slots of the hash table
+ *                from the cursor to the buffer as snapshot records, and adds
+ *                their number to items. Returns the cursor to continue from,
+ *                0 at the end. Writers wait at most for one batch
+ * =============================================================================
+ */
+size_t dbSnapshotScan (unsigned int hashTblNum, size_t cursor, 
+    string &buffer, unsigned long int &items)
+{
+  if (gServStorageEngine == DB_ENGINE_SEGMENT)
+  {
+    return dbSegSnapshotScan(hashTblNum, cursor, buffer, items);
+  }
+  RelTimeType now = dbClockNow();
+  vector<ItemStruct *> batch;
+  // Copies of the items with values in external storage or compressed,
+  // which are read or decompressed once the lock is let go
+  vector<ItemStruct *> deferred;
+
+  gKeyToValueMutex[hashTblNum].lock();
+  cursor = gKeyToValueIndex[hashTblNum].scan(cursor, DB_SNAP_BATCH, batch);
+  for (auto item: batch)
+  {
+    if (isItemExpired(item, now))
+    {
+      continue;
+    }
+    if (item->isChunked || item->isNumeric)
+    {
+      string value;
+      copyValue(item, value);
+      time_t expiry = 0;
+      if (item->expiry != DB_CLOCK_NEVER)
+      {
+        expiry = dbClockToAbsolute(item->expiry);
+      }
+      dbSnapAppendRecord(buffer, dbItemKey(item), item->keyLen, 
+          dbItemFlags(item), item->flagsLen, value.data(), value.size(),
+          expiry, item->cost);
+      items++;
+      continue;
+    }
+    if (item->isExternal || (item->rawLen > 0))
+    {
+      size_t size = dbItemSize(item->keyLen, item->flagsLen, 
+          item->isExternal ? sizeof(DbExtRef) : item->valueLen);
+      ItemStruct *copy = (ItemStruct *)malloc(size);
+      if (copy != NULL)
+      {
+        memcpy(copy, item, size);
+        deferred.push_back(copy);
+      }
+      continue;
+    }
+    time_t expiry = 0;
+    if (item->expiry != DB_CLOCK_NEVER)
+    {
+      expiry = dbClockToAbsolute(item->expiry);
+    }
+    dbSnapAppendRecord(buffer, dbItemKey(item), item->keyLen, 
+        dbItemFlags(item), item->flagsLen, dbItemValue(item), item->valueLen,
+        expiry, item->cost);
+    items++;
+  }
   gKeyToValueMutex[hashTblNum].unlock();
-  return NOT_EXIST;
-}		/* -----  end of function dbGetElement  ----- */
+
+  string value;
+  for (auto item: deferred)
+  {
+    bool isRead = true;
+    if (item->isExternal)
+    {
+      isRead = dbExtRead(getItemRef(item), item->valueLen, value);
+    }
+    else
+    {
+      value.assign(dbItemValue(item), item->valueLen);
+    }
+    if (isRead && ((item->rawLen == 0) || 
+          decompressValue(value, item->rawLen)))
+    {
+      time_t expiry = 0;
+      if (item->expiry != DB_CLOCK_NEVER)
+      {
+        expiry = dbClockToAbsolute(item->expiry);
+      }
+      dbSnapAppendRecord(buffer, dbItemKey(item), item->keyLen, 
+          dbItemFlags(item), item->flagsLen, value.data(), value.size(),
+          expiry, item->cost);
+      items++;
+    }
+    free(item);
+  }
+  return cursor;
+}		/* -----  end of function dbSnapshotScan  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbShutdown
+ *  Description:  Leaves the items behind in a file backed arena for the next
+ *                run. The live items are marked with a nonce the footer
+ *                records, so that items removed but not yet freed, or
+ *                allocated but not yet stored, are not taken for live ones.
+ *                The locks of the hash tables are kept, as the server is about
+ *                to exit
+ * =============================================================================
+ */
+void dbShutdown ()
+{
+  if (gServStorageEngine == DB_ENGINE_SEGMENT)
+  {
+    return;
+  }
+  // Drawn at random, as cas values can be seen by clients. Flush
+  // generations are small, so they never match it
+  random_device device;
+  unsigned long long int nonce = ((unsigned long long int)device() << 32) |
+    device() | (1ULL << 63);
+  RelTimeType now = dbClockNow();
+  unsigned long int items = 0;
+  vector<ItemStruct *> batch;
+
+  for (unsigned int hashTblNum = 0; hashTblNum < DB_MAX_HASH_TABLES; 
+      hashTblNum++)
+  {
+    lockShard(hashTblNum);
+    size_t cursor = 0;
+    do
+    {
+      batch.clear();
+      cursor = gKeyToValueIndex[hashTblNum].scan(cursor, DB_CRAWL_BATCH, 
+          batch);
+      for (auto item: batch)
+      {
+        if (!isItemExpired(item, now))
+        {
+          if (item->isStriped)
+          {
+            unstripeLocked(hashTblNum, item);
+          }
+          item->timestamp = nonce;
+          items++;
+        }
+      }
+    } while (cursor != 0);
+  }
+  dbArenaClose(nonce, dbClockToAbsolute(0));
+  cout<<"Left "<<items<<" items for the next run"<<endl;
+}		/* -----  end of function dbShutdown  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbInit
+ *  Description:  Sets up the database. Has to be called once the command line
+ *                options are parsed and before any request is served
+ * =============================================================================
+ */
+void dbInit ()
+{
+  if (gServStorageEngine == DB_ENGINE_SEGMENT)
+  {
+    dbSegInit();
+  }
+  // Small memory limits get smaller steps, keeping the error of the total
+  // within a fraction of the limit
+  long int slack = gServMemLimit / 
+    (DB_MAX_HASH_TABLES * DB_STORED_SIZE_SLACK_DIV);
+  if (slack < gStoredSizeSlack)
+  {
+    gStoredSizeSlack = slack;
+  }
+  // The limit starts out split evenly between the tables
+  long int budget = gServMemLimit / DB_MAX_HASH_TABLES;
+  gBudgetStep = budget / DB_BUDGET_STEP_DIV;
+  gBudgetMin = budget / DB_BUDGET_MIN_DIV;
+  for (unsigned int hashTblNum = 0; hashTblNum < DB_MAX_HASH_TABLES; 
+      hashTblNum++)
+  {
+    gEvictPolicy[hashTblNum] = dbCreateEvictPolicy(gServEvictPolicy,
+        &gKeyToValueIndex[hashTblNum]);
+    gShardSize[hashTblNum].budget = budget;
+    chargeStructuresLocked(hashTblNum);
+  }
+  gShardSize[0].budget += gServMemLimit % DB_MAX_HASH_TABLES;
+  if (dbArenaIsRestored())
+  {
+    dbArenaForEachChunk(restoreItem);
+    unsigned long int items = 0;
+    for (unsigned int hashTblNum = 0; hashTblNum < DB_MAX_HASH_TABLES; 
+        hashTblNum++)
+    {
+      publishStoredSizeLocked(hashTblNum);
+      items += gKeyToValueIndex[hashTblNum].size();
+    }
+    cout<<"Restored "<<items<<" items"<<endl;
+  }
+  if (gServCrawlerBudget > 0)
+  {
+    thread(crawlerMain).detach();
+  }
+  if ((gServEvictWatermark < 100) || (gServStorageEngine != DB_ENGINE_SEGMENT))
+  {
+    thread(evictorMain).detach();
+  }
+}		/* -----  end of function dbInit  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbAppendStat
+ *  Description:  Appends a single stat line to the output
+ * =============================================================================
+ */
+void dbAppendStat (string &output, const char *name, 
+    unsigned long int value)
+{
+  output.append("STAT ");
+  output.append(name);
+  output.append(" ");
+  output.append(to_string(value));
+  output.append("\r\n");
+}		/* -----  end of function dbAppendStat  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbAppendStats
+ *  Description:  Appends the stats of the database to the output of the stats
+ *                command
+ * =============================================================================
+ */
+void dbAppendStats (string &output)
+{
+  if (gServStorageEngine == DB_ENGINE_SEGMENT)
+  {
+    dbSegAppendStats(output);
+    dbArenaAppendStats(output);
+    dbSnapshotAppendStats(output);
+    return;
+  }
+  unsigned long int items = 0;
+  unsigned long int bytes = 0;
+  unsigned long int payloadBytes = 0;
+  unsigned long int hashBytes = 0;
+  unsigned long int isExpanding = 0;
+  unsigned long int resizes = 0;
+  unsigned long int resizeUsec = 0;
+  unsigned long int expiryIndexed = 0;
+  unsigned long int compressedItems = 0;
+  unsigned long int compressedBytes = 0;
+  unsigned long int rawBytes = 0;
+  unsigned long int chunkedItems = 0;
+  unsigned long int chunkBytes = 0;
+  unsigned long int structBytes = 0;
+
+  for (unsigned int hashTblNum = 0; hashTblNum < DB_MAX_HASH_TABLES; 
+      hashTblNum++)
+  {
+    gKeyToValueMutex[hashTblNum].lock();
+    items += gKeyToValueIndex[hashTblNum].size();
+    bytes += gShardSize[hashTblNum].storedSize;
+    payloadBytes += gShardSize[hashTblNum].payloadSize;
+    hashBytes += gKeyToValueIndex[hashTblNum].getBytes();
+    if (gKeyToValueIndex[hashTblNum].isResizing())
+    {
+      isExpanding = 1;
+    }
+    resizes += gKeyToValueIndex[hashTblNum].getResizeCount();
+    resizeUsec += gKeyToValueIndex[hashTblNum].getResizeUsec();
+    expiryIndexed += gExpiryWheel[hashTblNum].size();
+    compressedItems += gShardSize[hashTblNum].compressedItems;
+    compressedBytes += gShardSize[hashTblNum].compressedSize;
+    rawBytes += gShardSize[hashTblNum].rawSize;
+    chunkedItems += gShardSize[hashTblNum].chunkedItems;
+    chunkBytes += gShardSize[hashTblNum].chunkedSize;
+    structBytes += gShardSize[hashTblNum].structSize;
+    gKeyToValueMutex[hashTblNum].unlock();
+  }
+
+  dbAppendStat(output, "curr_items", items);
+  dbAppendStat(output, "bytes", bytes);
+  dbAppendStat(output, "payload_bytes", payloadBytes);
+  dbAppendStat(output, "overhead_bytes", bytes - payloadBytes);
+  dbAppendStat(output, "limit_maxbytes", gServMemLimit);
+  dbAppendStat(output, "hash_bytes", hashBytes);
+  dbAppendStat(output, "structure_bytes", structBytes);
+  dbAppendStat(output, "retired_bytes", dbEpochRetiredBytes());
+  dbAppendStat(output, "hash_is_expanding", isExpanding);
+  dbAppendStat(output, "hash_resizes", resizes);
+  dbAppendStat(output, "hash_resize_usec", resizeUsec);
+  dbAppendStat(output, "evictions", 
+      gEvictions + gEvictionsInline + gEvictionsClass);
+  dbAppendStat(output, "evictions_inline", gEvictionsInline);
+  dbAppendStat(output, "evictions_class", gEvictionsClass);
+  dbAppendStat(output, "budget_moves", gBudgetMoves);
+  dbAppendStat(output, "expiry_indexed", expiryIndexed);
+  dbAppendStat(output, "crawler_reclaimed", gCrawlerReclaimed);
+  dbAppendStat(output, "crawler_reclaimed_bytes", gCrawlerReclaimedBytes);
+  dbAppendStat(output, "bumps_dropped", gBumpsDropped);
+  if (gServCompressMin > 0)
+  {
+    dbAppendStat(output, "compressed_items", compressedItems);
+    dbAppendStat(output, "compressed_bytes", compressedBytes);
+    dbAppendStat(output, "compressed_raw_bytes", rawBytes);
+    dbAppendStat(output, "compress_skipped", gCompressSkipped);
+  }
+  if (gServChunkMin > 0)
+  {
+    dbAppendStat(output, "chunked_items", chunkedItems);
+    dbAppendStat(output, "chunk_bytes", chunkBytes);
+  }
+  if (gServStripeRate > 0)
+  {
+    dbAppendStat(output, "counters_striped", gCountersStriped);
+    dbAppendStat(output, "counters_folded", gCountersFolded);
+  }
+  if (dbExtIsEnabled())
+  {
+    dbAppendStat(output, "ext_moved", gExtMoved);
+    dbAppendStat(output, "ext_rescued", gExtRescued);
+    dbAppendStat(output, "ext_dropped", gExtDropped);
+    dbExtAppendStats(output);
+  }
+  dbArenaAppendStats(output);
+  dbSnapshotAppendStats(output);
+}		/* -----  end of function dbAppendStats  ----- */
@@ -0,0 +1,930 @@
+/*==============================================================================
+ *
+ *       Filename:  dbpolicy.cpp
+ *
+ *    Description:  The cache replacement policies for memstashed: LRU,
+ *                  W-TinyLFU, 2Q, ARC, sampled LRU and GreedyDual-Size-
+ *                  Frequency. One policy object is kept per hash table
+ *
+ * =============================================================================
+ */
+
+#include <ctime>
+#include <climits>
+
+#include "../inc/dbpolicy.h"
+
+// Counters of the frequency sketch saturate at this value
+#define DB_SKETCH_MAX_COUNT 15
+#define DB_SKETCH_DEPTH 4
+#define DB_SKETCH_MIN_WIDTH 1024
+#define DB_SKETCH_MAX_WIDTH (1UL << 24)
+// The counts are halved after this many increments per counter column
+#define DB_SKETCH_SAMPLE_FACTOR 10
+
+// List numbers of the policies
+#define DB_LRU_LIST 0
+#define DB_TINYLFU_WINDOW 0
+#define DB_TINYLFU_PROBATION 1
+#define DB_TINYLFU_PROTECTED 2
+#define DB_2Q_A1IN 0
+#define DB_2Q_AM 1
+#define DB_ARC_T1 0
+#define DB_ARC_T2 1
+
+// Estimated bytes of a node of the standard containers beyond the element:
+// the allocator's header and the links of a list or tree node, or the next
+// pointer and cached hash of a hash map node
+#define DB_LIST_NODE_BYTES (2 * sizeof(void *) + 16)
+#define DB_TREE_NODE_BYTES (4 * sizeof(void *) + 16)
+#define DB_HASH_NODE_BYTES (2 * sizeof(void *) + 16)
+
+// Items sampled for each eviction by the sampled policy, and the number of
+// good candidates it keeps across evictions
+#define DB_SAMPLE_SIZE 5
+#define DB_SAMPLE_POOL_SIZE 16
+
+static const unsigned long long int gSketchSeeds[DB_SKETCH_DEPTH + 1] =
+{
+  0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL,
+  0xd6e8feb86659fd93ULL, 0xff51afd7ed558ccdULL
+};
+
+DbEvictPolicy::DbEvictPolicy ()
+{
+  for (unsigned int i = 0; i < DB_POLICY_MAX_LISTS; i++)
+  {
+    lists[i].head = NULL;
+    lists[i].tail = NULL;
+    lists[i].count = 0;
+  }
+}
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbEvictPolicy::listPushHead
+ *  Description:  Links the item at the most recently used end of the list
+ * =============================================================================
+ */
+void DbEvictPolicy::listPushHead (unsigned char listNum, ItemStruct *item)
+{
+  DbItemList &itemList = lists[listNum];
+  item->policyList = listNum;
+  item->prev = NULL;
+  item->next = itemList.head;
+  if (itemList.head != NULL)
+  {
+    itemList.head->prev = item;
+  }
+  else
+  {
+    itemList.tail = item;
+  }
+  itemList.head = item;
+  itemList.count++;
+}		/* -----  end of function DbEvictPolicy::listPushHead  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbEvictPolicy::listRemove
+ *  Description:  Unlinks the item from the list it is on
+ * =============================================================================
+ */
+void DbEvictPolicy::listRemove (ItemStruct *item)
+{
+  DbItemList &itemList = lists[item->policyList];
+  if (item->prev != NULL)
+  {
+    item->prev->next = item->next;
+  }
+  else
+  {
+    itemList.head = item->next;
+  }
+  if (item->next != NULL)
+  {
+    item->next->prev = item->prev;
+  }
+  else
+  {
+    itemList.tail = item->prev;
+  }
+  item->prev = NULL;
+  item->next = NULL;
+  itemList.count--;
+}		/* -----  end of function DbEvictPolicy::listRemove  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbEvictPolicy::listMoveToHead
+ *  Description:  Moves the item to the most recently used end of its list
+ * =============================================================================
+ */
+void DbEvictPolicy::listMoveToHead (ItemStruct *item)
+{
+  unsigned char listNum = item->policyList;
+  if (lists[listNum].head == item)
+  {
+    return;
+  }
+  listRemove(item);
+  listPushHead(listNum, item);
+}		/* -----  end of function DbEvictPolicy::listMoveToHead  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbEvictPolicy::onReplace
+ *  Description:  A new item has been stored under the key of an existing one.
+ *                The new item takes the place of the old one on its list, and
+ *                the replacement counts as an access
+ * =============================================================================
+ */
+void DbEvictPolicy::onReplace (ItemStruct *oldItem, ItemStruct *newItem)
+{
+  onSwap(oldItem, newItem);
+  onAccess(newItem);
+}		/* -----  end of function DbEvictPolicy::onReplace  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbEvictPolicy::onSwap
+ *  Description:  The new item, a copy of the old one, takes the place of the
+ *                old one on its list. This is not an access
+ * =============================================================================
+ */
+void DbEvictPolicy::onSwap (ItemStruct *oldItem, ItemStruct *newItem)
+{
+  DbItemList &itemList = lists[oldItem->policyList];
+  newItem->policyList = oldItem->policyList;
+  newItem->prev = oldItem->prev;
+  newItem->next = oldItem->next;
+  if (newItem->prev != NULL)
+  {
+    newItem->prev->next = newItem;
+  }
+  else
+  {
+    itemList.head = newItem;
+  }
+  if (newItem->next != NULL)
+  {
+    newItem->next->prev = newItem;
+  }
+  else
+  {
+    itemList.tail = newItem;
+  }
+  oldItem->prev = NULL;
+  oldItem->next = NULL;
+}		/* -----  end of function DbEvictPolicy::onSwap  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbEvictPolicy::nextVictim
+ *  Description:  Returns the item which would be evicted after the victim, as
+ *                far as the list of the victim goes, or NULL
+ * =============================================================================
+ */
+ItemStruct *DbEvictPolicy::nextVictim (ItemStruct *victim)
+{
+  return victim->prev;
+}		/* -----  end of function DbEvictPolicy::nextVictim  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbEvictPolicy::size
+ *  Description:  Returns the number of items on the lists of the policy
+ * =============================================================================
+ */
+size_t DbEvictPolicy::size () const
+{
+  size_t count = 0;
+  for (unsigned int i = 0; i < DB_POLICY_MAX_LISTS; i++)
+  {
+    count += lists[i].count;
+  }
+  return count;
+}		/* -----  end of function DbEvictPolicy::size  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbGhostList::add
+ *  Description:  Remembers the hash of an evicted key
+ * =============================================================================
+ */
+void DbGhostList::add (size_t hash)
+{
+  remove(hash);
+  hashes.push_front(hash);
+  positions[hash] = hashes.begin();
+}		/* -----  end of function DbGhostList::add  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbGhostList::remove
+ *  Description:  Forgets the hash. Returns whether it was remembered
+ * =============================================================================
+ */
+bool DbGhostList::remove (size_t hash)
+{
+  auto position = positions.find(hash);
+  if (position == positions.end())
+  {
+    return false;
+  }
+  hashes.erase(position->second);
+  positions.erase(position);
+  return true;
+}		/* -----  end of function DbGhostList::remove  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbGhostList::trim
+ *  Description:  Forgets the oldest hashes till at most maxCount are left
+ * =============================================================================
+ */
+void DbGhostList::trim (size_t maxCount)
+{
+  while (hashes.size() > maxCount)
+  {
+    positions.erase(hashes.back());
+    hashes.pop_back();
+  }
+}		/* -----  end of function DbGhostList::trim  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbGhostList::getBytes
+ *  Description:  Returns the memory taken up by the list and its map
+ * =============================================================================
+ */
+size_t DbGhostList::getBytes () const
+{
+  return hashes.size() * (sizeof(size_t) + DB_LIST_NODE_BYTES) +
+    positions.size() * (sizeof(*positions.begin()) + DB_HASH_NODE_BYTES) +
+    positions.bucket_count() * sizeof(void *);
+}		/* -----  end of function DbGhostList::getBytes  ----- */
+
+DbFrequencySketch::DbFrequencySketch () : width(0), widthBits(0), additions(0)
+{
+  ensureCapacity(DB_SKETCH_MIN_WIDTH);
+}
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbFrequencySketch::counterIndex
+ *  Description:  Returns the counter of the hash in the given row
+ * =============================================================================
+ */
+size_t DbFrequencySketch::counterIndex (size_t hash, unsigned int row) const
+{
+  unsigned long long int mixed = ((unsigned long long int)hash +
+      gSketchSeeds[row]) * gSketchSeeds[row];
+  return row * width + (size_t)(mixed >> (64 - widthBits));
+}		/* -----  end of function DbFrequencySketch::counterIndex  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbFrequencySketch::doorkeeperIndex
+ *  Description:  Returns the bit of the hash in the doorkeeper
+ * =============================================================================
+ */
+size_t DbFrequencySketch::doorkeeperIndex (size_t hash) const
+{
+  unsigned long long int mixed = ((unsigned long long int)hash +
+      gSketchSeeds[DB_SKETCH_DEPTH]) * gSketchSeeds[DB_SKETCH_DEPTH];
+  return (size_t)(mixed >> (64 - widthBits));
+}		/* -----  end of function DbFrequencySketch::doorkeeperIndex  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbFrequencySketch::increment
+ *  Description:  Counts an occurrence of the hash. The first occurrence only
+ *                goes into the doorkeeper
+ * =============================================================================
+ */
+void DbFrequencySketch::increment (size_t hash)
+{
+  size_t bit = doorkeeperIndex(hash);
+  unsigned long long int mask = 1ULL << (bit % 64);
+  if ((doorkeeper[bit / 64] & mask) == 0)
+  {
+    doorkeeper[bit / 64] |= mask;
+  }
+  else
+  {
+    for (unsigned int row = 0; row < DB_SKETCH_DEPTH; row++)
+    {
+      unsigned char &counter = counters[counterIndex(hash, row)];
+      if (counter < DB_SKETCH_MAX_COUNT)
+      {
+        counter++;
+      }
+    }
+  }
+
+  if (++additions >= DB_SKETCH_SAMPLE_FACTOR * width)
+  {
+    reset();
+  }
+}		/* -----  end of function DbFrequencySketch::increment  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbFrequencySketch::estimate
+ *  Description:  Returns the estimated number of occurrences of the hash
+ * =============================================================================
+ */
+unsigned int DbFrequencySketch::estimate (size_t hash) const
+{
+  unsigned int count = DB_SKETCH_MAX_COUNT;
+  for (unsigned int row = 0; row < DB_SKETCH_DEPTH; row++)
+  {
+    unsigned int counter = counters[counterIndex(hash, row)];
+    if (counter < count)
+    {
+      count = counter;
+    }
+  }
+  size_t bit = doorkeeperIndex(hash);
+  if ((doorkeeper[bit / 64] & (1ULL << (bit % 64))) != 0)
+  {
+    count++;
+  }
+  return count;
+}		/* -----  end of function DbFrequencySketch::estimate  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbFrequencySketch::reset
+ *  Description:  Halves all counts and clears the doorkeeper
+ * =============================================================================
+ */
+void DbFrequencySketch::reset ()
+{
+  for (auto &counter: counters)
+  {
+    counter >>= 1;
+  }
+  for (auto &word: doorkeeper)
+  {
+    word = 0;
+  }
+  additions /= 2;
+}		/* -----  end of function DbFrequencySketch::reset  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbFrequencySketch::ensureCapacity
+ *  Description:  Widens the sketch so that it can tell apart the given number
+ *                of keys. The counts gathered so far are dropped
+ * =============================================================================
+ */
+void DbFrequencySketch::ensureCapacity (size_t count)
+{
+  if ((count <= width) || (width >= DB_SKETCH_MAX_WIDTH))
+  {
+    return;
+  }
+  unsigned int bits = 0;
+  while (((size_t)1 << bits) < count)
+  {
+    bits++;
+  }
+  widthBits = bits;
+  width = (size_t)1 << bits;
+  counters.assign(width * DB_SKETCH_DEPTH, 0);
+  doorkeeper.assign((width + 63) / 64, 0);
+  additions = 0;
+}		/* -----  end of function DbFrequencySketch::ensureCapacity  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbFrequencySketch::getBytes
+ *  Description:  Returns the memory taken up by the counters and doorkeeper
+ * =============================================================================
+ */
+size_t DbFrequencySketch::getBytes () const
+{
+  return counters.capacity() + 
+    doorkeeper.capacity() * sizeof(unsigned long long int);
+}		/* -----  end of function DbFrequencySketch::getBytes  ----- */
+
+/*
+ * =============================================================================
+ *        Class:  DbLruPolicy
+ *  Description:  Least recently used. Of the two least recently used items the
+ *                larger one is evicted, as that frees more memory
+ * =============================================================================
+ */
+class DbLruPolicy : public DbEvictPolicy
+{
+  public:
+    void onInsert (ItemStruct *item)
+    {
+      listPushHead(DB_LRU_LIST, item);
+    }
+
+    void onAccess (ItemStruct *item)
+    {
+      listMoveToHead(item);
+    }
+
+    ItemStruct *chooseVictim ()
+    {
+      ItemStruct *victim = lists[DB_LRU_LIST].tail;
+      if ((victim != NULL) && (victim->prev != NULL) &&
+          (victim->valueLen < victim->prev->valueLen))
+      {
+        victim = victim->prev;
+      }
+      return victim;
+    }
+
+    void onRemove (ItemStruct *item, bool isEvicted)
+    {
+      listRemove(item);
+    }
+};
+
+/*
+ * =============================================================================
+ *        Class:  DbTinyLfuPolicy
+ *  Description:  W-TinyLFU. New items go into a small LRU window. An item
+ *                leaving the window is only admitted into the main area if the
+ *                frequency sketch says it is more popular than the item it
+ *                would push out. The main area is a segmented LRU: items hit
+ *                on probation are promoted to the protected segment. A scan
+ *                therefore passes through the window without evicting the
+ *                items which are used often
+ * =============================================================================
+ */
+class DbTinyLfuPolicy : public DbEvictPolicy
+{
+  public:
+    void onInsert (ItemStruct *item)
+    {
+      sketch.ensureCapacity(size() + 1);
+      sketch.increment(item->hash);
+      listPushHead(DB_TINYLFU_WINDOW, item);
+    }
+
+    void onAccess (ItemStruct *item)
+    {
+      sketch.increment(item->hash);
+      if (item->policyList != DB_TINYLFU_PROBATION)
+      {
+        listMoveToHead(item);
+        return;
+      }
+      listRemove(item);
+      listPushHead(DB_TINYLFU_PROTECTED, item);
+      // The protected segment takes up to 80% of the main area
+      size_t mainCount = lists[DB_TINYLFU_PROBATION].count +
+        lists[DB_TINYLFU_PROTECTED].count;
+      if (lists[DB_TINYLFU_PROTECTED].count * 5 > mainCount * 4)
+      {
+        ItemStruct *demoted = lists[DB_TINYLFU_PROTECTED].tail;
+        listRemove(demoted);
+        listPushHead(DB_TINYLFU_PROBATION, demoted);
+      }
+    }
+
+    ItemStruct *chooseVictim ()
+    {
+      // The window holds 1% of the items. Its overflow goes on probation,
+      // and the last item moved there competes with the probation tail.
+      // Eviction comes before the insert it makes room for, so a full window
+      // overflows already
+      size_t windowTarget = size() / 100 + 1;
+      ItemStruct *candidate = NULL;
+      while ((lists[DB_TINYLFU_WINDOW].count >= windowTarget) &&
+          (lists[DB_TINYLFU_WINDOW].tail != NULL))
+      {
+        candidate = lists[DB_TINYLFU_WINDOW].tail;
+        listRemove(candidate);
+        listPushHead(DB_TINYLFU_PROBATION, candidate);
+      }
+
+      ItemStruct *victim = lists[DB_TINYLFU_PROBATION].tail;
+      if (victim == candidate)
+      {
+        victim = lists[DB_TINYLFU_PROTECTED].tail;
+      }
+      if (candidate == NULL)
+      {
+        return (victim != NULL) ? victim : lists[DB_TINYLFU_WINDOW].tail;
+      }
+      if ((victim == NULL) ||
+          (sketch.estimate(candidate->hash) <= sketch.estimate(victim->hash)))
+      {
+        return candidate;
+      }
+      return victim;
+    }
+
+    void onRemove (ItemStruct *item, bool isEvicted)
+    {
+      listRemove(item);
+    }
+
+    size_t getBytes () const
+    {
+      return sketch.getBytes();
+    }
+
+  private:
+    DbFrequencySketch sketch;
+};
+
+/*
+ * =============================================================================
+ *        Class:  Db2QPolicy
+ *  Description:  2Q. New items go into the A1in FIFO. Keys evicted from A1in
+ *                are remembered in the A1out ghost list, and only keys
+ *                inserted again while remembered go into the Am LRU. Items
+ *                seen once are thus evicted before the ones seen again
+ * =============================================================================
+ */
+class Db2QPolicy : public DbEvictPolicy
+{
+  public:
+    void onInsert (ItemStruct *item)
+    {
+      if (a1out.remove(item->hash))
+      {
+        listPushHead(DB_2Q_AM, item);
+      }
+      else
+      {
+        listPushHead(DB_2Q_A1IN, item);
+      }
+    }
+
+    void onAccess (ItemStruct *item)
+    {
+      // A1in is a FIFO, hits there do not change the order
+      if (item->policyList == DB_2Q_AM)
+      {
+        listMoveToHead(item);
+      }
+    }
+
+    ItemStruct *chooseVictim ()
+    {
+      // A1in holds 25% of the items
+      size_t a1inTarget = size() / 4 + 1;
+      if ((lists[DB_2Q_A1IN].count > a1inTarget) ||
+          (lists[DB_2Q_AM].tail == NULL))
+      {
+        return lists[DB_2Q_A1IN].tail;
+      }
+      return lists[DB_2Q_AM].tail;
+    }
+
+    void onRemove (ItemStruct *item, bool isEvicted)
+    {
+      if (isEvicted && (item->policyList == DB_2Q_A1IN))
+      {
+        a1out.add(item->hash);
+        // A1out remembers as many keys as half the items
+        a1out.trim(size() / 2 + 1);
+      }
+      listRemove(item);
+    }
+
+    size_t getBytes () const
+    {
+      return a1out.getBytes();
+    }
+
+  private:
+    DbGhostList a1out;
+};
+
+/*
+ * =============================================================================
+ *        Class:  DbArcPolicy
+ *  Description:  Adaptive replacement cache. T1 holds items seen once and T2
+ *                items seen more than once, with ghost lists B1 and B2 of the
+ *                keys evicted from each. A miss on a ghost key moves the
+ *                target size p of T1 towards the list which would have kept
+ *                it, so the balance of recency and frequency adapts to the
+ *                workload. The cache size is the number of items present, as
+ *                eviction is driven by memory
+ * =============================================================================
+ */
+class DbArcPolicy : public DbEvictPolicy
+{
+  public:
+    DbArcPolicy () : target(0) {}
+
+    void onInsert (ItemStruct *item)
+    {
+      size_t b1Count = b1.size();
+      size_t b2Count = b2.size();
+      if (b1.remove(item->hash))
+      {
+        size_t delta = (b1Count >= b2Count) ? 1 : b2Count / b1Count;
+        target = min(size() + 1, target + delta);
+        listPushHead(DB_ARC_T2, item);
+      }
+      else if (b2.remove(item->hash))
+      {
+        size_t delta = (b2Count >= b1Count) ? 1 : b1Count / b2Count;
+        target -= min(target, delta);
+        listPushHead(DB_ARC_T2, item);
+      }
+      else
+      {
+        listPushHead(DB_ARC_T1, item);
+      }
+    }
+
+    void onAccess (ItemStruct *item)
+    {
+      listRemove(item);
+      listPushHead(DB_ARC_T2, item);
+    }
+
+    ItemStruct *chooseVictim ()
+    {
+      if ((lists[DB_ARC_T1].tail != NULL) &&
+          ((lists[DB_ARC_T1].count > target) ||
+           (lists[DB_ARC_T2].tail == NULL)))
+      {
+        return lists[DB_ARC_T1].tail;
+      }
+      return lists[DB_ARC_T2].tail;
+    }
+
+    void onRemove (ItemStruct *item, bool isEvicted)
+    {
+      if (isEvicted)
+      {
+        DbGhostList &ghosts = (item->policyList == DB_ARC_T1) ? b1 : b2;
+        ghosts.add(item->hash);
+        ghosts.trim(size());
+      }
+      listRemove(item);
+    }
+
+    size_t getBytes () const
+    {
+      return b1.getBytes() + b2.getBytes();
+    }
+
+  private:
+    DbGhostList b1;
+    DbGhostList b2;
+    size_t target;
+};
+
+/*
+ * =============================================================================
+ *        Class:  DbSampledPolicy
+ *  Description:  Approximate LRU without any order kept. Each eviction samples
+ *                a few random items of the hash table and adds them to a small
+ *                pool of candidates kept across evictions. The worst item of
+ *                the pool is evicted: an expired one, else the one with the
+ *                oldest access time, the larger one on a tie. Items are not
+ *                linked anywhere and an access only sets the access time
+ * =============================================================================
+ */
+class DbSampledPolicy : public DbEvictPolicy
+{
+  public:
+    DbSampledPolicy (const DbHashIndex *index) : index(index), poolCount(0),
+      generator(random_device{}())
+    {
+    }
+
+    void onInsert (ItemStruct *item)
+    {
+    }
+
+    void onAccess (ItemStruct *item)
+    {
+    }
+
+    void onReplace (ItemStruct *oldItem, ItemStruct *newItem)
+    {
+      removeFromPool(oldItem);
+    }
+
+    void onSwap (ItemStruct *oldItem, ItemStruct *newItem)
+    {
+      for (unsigned int i = 0; i < poolCount; i++)
+      {
+        if (pool[i] == oldItem)
+        {
+          pool[i] = newItem;
+        }
+      }
+    }
+
+    ItemStruct *nextVictim (ItemStruct *victim)
+    {
+      // The worst candidate of the pool after the victim
+      RelTimeType now = dbClockNow();
+      ItemStruct *next = NULL;
+      for (unsigned int i = 0; i < poolCount; i++)
+      {
+        if (isWorse(victim, pool[i], now) &&
+            ((next == NULL) || isWorse(pool[i], next, now)))
+        {
+          next = pool[i];
+        }
+      }
+      return next;
+    }
+
+    bool isAccessOrdered () const
+    {
+      return false;
+    }
+
+    ItemStruct *chooseVictim ()
+    {
+      RelTimeType now = dbClockNow();
+      for (unsigned int i = 0; i < DB_SAMPLE_SIZE; i++)
+      {
+        ItemStruct *item = index->sample(generator());
+        if (item != NULL)
+        {
+          addToPool(item, now);
+        }
+      }
+
+      ItemStruct *victim = NULL;
+      for (unsigned int i = 0; i < poolCount; i++)
+      {
+        if ((victim == NULL) || isWorse(pool[i], victim, now))
+        {
+          victim = pool[i];
+        }
+      }
+      return victim;
+    }
+
+    void onRemove (ItemStruct *item, bool isEvicted)
+    {
+      removeFromPool(item);
+    }
+
+  private:
+    static bool isWorse (const ItemStruct *first, const ItemStruct *second,
+        RelTimeType now)
+    {
+      bool firstExpired = (first->expiry < now);
+      bool secondExpired = (second->expiry < now);
+      if (firstExpired != secondExpired)
+      {
+        return firstExpired;
+      }
+      if (first->accessTime != second->accessTime)
+      {
+        return (first->accessTime < second->accessTime);
+      }
+      return (first->valueLen > second->valueLen);
+    }
+
+    void addToPool (ItemStruct *item, RelTimeType now)
+    {
+      unsigned int best = 0;
+      for (unsigned int i = 0; i < poolCount; i++)
+      {
+        if (pool[i] == item)
+        {
+          return;
+        }
+        if (isWorse(pool[best], pool[i], now))
+        {
+          best = i;
+        }
+      }
+      if (poolCount < DB_SAMPLE_POOL_SIZE)
+      {
+        pool[poolCount++] = item;
+      }
+      else if (isWorse(item, pool[best], now))
+      {
+        // Replaces the candidate least worth evicting
+        pool[best] = item;
+      }
+    }
+
+    void removeFromPool (ItemStruct *item)
+    {
+      for (unsigned int i = 0; i < poolCount; i++)
+      {
+        if (pool[i] == item)
+        {
+          pool[i] = pool[--poolCount];
+          return;
+        }
+      }
+    }
+
+    const DbHashIndex *index;
+    ItemStruct *pool[DB_SAMPLE_POOL_SIZE];
+    unsigned int poolCount;
+    mt19937_64 generator;
+};
+
+/*
+ * =============================================================================
+ *        Class:  DbGdsfPolicy
+ *  Description:  GreedyDual-Size-Frequency. The priority of an item is 
+ *                L + frequency * cost / size, and the item with the lowest
+ *                priority is evicted. L is raised to the priority of each 
+ *                evicted item, so items not accessed for a while age out.
+ *                Small items which are expensive to recompute and often read
+ *                are kept in favour of large cheap ones
+ * =============================================================================
+ */
+class DbGdsfPolicy : public DbEvictPolicy
+{
+  public:
+    DbGdsfPolicy () : inflation(0) {}
+
+    void onInsert (ItemStruct *item)
+    {
+      item->frequency = 1;
+      enqueue(item);
+    }
+
+    void onAccess (ItemStruct *item)
+    {
+      queue.erase(make_pair(item->priority, item));
+      if (item->frequency < UINT_MAX)
+      {
+        item->frequency++;
+      }
+      enqueue(item);
+    }
+
+    void onReplace (ItemStruct *oldItem, ItemStruct *newItem)
+    {
+      queue.erase(make_pair(oldItem->priority, oldItem));
+      newItem->frequency = oldItem->frequency;
+      onAccess(newItem);
+    }
+
+    void onSwap (ItemStruct *oldItem, ItemStruct *newItem)
+    {
+      queue.erase(make_pair(oldItem->priority, oldItem));
+      newItem->frequency = oldItem->frequency;
+      newItem->priority = oldItem->priority;
+      queue.insert(make_pair(newItem->priority, newItem));
+    }
+
+    ItemStruct *nextVictim (ItemStruct *victim)
+    {
+      auto next = queue.upper_bound(make_pair(victim->priority, victim));
+      return (next != queue.end()) ? next->second : NULL;
+    }
+
+    ItemStruct *chooseVictim ()
+    {
+      if (queue.empty())
+      {
+        return NULL;
+      }
+      return queue.begin()->second;
+    }
+
+    void onRemove (ItemStruct *item, bool isEvicted)
+    {
+      queue.erase(make_pair(item->priority, item));
+      if (isEvicted)
+      {
+        inflation = item->priority;
+      }
+    }
+
+    size_t getBytes () const
+    {
+      return queue.size() * 
+        (sizeof(pair<double, ItemStruct *>) + DB_TREE_NODE_BYTES);
+    }
+
+  private:
+    void enqueue (ItemStruct *item)
+    {
+      double size = dbItemSize(item->keyLen, item->flagsLen, item->valueLen);
+      item->priority = inflation + (double)item->frequency * item->cost / size;
+      queue.insert(make_pair(item->priority, item));
+    }
+
+    set<pair<double, ItemStruct *> > queue;
+    double inflation;
+};
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbCreateEvictPolicy
+ *  Description:  Creates a policy of the given type, LRU if it is unknown. The
+ *                index is the one of the hash table the policy is for
+ * =============================================================================
+ */
+DbEvictPolicy *dbCreateEvictPolicy (unsigned int policyType, 
+    const DbHashIndex *index)
+{
+  switch (policyType)
+  {
+    case DB_POLICY_SAMPLED:
+      return new DbSampledPolicy(index);
+    case DB_POLICY_GDSF:
+      return new DbGdsfPolicy();
+    case DB_POLICY_TINYLFU:
+      return new DbTinyLfuPolicy();
+    case DB_POLICY_2Q:
+      return new Db2QPolicy();
+    case DB_POLICY_ARC:
+      return new DbArcPolicy();
+    default:
+      return new DbLruPolicy();
+  }
+}		/* -----  end of function dbCreateEvictPolicy  ----- */
@@ -0,0 +1,1094 @@
+/*==============================================================================
+ *
+ *       Filename:  dbseg.cpp
+ *
+ *    Description:  Segment storage engine. Items are appended into large
+ *                  segments shared by items of similar TTL. Expired segments
+ *                  are freed whole, and memory is made by merging the oldest
+ *                  segments of a TTL bucket, keeping only the items read since
+ *                  they were written
+ *
+ * =============================================================================
+ */
+
+#include <algorithm>
+
+#include "../inc/sconst.h"
+#include "../inc/dblru.h"
+
+// The index of each shard and the bytes of the items in it, guarded by the
+// lock of the shard
+static DbSegIndex gSegIndex[DB_MAX_HASH_TABLES];
+static mutex gSegIndexMutex[DB_MAX_HASH_TABLES];
+static unsigned long int gSegLiveBytes[DB_MAX_HASH_TABLES];
+static unsigned long int gSegLivePayload[DB_MAX_HASH_TABLES];
+// The segments and the free pool, guarded by gSegMutex. The chain of a TTL
+// bucket and the room left in its last segment are guarded by the lock of
+// the bucket as well, so that a store which fits into the last segment only
+// takes that. Locks are taken in the order gSegMutex, bucket, shard
+static mutex gSegMutex;
+static DbSegment *gSegments = NULL;
+static size_t gSegCount = 0;
+static size_t gSegSize = 0;
+static size_t gSegAllocated = 0;
+static DbSegChain gSegTtlBuckets[DB_SEG_TTL_BUCKETS];
+static mutex gSegBucketMutex[DB_SEG_TTL_BUCKETS];
+static vector<DbSegment *> gSegFreePool;
+// Free segments the background evictor keeps in hand, from -w
+static size_t gSegFreeTarget = 0;
+// A segment sized buffer a merge copies the surviving items into. It then
+// takes the place of the data of the merged segment
+static char *gSegScratch = NULL;
+static atomic<unsigned long int> gSegMerges(0);
+static atomic<unsigned long int> gSegEvicted(0);
+static atomic<unsigned long int> gSegExpired(0);
+static atomic<unsigned long int> gSegExpiredBytes(0);
+
+DbSegIndex::DbSegIndex () : slots(DB_SEG_INDEX_MIN_CAPACITY), count(0)
+{
+  clear();
+}
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbSegIndex::findSlot
+ *  Description:  Returns the slot of the key, or NULL if it is not indexed
+ * =============================================================================
+ */
+SegSlotStruct *DbSegIndex::findSlot (const char *key, size_t keyLen,
+    size_t hash)
+{
+  size_t mask = slots.size() - 1;
+  for (size_t pos = hash & mask; slots[pos].item != NULL;
+      pos = (pos + 1) & mask)
+  {
+    SegItemStruct *item = slots[pos].item;
+    if ((slots[pos].hash == hash) && (item->keyLen == keyLen) &&
+        (memcmp(dbSegItemKey(item), key, keyLen) == 0))
+    {
+      return &slots[pos];
+    }
+  }
+  return NULL;
+}		/* -----  end of function DbSegIndex::findSlot  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbSegIndex::insert
+ *  Description:  Adds an item whose key is not indexed. The table is doubled
+ *                once it is half full. Throws bad_alloc if that fails
+ * =============================================================================
+ */
+void DbSegIndex::insert (SegItemStruct *item, size_t hash)
+{
+  if ((count + 1) * 2 > slots.size())
+  {
+    grow();
+  }
+  size_t mask = slots.size() - 1;
+  size_t pos = hash & mask;
+  while (slots[pos].item != NULL)
+  {
+    pos = (pos + 1) & mask;
+  }
+  slots[pos].hash = hash;
+  slots[pos].item = item;
+  count++;
+}		/* -----  end of function DbSegIndex::insert  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbSegIndex::eraseSlot
+ *  Description:  Empties the slot and moves back the entries after it which
+ *                would otherwise no longer be found. Other slot pointers are
+ *                no longer valid afterwards
+ * =============================================================================
+ */
+void DbSegIndex::eraseSlot (SegSlotStruct *slot)
+{
+  size_t mask = slots.size() - 1;
+  size_t hole = slot - &slots[0];
+  size_t pos = hole;
+  while (true)
+  {
+    pos = (pos + 1) & mask;
+    if (slots[pos].item == NULL)
+    {
+      break;
+    }
+    // An entry may move into the hole if its home is not between the hole
+    // and where it is now
+    size_t home = slots[pos].hash & mask;
+    if (((pos - home) & mask) >= ((pos - hole) & mask))
+    {
+      slots[hole] = slots[pos];
+      hole = pos;
+    }
+  }
+  slots[hole].item = NULL;
+  count--;
+}		/* -----  end of function DbSegIndex::eraseSlot  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbSegIndex::clear
+ *  Description:  Drops all the entries
+ * =============================================================================
+ */
+void DbSegIndex::clear ()
+{
+  for (auto &slot: slots)
+  {
+    slot.item = NULL;
+  }
+  count = 0;
+}		/* -----  end of function DbSegIndex::clear  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbSegIndex::scan
+ *  Description:  Appends the items in the next count slots from the cursor to
+ *                items, and returns the cursor to continue from. 0 is returned
+ *                once the end is reached. Entries shifted back by an erase or
+ *                moved by a growth in between scans may be skipped or repeated
+ * =============================================================================
+ */
+size_t DbSegIndex::scan (size_t cursor, size_t count, 
+    vector<SegItemStruct *> &items) const
+{
+  for (size_t i = 0; i < count; i++, cursor++)
+  {
+    if (cursor >= slots.size())
+    {
+      return 0;
+    }
+    if (slots[cursor].item != NULL)
+    {
+      items.push_back(slots[cursor].item);
+    }
+  }
+  return cursor;
+}		/* -----  end of function DbSegIndex::scan  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  DbSegIndex::grow
+ *  Description:  Moves the entries into a table of twice the size
+ * =============================================================================
+ */
+void DbSegIndex::grow ()
+{
+  vector<SegSlotStruct> newSlots(slots.size() * 2);
+  size_t mask = newSlots.size() - 1;
+  for (auto &slot: newSlots)
+  {
+    slot.item = NULL;
+  }
+  for (auto &slot: slots)
+  {
+    if (slot.item == NULL)
+    {
+      continue;
+    }
+    size_t pos = slot.hash & mask;
+    while (newSlots[pos].item != NULL)
+    {
+      pos = (pos + 1) & mask;
+    }
+    newSlots[pos] = slot;
+  }
+  slots.swap(newSlots);
+}		/* -----  end of function DbSegIndex::grow  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  getSegHash
+ *  Description:  Hash of the key: FNV-1a, finished with a mix so that the low
+ *                bits used by the index are spread as well as the high bits
+ *                picking the shard
+ * =============================================================================
+ */
+static size_t getSegHash (const char *key, size_t keyLen)
+{
+  unsigned long long int hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < keyLen; i++)
+  {
+    hash ^= (unsigned char)key[i];
+    hash *= 1099511628211ULL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return hash;
+}		/* -----  end of function getSegHash  ----- */
+
+inline unsigned int getSegShard (size_t hash)
+{
+  return (unsigned int)((unsigned long long int)hash >> 32) %
+    DB_MAX_HASH_TABLES;
+}
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  getTtlBucket
+ *  Description:  Returns the TTL bucket of an item expiring at expiry. Short
+ *                TTLs get narrow buckets and long TTLs wide ones
+ * =============================================================================
+ */
+static unsigned int getTtlBucket (RelTimeType expiry, RelTimeType now)
+{
+  if (expiry == DB_CLOCK_NEVER)
+  {
+    return DB_SEG_TTL_BUCKETS - 1;
+  }
+  RelTimeType ttl = 0;
+  if (expiry > now)
+  {
+    ttl = expiry - now;
+  }
+  unsigned int shift = DB_SEG_TTL_FIRST_SHIFT;
+  for (unsigned int range = 0; range < DB_SEG_TTL_RANGES; range++)
+  {
+    if (ttl < ((unsigned long int)DB_SEG_TTL_RANGE_BUCKETS << shift))
+    {
+      return range * DB_SEG_TTL_RANGE_BUCKETS + (ttl >> shift);
+    }
+    shift += DB_SEG_TTL_RANGE_SHIFT;
+  }
+  return DB_SEG_TTL_BUCKETS - 2;
+}		/* -----  end of function getTtlBucket  ----- */
+
+inline bool isSegItemExpired (const SegItemStruct *item, RelTimeType now)
+{
+  return (item->expiry < now);
+}
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  unlinkSegmentLocked
+ *  Description:  Takes the segment off the chain of its TTL bucket and puts it
+ *                into the free pool. gSegMutex and the lock of the bucket
+ *                must be held
+ * =============================================================================
+ */
+static void unlinkSegmentLocked (DbSegment *seg)
+{
+  DbSegChain &chain = gSegTtlBuckets[seg->ttlBucket];
+  if (seg->prev != NULL)
+  {
+    seg->prev->next = seg->next;
+  }
+  else
+  {
+    chain.head = seg->next;
+  }
+  if (seg->next != NULL)
+  {
+    seg->next->prev = seg->prev;
+  }
+  else
+  {
+    chain.tail = seg->prev;
+  }
+  seg->prev = NULL;
+  seg->next = NULL;
+  seg->used = 0;
+  gSegFreePool.push_back(seg);
+}		/* -----  end of function unlinkSegmentLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dropSegmentLocked
+ *  Description:  Removes the items of the segment which are still indexed and
+ *                frees the segment. gSegMutex and the lock of its bucket must
+ *                be held. Returns the number of items removed and their bytes
+ * =============================================================================
+ */
+static unsigned long int dropSegmentLocked (DbSegment *seg,
+    unsigned long int &bytes)
+{
+  unsigned long int items = 0;
+  bytes = 0;
+  for (size_t offset = 0; offset < seg->used; )
+  {
+    SegItemStruct *item = (SegItemStruct *)(seg->data + offset);
+    size_t size = dbSegItemSize(item);
+    offset += size;
+
+    size_t hash = getSegHash(dbSegItemKey(item), item->keyLen);
+    unsigned int shard = getSegShard(hash);
+    gSegIndexMutex[shard].lock();
+    SegSlotStruct *slot = gSegIndex[shard].findSlot(dbSegItemKey(item),
+        item->keyLen, hash);
+    if ((slot != NULL) && (slot->item == item))
+    {
+      gSegIndex[shard].eraseSlot(slot);
+      gSegLiveBytes[shard] -= size;
+      gSegLivePayload[shard] -= dbSegItemPayload(item);
+      items++;
+      bytes += size;
+    }
+    gSegIndexMutex[shard].unlock();
+  }
+  unlinkSegmentLocked(seg);
+  return items;
+}		/* -----  end of function dropSegmentLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  expireSegmentsLocked
+ *  Description:  Frees up to maxSegments segments all of whose items have
+ *                expired. Segments of a TTL bucket are in the order they were
+ *                written, so only the head of each bucket is looked at.
+ *                gSegMutex must be held. Returns the number freed
+ * =============================================================================
+ */
+static unsigned int expireSegmentsLocked (RelTimeType now,
+    unsigned int maxSegments)
+{
+  unsigned int freed = 0;
+  for (unsigned int bucket = 0; bucket < DB_SEG_TTL_BUCKETS; bucket++)
+  {
+    lock_guard<mutex> lock(gSegBucketMutex[bucket]);
+    DbSegment *seg = gSegTtlBuckets[bucket].head;
+    while ((freed < maxSegments) && (seg != NULL) && (seg->writers == 0) &&
+        (seg->maxExpiry < now))
+    {
+      DbSegment *next = seg->next;
+      unsigned long int bytes;
+      gSegExpired += dropSegmentLocked(seg, bytes);
+      gSegExpiredBytes += bytes;
+      freed++;
+      seg = next;
+    }
+    if (freed == maxSegments)
+    {
+      break;
+    }
+  }
+  return freed;
+}		/* -----  end of function expireSegmentsLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  mergeItemLocked
+ *  Description:  Decides what happens to an item of a segment being merged.
+ *                The first pass only keeps the items read since they were
+ *                written; the last pass keeps whatever else still fits and
+ *                evicts the rest. A kept item is copied into the scratch
+ *                buffer and the index is pointed at the copy under the lock of
+ *                its shard, so a reader always finds a whole item.
+ *                gSegMutex must be held
+ * =============================================================================
+ */
+static void mergeItemLocked (SegItemStruct *item, bool isLastPass,
+    RelTimeType now, size_t &kept, RelTimeType &maxExpiry)
+{
+  size_t size = dbSegItemSize(item);
+  size_t hash = getSegHash(dbSegItemKey(item), item->keyLen);
+  unsigned int shard = getSegShard(hash);
+
+  gSegIndexMutex[shard].lock();
+  SegSlotStruct *slot = gSegIndex[shard].findSlot(dbSegItemKey(item),
+      item->keyLen, hash);
+  if ((slot == NULL) || (slot->item != item))
+  {
+    // Deleted or written again since, or kept in the first pass
+    gSegIndexMutex[shard].unlock();
+    return;
+  }
+  bool isLive = !isSegItemExpired(item, now);
+  if (isLive && (kept + size <= gSegSize) &&
+      (isLastPass || (item->frequency > 0)))
+  {
+    SegItemStruct *copy = (SegItemStruct *)(gSegScratch + kept);
+    memcpy(copy, item, size);
+    // It has to be read again to stay ahead in later merges
+    copy->frequency /= 2;
+    slot->item = copy;
+    kept += size;
+    if (copy->expiry > maxExpiry)
+    {
+      maxExpiry = copy->expiry;
+    }
+  }
+  else if (isLastPass || !isLive)
+  {
+    gSegIndex[shard].eraseSlot(slot);
+    gSegLiveBytes[shard] -= size;
+    gSegLivePayload[shard] -= dbSegItemPayload(item);
+    if (isLive)
+    {
+      gSegEvicted++;
+    }
+  }
+  gSegIndexMutex[shard].unlock();
+}		/* -----  end of function mergeItemLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  mergeSegmentsLocked
+ *  Description:  Merges the count segments of a TTL bucket starting at first
+ *                into first. Items are kept as long as they fit, those read
+ *                since they were written ahead of the others, and the rest are
+ *                evicted. The scratch buffer holding the kept items then
+ *                becomes the data of first, and the other segments are freed.
+ *                gSegMutex and the lock of the bucket must be held
+ * =============================================================================
+ */
+static void mergeSegmentsLocked (DbSegment *first, unsigned int count)
+{
+  RelTimeType now = dbClockNow();
+  size_t kept = 0;
+  RelTimeType maxExpiry = 0;
+  DbSegment *last = first;
+
+  for (unsigned int pass = 0; pass < 2; pass++)
+  {
+    DbSegment *seg = first;
+    for (unsigned int i = 0; i < count; i++, seg = seg->next)
+    {
+      last = seg;
+      for (size_t offset = 0; offset < seg->used; )
+      {
+        SegItemStruct *item = (SegItemStruct *)(seg->data + offset);
+        offset += dbSegItemSize(item);
+        mergeItemLocked(item, (pass == 1), now, kept, maxExpiry);
+      }
+    }
+  }
+
+  // Otherwise the merged segment would be the next one picked
+  first->createTime = last->createTime;
+  DbSegment *seg = first->next;
+  for (unsigned int i = 1; i < count; i++)
+  {
+    DbSegment *next = seg->next;
+    unlinkSegmentLocked(seg);
+    seg = next;
+  }
+  swap(first->data, gSegScratch);
+  first->used = kept;
+  first->maxExpiry = maxExpiry;
+  gSegMerges++;
+}		/* -----  end of function mergeSegmentsLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  countFreeSegmentsLocked
+ *  Description:  Returns the segments in the free pool and those not yet
+ *                allocated. gSegMutex must be held
+ * =============================================================================
+ */
+static size_t countFreeSegmentsLocked ()
+{
+  return gSegFreePool.size() + gSegCount - gSegAllocated;
+}		/* -----  end of function countFreeSegmentsLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  evictSegmentsLocked
+ *  Description:  Frees at least one segment. Expired segments go first. Else
+ *                the TTL bucket whose first segment is the oldest has up to
+ *                DB_SEG_MERGE_COUNT of its segments merged if isMerged is
+ *                set, or its first one evicted. Only the background evictor
+ *                merges, as a merge copies whole segments. gSegMutex must be
+ *                held. Returns false if every segment is being written to
+ * =============================================================================
+ */
+static bool evictSegmentsLocked (bool isMerged)
+{
+  RelTimeType now = dbClockNow();
+  if (expireSegmentsLocked(now, 1) > 0)
+  {
+    return true;
+  }
+
+  unsigned int oldestBucket = DB_SEG_TTL_BUCKETS;
+  RelTimeType oldestTime = 0;
+  for (unsigned int bucket = 0; bucket < DB_SEG_TTL_BUCKETS; bucket++)
+  {
+    lock_guard<mutex> lock(gSegBucketMutex[bucket]);
+    DbSegment *seg = gSegTtlBuckets[bucket].head;
+    if ((seg != NULL) && (seg->writers == 0) &&
+        ((oldestBucket == DB_SEG_TTL_BUCKETS) ||
+         (seg->createTime < oldestTime)))
+    {
+      oldestBucket = bucket;
+      oldestTime = seg->createTime;
+    }
+  }
+  if (oldestBucket == DB_SEG_TTL_BUCKETS)
+  {
+    return false;
+  }
+
+  // Only stores holding gSegMutex link segments, so the first one is still
+  // there. It may have been reserved in since
+  lock_guard<mutex> lock(gSegBucketMutex[oldestBucket]);
+  DbSegment *oldest = gSegTtlBuckets[oldestBucket].head;
+  if (oldest->writers != 0)
+  {
+    return true;
+  }
+  unsigned int count = 1;
+  for (DbSegment *seg = oldest->next; (seg != NULL) &&
+      (count < DB_SEG_MERGE_COUNT) && (seg->writers == 0); seg = seg->next)
+  {
+    count++;
+  }
+  if (!isMerged || (count == 1) || (gSegScratch == NULL))
+  {
+    unsigned long int bytes;
+    gSegEvicted += dropSegmentLocked(oldest, bytes);
+    return true;
+  }
+  mergeSegmentsLocked(oldest, count);
+  return true;
+}		/* -----  end of function evictSegmentsLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  takeFreeSegmentLocked
+ *  Description:  Returns a segment from the free pool, evicting if there is
+ *                none, without merging. The data of a segment is allocated on
+ *                first use. gSegMutex must be held, and no bucket lock.
+ *                Returns NULL if there is no memory
+ * =============================================================================
+ */
+static DbSegment *takeFreeSegmentLocked ()
+{
+  while (gSegFreePool.empty())
+  {
+    if (gSegAllocated < gSegCount)
+    {
+      DbSegment *seg = &gSegments[gSegAllocated];
+      seg->data = (char *)dbArenaTakeSlab();
+      if (seg->data == NULL)
+      {
+        seg->data = (char *)malloc(gSegSize);
+      }
+      if (seg->data == NULL)
+      {
+        return NULL;
+      }
+      gSegAllocated++;
+      gSegFreePool.push_back(seg);
+      break;
+    }
+    if (!evictSegmentsLocked(false))
+    {
+      return NULL;
+    }
+  }
+  DbSegment *seg = gSegFreePool.back();
+  gSegFreePool.pop_back();
+  if (countFreeSegmentsLocked() < gSegFreeTarget)
+  {
+    dbWakeEvictor();
+  }
+  return seg;
+}		/* -----  end of function takeFreeSegmentLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbSegEvict
+ *  Description:  Called by the background evictor. Evicts till there are
+ *                gSegFreeTarget free segments, letting go of gSegMutex between
+ *                evictions so that stores are not held up
+ * =============================================================================
+ */
+void dbSegEvict ()
+{
+  gSegMutex.lock();
+  while (countFreeSegmentsLocked() < gSegFreeTarget)
+  {
+    if (!evictSegmentsLocked(true))
+    {
+      break;
+    }
+    gSegMutex.unlock();
+    gSegMutex.lock();
+  }
+  gSegMutex.unlock();
+}		/* -----  end of function dbSegEvict  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  reserveItem
+ *  Description:  Reserves room for an item at the end of the last segment of
+ *                its TTL bucket, under the lock of the bucket only. If it does
+ *                not fit, a segment is taken from the free pool under
+ *                gSegMutex, which has to be taken first, and the bucket is
+ *                looked at again. The segment is returned in seg with its
+ *                writer count raised; the caller lowers it once the item is in
+ *                the index or given up. Returns NULL if there is no memory
+ * =============================================================================
+ */
+static SegItemStruct *reserveItem (size_t size, RelTimeType expiry,
+    RelTimeType now, DbSegment *&seg)
+{
+  unsigned int bucket = getTtlBucket(expiry, now);
+  DbSegChain &chain = gSegTtlBuckets[bucket];
+
+  gSegBucketMutex[bucket].lock();
+  seg = chain.tail;
+  if ((seg == NULL) || (seg->used + size > gSegSize))
+  {
+    gSegBucketMutex[bucket].unlock();
+    gSegMutex.lock();
+    DbSegment *fresh = takeFreeSegmentLocked();
+    if (fresh == NULL)
+    {
+      gSegMutex.unlock();
+      return NULL;
+    }
+    gSegBucketMutex[bucket].lock();
+    seg = chain.tail;
+    if ((seg != NULL) && (seg->used + size <= gSegSize))
+    {
+      // Another store started a segment in the meantime
+      gSegFreePool.push_back(fresh);
+    }
+    else
+    {
+      seg = fresh;
+      seg->createTime = now;
+      seg->maxExpiry = 0;
+      seg->ttlBucket = bucket;
+      seg->prev = chain.tail;
+      seg->next = NULL;
+      if (chain.tail != NULL)
+      {
+        chain.tail->next = seg;
+      }
+      else
+      {
+        chain.head = seg;
+      }
+      chain.tail = seg;
+    }
+    gSegMutex.unlock();
+  }
+  SegItemStruct *item = (SegItemStruct *)(seg->data + seg->used);
+  seg->used += size;
+  if (expiry > seg->maxExpiry)
+  {
+    seg->maxExpiry = expiry;
+  }
+  seg->writers++;
+  gSegBucketMutex[bucket].unlock();
+  return item;
+}		/* -----  end of function reserveItem  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  checkExistingLocked
+ *  Description:  Checks whether a store may go ahead given the item in slot
+ *                and what the store requires of it (see segStoreMode). An
+ *                expired item is erased and taken as missing. The lock of
+ *                the shard must be held
+ * =============================================================================
+ */
+static int checkExistingLocked (unsigned int shard, SegSlotStruct *&slot,
+    const string &casUniq, unsigned int mode, RelTimeType now)
+{
+  if ((slot != NULL) && isSegItemExpired(slot->item, now))
+  {
+    gSegLiveBytes[shard] -= dbSegItemSize(slot->item);
+    gSegLivePayload[shard] -= dbSegItemPayload(slot->item);
+    gSegIndex[shard].eraseSlot(slot);
+    slot = NULL;
+  }
+  if (slot == NULL)
+  {
+    return (casUniq.empty() && (mode != SEG_STORE_PRESENT) &&
+        (mode != SEG_STORE_TOUCH)) ? SUCCESS : NOT_EXIST;
+  }
+  if (mode == SEG_STORE_ABSENT)
+  {
+    return EXIST;
+  }
+  if (!casUniq.empty() &&
+      (to_string(slot->item->casUniq).compare(casUniq) != 0))
+  {
+    return EXIST;
+  }
+  return SUCCESS;
+}		/* -----  end of function checkExistingLocked  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  storeItem
+ *  Description:  Writes an item into its segment and points the index at it.
+ *                Whether the store may go ahead is checked before writing, so
+ *                that failing adds and cas do not use up segment space, and
+ *                again once the item is written
+ * =============================================================================
+ */
+static int storeItem (const string &key, const string &flags,
+    const string &casUniq, const string &value, unsigned long int expiry,
+    unsigned int mode)
+{
+  RelTimeType now = dbClockNow();
+  size_t size = dbSegItemSize(key.size(), flags.size(), value.size());
+  if ((key.size() > UCHAR_MAX) || (flags.size() > UCHAR_MAX) ||
+      (size > gSegSize))
+  {
+    return MEMORY_FULL;
+  }
+  size_t hash = getSegHash(key.data(), key.size());
+  unsigned int shard = getSegShard(hash);
+  RelTimeType itemExpiry = dbClockExpiry(expiry, now);
+
+  gSegIndexMutex[shard].lock();
+  SegSlotStruct *slot = gSegIndex[shard].findSlot(key.data(), key.size(),
+      hash);
+  int ret = checkExistingLocked(shard, slot, casUniq, mode, now);
+  gSegIndexMutex[shard].unlock();
+  if (ret != SUCCESS)
+  {
+    return ret;
+  }
+
+  DbSegment *seg;
+  SegItemStruct *item = reserveItem(size, itemExpiry, now, seg);
+  if (item == NULL)
+  {
+    return MEMORY_FULL;
+  }
+  item->casUniq = (mode == SEG_STORE_TOUCH) ?
+    strtoull(casUniq.c_str(), NULL, 10) : dbGetNewCas();
+  item->expiry = itemExpiry;
+  item->valueLen = value.size();
+  item->keyLen = key.size();
+  item->flagsLen = flags.size();
+  item->frequency = 0;
+  memcpy(item->data, key.data(), key.size());
+  memcpy(item->data + key.size(), flags.data(), flags.size());
+  memcpy(dbSegItemValue(item), value.data(), value.size());
+
+  gSegIndexMutex[shard].lock();
+  slot = gSegIndex[shard].findSlot(key.data(), key.size(), hash);
+  ret = checkExistingLocked(shard, slot, casUniq, mode, now);
+  if (ret == SUCCESS)
+  {
+    if (slot != NULL)
+    {
+      gSegLiveBytes[shard] -= dbSegItemSize(slot->item);
+      gSegLivePayload[shard] -= dbSegItemPayload(slot->item);
+      slot->item = item;
+      gSegLiveBytes[shard] += size;
+      gSegLivePayload[shard] += dbSegItemPayload(item);
+    }
+    else
+    {
+      try
+      {
+        gSegIndex[shard].insert(item, hash);
+        gSegLiveBytes[shard] += size;
+        gSegLivePayload[shard] += dbSegItemPayload(item);
+      }
+      catch (const bad_alloc& ba)
+      {
+        ret = MEMORY_FULL;
+      }
+    }
+  }
+  gSegIndexMutex[shard].unlock();
+  // An item left out of the index is just dead space in the segment
+  seg->writers--;
+  return ret;
+}		/* -----  end of function storeItem  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbSegInit
+ *  Description:  Sizes the segments from the memory limit and sets up the
+ *                free pool. Segment memory is allocated as it gets used
+ * =============================================================================
+ */
+void dbSegInit ()
+{
+  unsigned long int memLimit = gServMemLimit;
+  gSegSize = DB_SEG_SIZE;
+  if (memLimit / DB_SEG_MIN_COUNT < gSegSize)
+  {
+    gSegSize = (memLimit / DB_SEG_MIN_COUNT) & ~(size_t)7;
+  }
+  gSegCount = (gSegSize == 0) ? 0 : memLimit / gSegSize;
+  gSegments = new DbSegment[gSegCount];
+  for (size_t i = 0; i < gSegCount; i++)
+  {
+    gSegments[i].data = NULL;
+    gSegments[i].used = 0;
+    gSegments[i].writers = 0;
+    gSegments[i].prev = NULL;
+    gSegments[i].next = NULL;
+  }
+  // Without it every eviction drops a whole segment instead of merging
+  gSegScratch = (char *)dbArenaTakeSlab();
+  if (gSegScratch == NULL)
+  {
+    gSegScratch = (char *)malloc(gSegSize);
+  }
+  if (gServEvictWatermark < 100)
+  {
+    gSegFreeTarget = max((size_t)1, 
+        gSegCount * (100 - gServEvictWatermark) / 100);
+  }
+}		/* -----  end of function dbSegInit  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbSegInsertElement
+ *  Description:  Stores an element, checking the cas value if one is given
+ * =============================================================================
+ */
+int dbSegInsertElement (const string &key, const string &flags,
+    const string &casUniq, const string &value,
+    const unsigned long int &expiry)
+{
+  return storeItem(key, flags, casUniq, value, expiry, SEG_STORE_ANY);
+}		/* -----  end of function dbSegInsertElement  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbSegAddElement
+ *  Description:  Stores an element if it does not already exist
+ * =============================================================================
+ */
+int dbSegAddElement (const string &key, const string &flags,
+    const string &value, const unsigned long int &expiry)
+{
+  return storeItem(key, flags, "", value, expiry, SEG_STORE_ABSENT);
+}		/* -----  end of function dbSegAddElement  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbSegReplaceElement
+ *  Description:  Stores an element only if it already exists
+ * =============================================================================
+ */
+int dbSegReplaceElement (const string &key, const string &flags,
+    const string &value, const unsigned long int &expiry)
+{
+  return storeItem(key, flags, "", value, expiry, SEG_STORE_PRESENT);
+}		/* -----  end of function dbSegReplaceElement  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbSegTouchElement
+ *  Description:  Gives the element a new expiry. An item never changes its
+ *                expiry inside a segment, as the segment is freed by the
+ *                latest expiry of its items, so it is written again into the
+ *                TTL bucket of the new expiry. The copy keeps the cas value,
+ *                and is only put in if the item is still the one read; if a
+ *                store got in between, the newer item is read and touched,
+ *                till the touch goes through or the item is gone
+ * =============================================================================
+ */
+int dbSegTouchElement (const string &key, unsigned long int expiry)
+{
+  size_t hash = getSegHash(key.data(), key.size());
+  unsigned int shard = getSegShard(hash);
+
+  int ret = EXIST;
+  while (ret == EXIST)
+  {
+    RelTimeType now = dbClockNow();
+    gSegIndexMutex[shard].lock();
+    SegSlotStruct *slot = gSegIndex[shard].findSlot(key.data(), key.size(),
+        hash);
+    if ((slot == NULL) || isSegItemExpired(slot->item, now))
+    {
+      gSegIndexMutex[shard].unlock();
+      return NOT_EXIST;
+    }
+    SegItemStruct *item = slot->item;
+    string flags(dbSegItemFlags(item), item->flagsLen);
+    string value(dbSegItemValue(item), item->valueLen);
+    string cas(to_string(item->casUniq));
+    gSegIndexMutex[shard].unlock();
+
+    ret = storeItem(key, flags, cas, value, expiry, SEG_STORE_TOUCH);
+  }
+  return ret;
+}		/* -----  end of function dbSegTouchElement  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbSegDeleteElement
+ *  Description:  Removes the element, or gives it a new expiry like
+ *                dbSegTouchElement
+ * =============================================================================
+ */
+int dbSegDeleteElement (const string &key, unsigned long int expiry)
+{
+  if (expiry != 0)
+  {
+    return dbSegTouchElement(key, expiry);
+  }
+  RelTimeType now = dbClockNow();
+  size_t hash = getSegHash(key.data(), key.size());
+  unsigned int shard = getSegShard(hash);
+
+  gSegIndexMutex[shard].lock();
+  SegSlotStruct *slot = gSegIndex[shard].findSlot(key.data(), key.size(),
+      hash);
+  if ((slot == NULL) || isSegItemExpired(slot->item, now))
+  {
+    gSegIndexMutex[shard].unlock();
+    return NOT_EXIST;
+  }
+  SegItemStruct *item = slot->item;
+  gSegLiveBytes[shard] -= dbSegItemSize(item);
+  gSegLivePayload[shard] -= dbSegItemPayload(item);
+  gSegIndex[shard].eraseSlot(slot);
+  gSegIndexMutex[shard].unlock();
+  return SUCCESS;
+}		/* -----  end of function dbSegDeleteElement  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbSegGetElement
+ *  Description:  Copies the element out under the lock of its shard and counts
+ *                the read towards the item surviving a merge
+ * =============================================================================
+ */
+int dbSegGetElement (const string &key, string &flags, string &cas,
+    string &value, unsigned long int &expiry)
+{
+  RelTimeType now = dbClockNow();
+  size_t hash = getSegHash(key.data(), key.size());
+  unsigned int shard = getSegShard(hash);
+
+  gSegIndexMutex[shard].lock();
+  SegSlotStruct *slot = gSegIndex[shard].findSlot(key.data(), key.size(),
+      hash);
+  if (slot == NULL)
+  {
+    gSegIndexMutex[shard].unlock();
+    return NOT_EXIST;
+  }
+  SegItemStruct *item = slot->item;
+  if (isSegItemExpired(item, now))
+  {
+    gSegLiveBytes[shard] -= dbSegItemSize(item);
+    gSegLivePayload[shard] -= dbSegItemPayload(item);
+    gSegIndex[shard].eraseSlot(slot);
+    gSegIndexMutex[shard].unlock();
+    return NOT_EXIST;
+  }
+  value.assign(dbSegItemValue(item), item->valueLen);
+  flags.assign(dbSegItemFlags(item), item->flagsLen);
+  cas.assign(to_string(item->casUniq));
+  expiry = dbClockSecondsLeft(item->expiry, now);
+  if (item->frequency < DB_SEG_MAX_FREQUENCY)
+  {
+    item->frequency++;
+  }
+  gSegIndexMutex[shard].unlock();
+  return SUCCESS;
+}		/* -----  end of function dbSegGetElement  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbSegFlushAll
+ *  Description:  Drops every item and frees the segments. Segments still being
+ *                written to stay till they are merged or expire; the items
+ *                being written into them are newer than the flush
+ * =============================================================================
+ */
+void dbSegFlushAll ()
+{
+  gSegMutex.lock();
+  for (unsigned int shard = 0; shard < DB_MAX_HASH_TABLES; shard++)
+  {
+    gSegIndexMutex[shard].lock();
+    gSegIndex[shard].clear();
+    gSegLiveBytes[shard] = 0;
+    gSegLivePayload[shard] = 0;
+    gSegIndexMutex[shard].unlock();
+  }
+  for (unsigned int bucket = 0; bucket < DB_SEG_TTL_BUCKETS; bucket++)
+  {
+    lock_guard<mutex> lock(gSegBucketMutex[bucket]);
+    DbSegment *seg = gSegTtlBuckets[bucket].head;
+    while (seg != NULL)
+    {
+      DbSegment *next = seg->next;
+      if (seg->writers == 0)
+      {
+        unlinkSegmentLocked(seg);
+      }
+      seg = next;
+    }
+  }
+  gSegMutex.unlock();
+}		/* -----  end of function dbSegFlushAll  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbSegCrawl
+ *  Description:  Frees the next segment whose items have all expired. Called
+ *                by the crawler thread. Returns true once there is none left
+ * =============================================================================
+ */
+bool dbSegCrawl ()
+{
+  RelTimeType now = dbClockNow();
+  gSegMutex.lock();
+  bool isDone = (expireSegmentsLocked(now, 1) == 0);
+  gSegMutex.unlock();
+  return isDone;
+}		/* -----  end of function dbSegCrawl  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbSegSnapshotScan
+ *  Description:  Appends the live items in the next slots of the index of the
+ *                shard from the cursor to the buffer as snapshot records, and
+ *                adds their number to items. Returns the cursor to continue
+ *                from, 0 at the end
+ * =============================================================================
+ */
+size_t dbSegSnapshotScan (unsigned int shard, size_t cursor, string &buffer,
+    unsigned long int &items)
+{
+  RelTimeType now = dbClockNow();
+  vector<SegItemStruct *> batch;
+
+  gSegIndexMutex[shard].lock();
+  cursor = gSegIndex[shard].scan(cursor, DB_SNAP_BATCH, batch);
+  for (auto item: batch)
+  {
+    if (isSegItemExpired(item, now))
+    {
+      continue;
+    }
+    time_t expiry = 0;
+    if (item->expiry != DB_CLOCK_NEVER)
+    {
+      expiry = dbClockToAbsolute(item->expiry);
+    }
+    dbSnapAppendRecord(buffer, dbSegItemKey(item), item->keyLen,
+        dbSegItemFlags(item), item->flagsLen, dbSegItemValue(item),
+        item->valueLen, expiry, 0);
+    items++;
+  }
+  gSegIndexMutex[shard].unlock();
+  return cursor;
+}		/* -----  end of function dbSegSnapshotScan  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbSegAppendStats
+ *  Description:  Appends the stats of the segment engine to the output of the
+ *                stats command
+ * =============================================================================
+ */
+void dbSegAppendStats (string &output)
+{
+  unsigned long int items = 0;
+  unsigned long int bytes = 0;
+  unsigned long int payloadBytes = 0;
+  unsigned long int hashBytes = 0;
+  for (unsigned int shard = 0; shard < DB_MAX_HASH_TABLES; shard++)
+  {
+    gSegIndexMutex[shard].lock();
+    items += gSegIndex[shard].size();
+    bytes += gSegLiveBytes[shard];
+    payloadBytes += gSegLivePayload[shard];
+    hashBytes += gSegIndex[shard].getBytes();
+    gSegIndexMutex[shard].unlock();
+  }
+  gSegMutex.lock();
+  unsigned long int freeSegments = countFreeSegmentsLocked();
+  unsigned long int allocatedBytes = gSegAllocated * gSegSize;
+  gSegMutex.unlock();
+
+  dbAppendStat(output, "curr_items", items);
+  dbAppendStat(output, "bytes", bytes);
+  dbAppendStat(output, "payload_bytes", payloadBytes);
+  dbAppendStat(output, "overhead_bytes", bytes - payloadBytes);
+  dbAppendStat(output, "limit_maxbytes", gServMemLimit);
+  dbAppendStat(output, "hash_bytes", hashBytes);
+  dbAppendStat(output, "segment_bytes", allocatedBytes);
+  dbAppendStat(output, "segment_size", gSegSize);
+  dbAppendStat(output, "segments", gSegCount);
+  dbAppendStat(output, "segments_free", freeSegments);
+  dbAppendStat(output, "segment_merges", gSegMerges);
+  dbAppendStat(output, "evictions", gSegEvicted);
+  dbAppendStat(output, "crawler_reclaimed", gSegExpired);
+  dbAppendStat(output, "crawler_reclaimed_bytes", gSegExpiredBytes);
+}		/* -----  end of function dbSegAppendStats  ----- */
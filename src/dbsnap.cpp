@@ -0,0 +1,362 @@
+/*==============================================================================
+ *
+ *       Filename:  dbsnap.cpp
+ *
+ *    Description:  Snapshots of the live items to a file, taken by the
+ *                  snapshot command or every -P seconds, and loaded back at
+ *                  startup. A snapshot copies a batch of items at a time out
+ *                  of each hash table, so that writers wait at most for one
+ *                  batch. It is written to a temporary file which is renamed
+ *                  over the last snapshot once complete. Loading reads the
+ *                  section of each hash table in a thread of its own
+ *
+ * =============================================================================
+ */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "../inc/sconst.h"
+#include "../inc/dblru.h"
+#include "../inc/sprot.h"
+#include "../inc/dbsnap.h"
+
+// Held while a snapshot is written, so that there is only one at a time
+static mutex gSnapshotMutex;
+static atomic<unsigned long int> gSnapshots(0);
+static atomic<unsigned long int> gSnapshotFailures(0);
+static atomic<unsigned long int> gSnapshotItems(0);
+static atomic<unsigned long int> gSnapshotBytes(0);
+static atomic<unsigned long int> gSnapshotUsec(0);
+static atomic<unsigned long int> gSnapshotLoaded(0);
+static atomic<unsigned long int> gSnapshotLoadUsec(0);
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbSnapAppendRecord
+ *  Description:  Appends an item to the buffer in the layout of a section.
+ *                expiry is an absolute time, 0 if the item never expires
+ * =============================================================================
+ */
+void dbSnapAppendRecord (string &buffer, const char *key, unsigned int keyLen,
+    const char *flags, unsigned int flagsLen, const char *value,
+    unsigned int valueLen, time_t expiry, unsigned int cost)
+{
+  DbSnapRecord record;
+  memset(&record, 0, sizeof(record));
+  record.expiry = expiry;
+  record.keyLen = keyLen;
+  record.flagsLen = flagsLen;
+  record.valueLen = valueLen;
+  record.cost = cost;
+  buffer.append((const char *)&record, sizeof(record));
+  buffer.append(key, keyLen);
+  buffer.append(flags, flagsLen);
+  buffer.append(value, valueLen);
+}		/* -----  end of function dbSnapAppendRecord  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  writeBuffer
+ *  Description:  Writes all of the buffer to the file. Returns false if that
+ *                fails
+ * =============================================================================
+ */
+static bool writeBuffer (int fd, const string &buffer)
+{
+  size_t written = 0;
+  while (written < buffer.size())
+  {
+    ssize_t ret = write(fd, buffer.data() + written, buffer.size() - written);
+    if (ret < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    written += ret;
+  }
+  return true;
+}		/* -----  end of function writeBuffer  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbSnapshotWrite
+ *  Description:  Writes the live items to the snapshot file. Returns EXIST if
+ *                a snapshot is already being written, and FAILURE if the file
+ *                could not be written, in which case the last snapshot is
+ *                left as it was
+ * =============================================================================
+ */
+int dbSnapshotWrite ()
+{
+  unique_lock<mutex> snapshotLock(gSnapshotMutex, try_to_lock);
+  if (!snapshotLock.owns_lock())
+  {
+    return EXIST;
+  }
+  auto start = chrono::steady_clock::now();
+  string tempFile = gServSnapshotFile + ".tmp";
+  int fd = open(tempFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    gSnapshotFailures++;
+    return FAILURE;
+  }
+
+  DbSnapHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = DB_SNAP_MAGIC;
+  header.version = DB_SNAP_VERSION;
+  header.sectionCount = DB_MAX_HASH_TABLES;
+  header.time = dbClockToAbsolute(dbClockNow());
+  // The sections go after the header, which is written once they are done
+  unsigned long long int offset = sizeof(header);
+  bool isWritten = (lseek(fd, offset, SEEK_SET) == (off_t)offset);
+  unsigned long int items = 0;
+  string buffer;
+  for (unsigned int hashTblNum = 0;
+      isWritten && (hashTblNum < DB_MAX_HASH_TABLES); hashTblNum++)
+  {
+    header.sectionOffset[hashTblNum] = offset;
+    unsigned long int sectionItems = 0;
+    size_t cursor = 0;
+    do
+    {
+      buffer.clear();
+      cursor = dbSnapshotScan(hashTblNum, cursor, buffer, sectionItems);
+      isWritten = writeBuffer(fd, buffer);
+      offset += buffer.size();
+    } while (isWritten && (cursor != 0));
+    header.sectionBytes[hashTblNum] = offset -
+      header.sectionOffset[hashTblNum];
+    header.sectionItems[hashTblNum] = sectionItems;
+    items += sectionItems;
+  }
+  isWritten = isWritten &&
+    (pwrite(fd, &header, sizeof(header), 0) == sizeof(header)) &&
+    (fsync(fd) == 0);
+  isWritten = (close(fd) == 0) && isWritten;
+  if (!isWritten || (rename(tempFile.c_str(), gServSnapshotFile.c_str()) != 0))
+  {
+    unlink(tempFile.c_str());
+    gSnapshotFailures++;
+    return FAILURE;
+  }
+
+  gSnapshots++;
+  gSnapshotItems = items;
+  gSnapshotBytes = offset;
+  gSnapshotUsec = chrono::duration_cast<chrono::microseconds>(
+      chrono::steady_clock::now() - start).count();
+  return SUCCESS;
+}		/* -----  end of function dbSnapshotWrite  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  fillBuffer
+ *  Description:  Makes sure that the next size bytes of the section are in
+ *                the buffer from pos on, reading on from offset up to end.
+ *                Returns false if the section ends first
+ * =============================================================================
+ */
+static bool fillBuffer (int fd, string &buffer, size_t &pos,
+    unsigned long long int &offset, unsigned long long int end, size_t size)
+{
+  if (buffer.size() - pos >= size)
+  {
+    return true;
+  }
+  buffer.erase(0, pos);
+  pos = 0;
+  while (buffer.size() < size)
+  {
+    unsigned long long int wanted = size - buffer.size();
+    if (wanted < DB_SNAP_READ_SIZE)
+    {
+      wanted = DB_SNAP_READ_SIZE;
+    }
+    if (wanted > end - offset)
+    {
+      wanted = end - offset;
+    }
+    if (wanted == 0)
+    {
+      return false;
+    }
+    size_t filled = buffer.size();
+    buffer.resize(filled + wanted);
+    ssize_t ret = pread(fd, &buffer[filled], wanted, offset);
+    if (ret <= 0)
+    {
+      buffer.resize(filled);
+      return false;
+    }
+    buffer.resize(filled + ret);
+    offset += ret;
+  }
+  return true;
+}		/* -----  end of function fillBuffer  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  loadSection
+ *  Description:  Stores the items of a section of the snapshot, skipping the
+ *                ones which have expired since it was taken. The number
+ *                stored is left in loaded
+ * =============================================================================
+ */
+static void loadSection (int fd, unsigned long long int offset,
+    unsigned long long int bytes, unsigned long int *loaded)
+{
+  unsigned long long int end = offset + bytes;
+  time_t now = dbClockToAbsolute(dbClockNow());
+  string buffer;
+  size_t pos = 0;
+  DbSnapRecord record;
+
+  *loaded = 0;
+  while (fillBuffer(fd, buffer, pos, offset, end, sizeof(record)))
+  {
+    memcpy(&record, &buffer[pos], sizeof(record));
+    pos += sizeof(record);
+    size_t length = (size_t)record.keyLen + record.flagsLen +
+      record.valueLen;
+    if (!fillBuffer(fd, buffer, pos, offset, end, length))
+    {
+      break;
+    }
+    const char *data = &buffer[pos];
+    pos += length;
+    if ((record.expiry != 0) && (record.expiry <= now))
+    {
+      continue;
+    }
+    unsigned long int expiry = 0;
+    if (record.expiry != 0)
+    {
+      expiry = record.expiry - now;
+    }
+    string key(data, record.keyLen);
+    string flags(data + record.keyLen, record.flagsLen);
+    string value(data + record.keyLen + record.flagsLen, record.valueLen);
+    if (dbInsertElement(key, flags, "", value, expiry, record.cost) ==
+        SUCCESS)
+    {
+      (*loaded)++;
+    }
+  }
+}		/* -----  end of function loadSection  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  loadSnapshot
+ *  Description:  Stores the items of the snapshot file, if there is one, with
+ *                a loader thread per section
+ * =============================================================================
+ */
+static void loadSnapshot ()
+{
+  auto start = chrono::steady_clock::now();
+  int fd = open(gServSnapshotFile.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    return;
+  }
+  DbSnapHeader header;
+  struct stat fileStat;
+  bool isValid = (fstat(fd, &fileStat) == 0) &&
+    (pread(fd, &header, sizeof(header), 0) == sizeof(header)) &&
+    (header.magic == DB_SNAP_MAGIC) && (header.version == DB_SNAP_VERSION) &&
+    (header.sectionCount == DB_MAX_HASH_TABLES);
+  for (unsigned int section = 0; isValid && (section < DB_MAX_HASH_TABLES);
+      section++)
+  {
+    isValid = (header.sectionOffset[section] + header.sectionBytes[section] <=
+        (unsigned long long int)fileStat.st_size);
+  }
+  if (!isValid)
+  {
+    close(fd);
+    cout<<"Ignoring "<<gServSnapshotFile<<", it is not a snapshot"<<endl;
+    return;
+  }
+
+  vector<thread> loaders;
+  vector<unsigned long int> loaded(DB_MAX_HASH_TABLES);
+  for (unsigned int section = 0; section < DB_MAX_HASH_TABLES; section++)
+  {
+    loaders.push_back(thread(loadSection, fd, header.sectionOffset[section],
+          header.sectionBytes[section], &loaded[section]));
+  }
+  unsigned long int items = 0;
+  for (unsigned int section = 0; section < DB_MAX_HASH_TABLES; section++)
+  {
+    loaders[section].join();
+    items += loaded[section];
+  }
+  close(fd);
+
+  gSnapshotLoaded = items;
+  gSnapshotLoadUsec = chrono::duration_cast<chrono::microseconds>(
+      chrono::steady_clock::now() - start).count();
+  cout<<"Loaded "<<items<<" items from "<<gServSnapshotFile<<endl;
+}		/* -----  end of function loadSnapshot  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  snapshotMain
+ *  Description:  Takes a snapshot every -P seconds
+ * =============================================================================
+ */
+static void snapshotMain ()
+{
+  while (true)
+  {
+    this_thread::sleep_for(chrono::seconds(gServSnapshotInterval));
+    if (dbSnapshotWrite() == FAILURE)
+    {
+      cout<<"Could not write the snapshot to "<<gServSnapshotFile<<endl;
+    }
+  }
+}		/* -----  end of function snapshotMain  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbSnapshotInit
+ *  Description:  Loads the snapshot file and starts taking periodic snapshots.
+ *                Has to be called after dbInit. Items picked up again from
+ *                the arena file are newer than any snapshot, so none is
+ *                loaded then
+ * =============================================================================
+ */
+void dbSnapshotInit ()
+{
+  if (gServSnapshotFile.empty())
+  {
+    return;
+  }
+  if (!dbArenaIsRestored())
+  {
+    loadSnapshot();
+  }
+  if (gServSnapshotInterval > 0)
+  {
+    thread(snapshotMain).detach();
+  }
+}		/* -----  end of function dbSnapshotInit  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  dbSnapshotAppendStats
+ *  Description:  Appends the stats of the snapshots to the output of the
+ *                stats command
+ * =============================================================================
+ */
+void dbSnapshotAppendStats (string &output)
+{
+  if (gServSnapshotFile.empty())
+  {
+    return;
+  }
+  dbAppendStat(output, "snapshots", gSnapshots);
+  dbAppendStat(output, "snapshot_failures", gSnapshotFailures);
+  dbAppendStat(output, "snapshot_items", gSnapshotItems);
+  dbAppendStat(output, "snapshot_bytes", gSnapshotBytes);
+  dbAppendStat(output, "snapshot_usec", gSnapshotUsec);
+  dbAppendStat(output, "snapshot_loaded", gSnapshotLoaded);
+  dbAppendStat(output, "snapshot_load_usec", gSnapshotLoadUsec);
+}		/* -----  end of function dbSnapshotAppendStats  ----- */
@@ -11,6 +11,53 @@
 #include "../inc/sinc.h"
 #include "../inc/scmd.h"
 
+/* ===  FUNCTION  ==============================================================
+ *         Name:  cmdProcessOptions
+ *  Description:  Parses the tokens after <bytes> or <cas unique>: "noreply"
+ *                and the cost hint "C<cost>", the cost of recomputing the
+ *                value, used by the gdsf eviction policy
+ * =============================================================================
+ */
+static void cmdProcessOptions (const string &options, string &output,
+    StorageStruct &store)
+{
+  string::size_type start = 0;
+  while (start < options.size())
+  {
+    string::size_type end = options.find(' ', start);
+    if (end == string::npos)
+    {
+      end = options.size();
+    }
+    string token = options.substr(start, end - start);
+    start = end + 1;
+    if (token.empty())
+    {
+      continue;
+    }
+    if (token.compare("noreply") == 0)
+    {
+      store.noreply = true;
+      continue;
+    }
+    if ((token[0] == 'C') && (token.size() > 1) && isdigit(token[1]))
+    {
+      try
+      {
+        unsigned long int cost = stoul(token.substr(1));
+        store.cost = (cost > DB_MAX_ITEM_COST) ? DB_MAX_ITEM_COST : cost;
+        continue;
+      }
+      catch (const out_of_range& oor)
+      {
+        store.cost = DB_MAX_ITEM_COST;
+        continue;
+      }
+    }
+    output.assign ("CLIENT_ERROR junk found instead of \"noreply\"\r\n");
+    return;
+  }
+}		/* -----  end of function cmdProcessOptions  ----- */
 
 /* ===  FUNCTION  ==============================================================
  *         Name:  cmdProcessCommon
@@ -25,6 +72,8 @@ int cmdProcessCommon (const string &input, string &output, bool isCas,
   unsigned int nextSpace = input.find(' ');
   unsigned int tempSpace;
   unsigned int nextEndl = input.find("\r\n");
+  store.cost = DB_DEF_ITEM_COST;
+  store.noreply = false;
   if ((nextSpace == string::npos) || (nextSpace > nextEndl))
   {
     output.assign ("CLIENT_ERROR key not found\r\n");
@@ -60,14 +109,14 @@ int cmdProcessCommon (const string &input, string &output, bool isCas,
       store.expTime = stoul(expTimeStr);
       if (store.expTime > EXPIRY_THRESHOLD)
       {
-        time_t curSystemTime;
-        time(&curSystemTime);
-        store.expTime -= curSystemTime;
-        if (store.expTime < 0)
+        // An absolute time
+        unsigned long int curSystemTime = dbClockToAbsolute(dbClockNow());
+        if (store.expTime <= curSystemTime)
         {
           output.assign ("CLIENT_ERROR invalid expiry time\r\n");
           return 0;
         }
+        store.expTime -= curSystemTime;
       }
     }
     catch (const invalid_argument& ia)
@@ -116,25 +165,15 @@ int cmdProcessCommon (const string &input, string &output, bool isCas,
   }
   else
   {
-    // noreply could be there or just a space between <bytes> and \r\n
+    // noreply and the cost hint could be there or just a space between
+    // <bytes> and \r\n
     nextSpace = tempSpace;
     nextSpace++;
-    if (nextSpace == nextEndl)
-    {
-      // No noreply found
-      store.noreply = false;
-    }
-    else
+    cmdProcessOptions(input.substr(nextSpace, nextEndl - nextSpace), output,
+        store);
+    if (output.size() > 0)
     {
-      string noReplyStr = input.substr(nextSpace, 
-          (tempSpace = input.find("\r\n", nextSpace)) - nextSpace);
-      if ((noReplyStr.compare("noreply") != 0) &&
-          (noReplyStr.compare("noreply ") != 0))
-      {
-        output.assign ("CLIENT_ERROR junk found instead of \"noreply\"\r\n");
-        return 0;
-      }
-      store.noreply = true;
+      return 0;
     }
   }
   try
@@ -192,7 +231,7 @@ int cmdProcessSet (const string &input, string &output)
   }
 
   if (dbInsertElement(store.key, store.flags, store.casStr, store.data, 
-        store.expTime) == MEMORY_FULL)
+        store.expTime, store.cost) == MEMORY_FULL)
   {
     cout<<"Could not set element"<<endl;
     if (store.noreply == false)
@@ -232,7 +271,7 @@ int cmdProcessAdd (const string &input, string &output)
 
   // We have everything to do the actual processing.
   ret = dbAddElement(store.key, store.flags, store.casStr, store.data, 
-        store.expTime);
+        store.expTime, store.cost);
   if (ret == MEMORY_FULL)
   {
     cout<<"Could not add element"<<endl;
@@ -280,9 +319,9 @@ int cmdProcessReplace (const string &input, string &output)
   }
   
   // We have everything to do the actual processing.
-  string flags, cas, value;
-  unsigned long int expiry;
-  if (dbGetElement(store.key, flags, cas, value, expiry) != SUCCESS)
+  ret = dbReplaceElement(store.key, store.flags, store.casStr, store.data, 
+      store.expTime, store.cost);
+  if (ret == NOT_EXIST)
   {
     // Data is not already present
     cout<<"Could not replace element"<<endl;
@@ -292,9 +331,7 @@ int cmdProcessReplace (const string &input, string &output)
     }
     return 0;
   }
-
-  if (dbInsertElement(store.key, store.flags, store.casStr, store.data, 
-        store.expTime) == MEMORY_FULL)
+  if (ret == MEMORY_FULL)
   {
     cout<<"Could not replace element"<<endl;
     if (store.noreply == false)
@@ -311,6 +348,44 @@ int cmdProcessReplace (const string &input, string &output)
   return 0;
 }		/* -----  end of function cmdProcessReplace  ----- */
 
+/* ===  FUNCTION  ==============================================================
+ *         Name:  cmdAppendData
+ *  Description:  Adds the data of an append, or of a prepend if isPrepend is
+ *                set, to the stored value. A value the database cannot add
+ *                to in place is stored again as a whole, only if its cas
+ *                value shows that nobody changed it in between; otherwise
+ *                it is tried again
+ * =============================================================================
+ */
+static int cmdAppendData (StorageStruct &store, bool isPrepend)
+{
+  int ret = dbAppendElement(store.key, store.data, isPrepend);
+  while (ret == FAILURE)
+  {
+    string value, cas;
+    if (dbGetElement(store.key, store.flags, cas, value, store.expTime) 
+        != SUCCESS)
+    {
+      return NOT_EXIST;
+    }
+    if (isPrepend)
+    {
+      value.insert(0, store.data);
+    }
+    else
+    {
+      value.append(store.data);
+    }
+    ret = dbInsertElement(store.key, store.flags, cas, value, store.expTime,
+        DB_ITEM_COST_KEEP);
+    if (ret == EXIST)
+    {
+      ret = FAILURE;
+    }
+  }
+  return ret;
+}		/* -----  end of function cmdAppendData  ----- */
+
 /* ===  FUNCTION  ==============================================================
  *         Name:  cmdProcessAppend
  *  Description:  This function processes the given command
@@ -338,9 +413,8 @@ int cmdProcessAppend (const string &input, string &output)
   }
 
   // We have everything to do the actual processing.
-  string value;
-  if (dbGetElement(store.key, store.flags, store.casStr, value, store.expTime)
-      != SUCCESS)
+  ret = cmdAppendData(store, false);
+  if (ret == NOT_EXIST)
   {
     // Data is not already present
     cout<<"Could not append element"<<endl;
@@ -350,13 +424,7 @@ int cmdProcessAppend (const string &input, string &output)
     }
     return 0;
   }
-
-  value.append(store.data);
-  // This makes sure dbInsertElement generates a new cas value
-  store.casStr.clear();
-
-  if (dbInsertElement(store.key, store.flags, store.casStr, value, 
-        store.expTime) == MEMORY_FULL)
+  if (ret == MEMORY_FULL)
   {
     cout<<"Could not append element"<<endl;
     if (store.noreply == false)
@@ -400,9 +468,8 @@ int cmdProcessPrepend (const string &input, string &output)
   }
 
   // We have everything to do the actual processing.
-  string value;
-  if (dbGetElement(store.key, store.flags, store.casStr, value, store.expTime)
-      != SUCCESS)
+  ret = cmdAppendData(store, true);
+  if (ret == NOT_EXIST)
   {
     // Data is not already present
     cout<<"Could not prepend element"<<endl;
@@ -412,13 +479,7 @@ int cmdProcessPrepend (const string &input, string &output)
     }
     return 0;
   }
-
-  store.data.append(value);
-  // This makes sure dbInsertElement generates a new cas value
-  store.casStr.clear();
-
-  if (dbInsertElement(store.key, store.flags, store.casStr, store.data, 
-        store.expTime) == MEMORY_FULL)
+  if (ret == MEMORY_FULL)
   {
     cout<<"Could not prepend element"<<endl;
     if (store.noreply == false)
@@ -457,7 +518,7 @@ int cmdProcessCas (const string &input, string &output)
 
   // We have everything to do the actual processing.
   ret = dbInsertElement(store.key, store.flags, store.casStr, store.data, 
-      store.expTime);
+      store.expTime, store.cost);
   if (ret == MEMORY_FULL)
   {
     cout<<"Could not cas element"<<endl;
@@ -715,22 +776,26 @@ int cmdProcessIncr (const string &input, string &output)
   }
 
   // We have everything to do the actual processing.
-  string storedValue, flags, cas;
-  unsigned long int expTime;
-  if (dbGetElement(key, flags, cas, storedValue, expTime)
-      != SUCCESS)
+  unsigned long long int inputValue, result;
+  try
   {
-    // Data is not already present
-    cout<<"Could not incr element"<<endl;
-    if (noreply == false)
+    // stoull would take a sign, leading blanks and trailing junk
+    size_t parsed = 0;
+    if (value.empty() || !isdigit(value[0]))
     {
-      output.assign("NOT_FOUND\r\n");
+      throw invalid_argument(value);
+    }
+    inputValue = stoull(value, &parsed, 10);
+    if (parsed != value.size())
+    {
+      throw invalid_argument(value);
     }
+  }
+  catch (const logic_error& le)
+  {
+    output.assign("CLIENT_ERROR invalid numeric delta argument\r\n");
     return 0;
   }
-
-  unsigned long int inputValue = stoul(value, nullptr, 10);
-  unsigned long int oldValue = stoul(storedValue, nullptr, 10);
   if (inputValue == 0)
   {
     if (noreply == false)
@@ -739,13 +804,28 @@ int cmdProcessIncr (const string &input, string &output)
       return 0;
     }
   }
-  inputValue += oldValue;
-  storedValue.assign(to_string(inputValue));
-  // This makes sure dbInsertElement generates a new cas value
-  cas.clear();
 
-  if (dbInsertElement(key, flags, cas, storedValue, expTime) 
-      == MEMORY_FULL)
+  int ret = dbIncrElement(key, inputValue, false, result);
+  if (ret == NOT_EXIST)
+  {
+    // Data is not already present
+    cout<<"Could not incr element"<<endl;
+    if (noreply == false)
+    {
+      output.assign("NOT_FOUND\r\n");
+    }
+    return 0;
+  }
+  if (ret == FAILURE)
+  {
+    if (noreply == false)
+    {
+      output.assign("CLIENT_ERROR cannot increment or decrement non-numeric "
+          "value\r\n");
+    }
+    return 0;
+  }
+  if (ret == MEMORY_FULL)
   {
     cout<<"Could not incr element"<<endl;
     if (noreply == false)
@@ -755,10 +835,9 @@ int cmdProcessIncr (const string &input, string &output)
     }
     return 0;
   }
-
   if (noreply == false)
   {
-    output.assign(storedValue);
+    output.assign(to_string(result));
     output.append("\r\n");
   }
   return 0;
@@ -811,22 +890,26 @@ int cmdProcessDecr (const string &input, string &output)
   }
 
   // We have everything to do the actual processing.
-  string storedValue, flags, cas;
-  unsigned long int expTime;
-  if (dbGetElement(key, flags, cas, storedValue, expTime)
-      != SUCCESS)
+  unsigned long long int inputValue, result;
+  try
   {
-    // Data is not already present
-    cout<<"Could not decr element"<<endl;
-    if (noreply == false)
+    // stoull would take a sign, leading blanks and trailing junk
+    size_t parsed = 0;
+    if (value.empty() || !isdigit(value[0]))
     {
-      output.assign("NOT_FOUND\r\n");
+      throw invalid_argument(value);
     }
+    inputValue = stoull(value, &parsed, 10);
+    if (parsed != value.size())
+    {
+      throw invalid_argument(value);
+    }
+  }
+  catch (const logic_error& le)
+  {
+    output.assign("CLIENT_ERROR invalid numeric delta argument\r\n");
     return 0;
   }
-
-  unsigned long int inputValue = stoul(value, nullptr, 10);
-  unsigned long int oldValue = stoul(storedValue, nullptr, 10);
   if (inputValue == 0)
   {
     if (noreply == false)
@@ -835,20 +918,28 @@ int cmdProcessDecr (const string &input, string &output)
       return 0;
     }
   }
-  if (oldValue <= inputValue)
+
+  int ret = dbIncrElement(key, inputValue, true, result);
+  if (ret == NOT_EXIST)
   {
-    inputValue = 0;
+    // Data is not already present
+    cout<<"Could not decr element"<<endl;
+    if (noreply == false)
+    {
+      output.assign("NOT_FOUND\r\n");
+    }
+    return 0;
   }
-  else
+  if (ret == FAILURE)
   {
-    inputValue = oldValue - inputValue;
+    if (noreply == false)
+    {
+      output.assign("CLIENT_ERROR cannot increment or decrement non-numeric "
+          "value\r\n");
+    }
+    return 0;
   }
-  storedValue.assign(to_string(inputValue));
-  // This makes sure dbInsertElement generates a new cas value
-  cas.clear();
-
-  if (dbInsertElement(key, flags, cas, storedValue, expTime) 
-      == MEMORY_FULL)
+  if (ret == MEMORY_FULL)
   {
     cout<<"Could not decr element"<<endl;
     if (noreply == false)
@@ -860,7 +951,7 @@ int cmdProcessDecr (const string &input, string &output)
   }
   if (noreply == false)
   {
-    output.assign(storedValue);
+    output.assign(to_string(result));
     output.append("\r\n");
   }
   return 0;
@@ -922,9 +1013,8 @@ int cmdProcessTouch (const string &input, string &output)
     }
   }
   // We have everything to do the actual processing.
-  string cas, flags, value;
-  unsigned long int expiry;
-  if (dbGetElement(key, flags, cas, value, expiry) != SUCCESS)
+  int ret = dbTouchElement(key, expTime);
+  if (ret == NOT_EXIST)
   {
     // Data is not already present
     cout<<"Could not touch element"<<endl;
@@ -934,9 +1024,7 @@ int cmdProcessTouch (const string &input, string &output)
     }
     return 0;
   }
-
-  // Cas is not updated, but just checked against the prev value
-  if (dbInsertElement(key, flags, cas, value, expTime) == MEMORY_FULL)
+  if (ret == MEMORY_FULL)
   {
     cout<<"Could not touch element"<<endl;
     if (noreply == false)
@@ -1132,33 +1220,68 @@ int cmdProcessStats (const string &input, string &output)
   // We have everything to do the actual processing.
   if (input.size() > 7)
   {
-    output.assign("CLIENT_ERROR quit has no options\r\n");
+    output.assign("CLIENT_ERROR stats has no options\r\n");
     return 0;
   }
-  output.assign("STAT ");
-  output.assign("pid ");
-  output.assign(to_string(getpid()));
-  output.assign("\r\n");
+  output.append("STAT ");
+  output.append("pid ");
+  output.append(to_string(getpid()));
+  output.append("\r\n");
 
-  output.assign("STAT ");
-  output.assign("time ");
-  time_t curSystemTime;
-  time(&curSystemTime);
-  output.assign(to_string(curSystemTime));
-  output.assign("\r\n");
+  output.append("STAT ");
+  output.append("time ");
+  output.append(to_string(dbClockToAbsolute(dbClockNow())));
+  output.append("\r\n");
 
-  output.assign("STAT ");
-  output.assign("version ");
-  output.assign(VERSION_STRING);
+  output.append("STAT ");
+  output.append("version ");
+  output.append(VERSION_NUMBER);
+  output.append("\r\n");
 
-  output.assign("STAT ");
-  output.assign("threads ");
-  output.assign(to_string(gServWorkerThreads));
-  output.assign("\r\n");
-  output.assign("END\r\n");
+  output.append("STAT ");
+  output.append("threads ");
+  output.append(to_string(gServWorkerThreads));
+  output.append("\r\n");
+
+  dbAppendStats(output);
+  output.append("END\r\n");
   return 0;
 }		/* -----  end of function cmdProcessStats  ----- */
 
+/* ===  FUNCTION  ==============================================================
+ *         Name:  cmdProcessSnapshot
+ *  Description:  This function processes the given command. The reply is only
+ *                sent once the snapshot is written
+ * =============================================================================
+ */
+int cmdProcessSnapshot (const string &input, string &output)
+{
+  if (input.size() > 10)
+  {
+    output.assign("CLIENT_ERROR snapshot has no options\r\n");
+    return 0;
+  }
+  if (gServSnapshotFile.empty())
+  {
+    output.assign("SERVER_ERROR no snapshot file given with -S\r\n");
+    return 0;
+  }
+  int ret = dbSnapshotWrite();
+  if (ret == SUCCESS)
+  {
+    output.assign("OK\r\n");
+  }
+  else if (ret == EXIST)
+  {
+    output.assign("SERVER_ERROR snapshot in progress\r\n");
+  }
+  else
+  {
+    output.assign("SERVER_ERROR snapshot could not be written\r\n");
+  }
+  return 0;
+}		/* -----  end of function cmdProcessSnapshot  ----- */
+
 /* ===  FUNCTION  ==============================================================
  *         Name:  cmdProcessCommand
  *  Description:  This is the entry point. Upon receiving a command from the
@@ -1169,7 +1292,7 @@ int cmdProcessStats (const string &input, string &output)
 int cmdProcessCommand (string &input, string &output)
 {
   // Get the command word from the input
-  unsigned int nextSpace = input.find(' ');
+  string::size_type nextSpace = input.find(' ');
   if (nextSpace == string::npos)
   {
     // Commands like stats, version and quit
@@ -1237,6 +1360,10 @@ int cmdProcessCommand (string &input, string &output)
   {
     return cmdProcessFlushAll (input, output);
   }
+  else if (command.compare("snapshot") == 0)
+  {
+    return cmdProcessSnapshot (input, output);
+  }
   else if (command.compare("version") == 0)
   {
     return cmdProcessVersion (input, output);
@@ -10,12 +10,85 @@
 #include "../inc/sinc.h"
 
 // GLOBALS
-atomic<unsigned int> gServMemLimit;
+atomic<unsigned long int> gServMemLimit;
 atomic<unsigned int> gServListPort;
 atomic<unsigned int> gServWorkerThreads;
+atomic<unsigned int> gServBumpWindow;
+atomic<unsigned int> gServEvictPolicy;
+atomic<unsigned int> gServCrawlerBudget;
+atomic<unsigned int> gServStorageEngine;
+atomic<unsigned int> gServEvictWatermark;
+atomic<bool> gServHugePages;
+atomic<bool> gServLockMemory;
+string gServMemFile;
+string gServSnapshotFile;
+atomic<unsigned int> gServSnapshotInterval;
+string gServExtPath;
+atomic<unsigned long int> gServExtSize;
+atomic<unsigned int> gServExtMinValue;
+atomic<unsigned int> gServCompressMin;
+atomic<unsigned int> gServChunkMin;
+atomic<unsigned int> gServStripeRate;
 // GLOBALS END
 
 
+/* ===  FUNCTION  ==============================================================
+ *         Name:  parseMemLimit
+ *  Description:  Parses a memory size given in megabytes, or with a k, m or g
+ *                suffix for kilobytes, megabytes or gigabytes. Returns 0 if
+ *                it is not a valid size
+ * =============================================================================
+ */
+static unsigned long int parseMemLimit (const char *arg)
+{
+  char *end;
+  errno = 0;
+  unsigned long int size = strtoul(arg, &end, 10);
+  if ((end == arg) || (errno != 0))
+  {
+    return 0;
+  }
+  unsigned int shift;
+  switch (tolower(*end))
+  {
+    case 'k':
+      shift = 10;
+      end++;
+      break;
+    case 'g':
+      shift = 30;
+      end++;
+      break;
+    case 'm':
+      end++;
+      // Fall through
+    case '\0':
+      shift = 20;
+      break;
+    default:
+      return 0;
+  }
+  if ((*end != '\0') || (size > (ULONG_MAX >> shift)))
+  {
+    return 0;
+  }
+  return size << shift;
+}		/* -----  end of function parseMemLimit  ----- */
+
+/* ===  FUNCTION  ==============================================================
+ *         Name:  shutdownMain
+ *  Description:  Waits for SIGINT or SIGTERM and shuts the server down
+ *                cleanly, leaving the items behind in the arena file
+ * =============================================================================
+ */
+static void shutdownMain (sigset_t signals)
+{
+  int signalNum;
+  sigwait(&signals, &signalNum);
+  dbShutdown();
+  _exit(EXIT_SUCCESS);
+}		/* -----  end of function shutdownMain  ----- */
+
 /* ===  FUNCTION  ==============================================================
  *         Name:  main
  *  Description:  The command line parameters are parsed and the server is 
@@ -27,6 +100,19 @@ int main (int argc, char *argv[])
   gServMemLimit = SERV_DEF_MEM_LIMIT;
   gServListPort = SERV_DEF_LIST_PORT;          
   gServWorkerThreads = SERV_DEF_WORKER_THREADS;
+  gServBumpWindow = SERV_DEF_BUMP_WINDOW;
+  gServEvictPolicy = DB_POLICY_LRU;
+  gServCrawlerBudget = SERV_DEF_CRAWLER_BUDGET;
+  gServStorageEngine = DB_ENGINE_LRU;
+  gServEvictWatermark = SERV_DEF_EVICT_WATERMARK;
+  gServHugePages = false;
+  gServLockMemory = false;
+  gServSnapshotInterval = 0;
+  gServExtSize = SERV_DEF_EXT_SIZE;
+  gServExtMinValue = SERV_DEF_EXT_MIN_VALUE;
+  gServCompressMin = 0;
+  gServChunkMin = SERV_DEF_CHUNK_MIN;
+  gServStripeRate = SERV_DEF_STRIPE_RATE;
 
   if (argc != 1) {
     // Optional parameters have been specified
@@ -37,6 +123,116 @@ int main (int argc, char *argv[])
         return EXIT_FAILURE;
       }
       switch (argv[optionIndex][1]) {
+        case 'm':
+          optionIndex++;
+          if ((optionIndex >= argc) || (argv[optionIndex][0] == '-')) {
+            cout<<"Option to -m missing"<<endl;
+            return EXIT_FAILURE;
+          }
+          gServMemLimit = parseMemLimit(argv[optionIndex]);
+          if (gServMemLimit == 0) {
+            cout<<"Invalid memory limit "<<argv[optionIndex]<<endl;
+            return EXIT_FAILURE;
+          }
+          optionIndex++;
+          break;
+        case 'R':
+          optionIndex++;
+          if ((optionIndex >= argc) || (argv[optionIndex][0] == '-')) {
+            cout<<"Option to -R missing"<<endl;
+            return EXIT_FAILURE;
+          }
+          gServMemFile = argv[optionIndex];
+          optionIndex++;
+          break;
+        case 'S':
+          optionIndex++;
+          if ((optionIndex >= argc) || (argv[optionIndex][0] == '-')) {
+            cout<<"Option to -S missing"<<endl;
+            return EXIT_FAILURE;
+          }
+          gServSnapshotFile = argv[optionIndex];
+          optionIndex++;
+          break;
+        case 'P':
+          optionIndex++;
+          if ((optionIndex >= argc) || (argv[optionIndex][0] == '-')) {
+            cout<<"Option to -P missing"<<endl;
+            return EXIT_FAILURE;
+          }
+          gServSnapshotInterval = atoi(argv[optionIndex]);
+          optionIndex++;
+          break;
+        case 'E':
+          optionIndex++;
+          if ((optionIndex >= argc) || (argv[optionIndex][0] == '-')) {
+            cout<<"Option to -E missing"<<endl;
+            return EXIT_FAILURE;
+          }
+          gServExtPath = argv[optionIndex];
+          optionIndex++;
+          break;
+        case 'X':
+          optionIndex++;
+          if ((optionIndex >= argc) || (argv[optionIndex][0] == '-')) {
+            cout<<"Option to -X missing"<<endl;
+            return EXIT_FAILURE;
+          }
+          gServExtSize = parseMemLimit(argv[optionIndex]);
+          if (gServExtSize == 0) {
+            cout<<"Invalid external storage size "<<argv[optionIndex]<<endl;
+            return EXIT_FAILURE;
+          }
+          optionIndex++;
+          break;
+        case 'V':
+          optionIndex++;
+          if ((optionIndex >= argc) || (argv[optionIndex][0] == '-')) {
+            cout<<"Option to -V missing"<<endl;
+            return EXIT_FAILURE;
+          }
+          gServExtMinValue = atoi(argv[optionIndex]);
+          optionIndex++;
+          break;
+        case 'z':
+          optionIndex++;
+          if ((optionIndex >= argc) || (argv[optionIndex][0] == '-')) {
+            cout<<"Option to -z missing"<<endl;
+            return EXIT_FAILURE;
+          }
+          gServCompressMin = atoi(argv[optionIndex]);
+          optionIndex++;
+          break;
+        case 'C':
+          optionIndex++;
+          if ((optionIndex >= argc) || (argv[optionIndex][0] == '-')) {
+            cout<<"Option to -C missing"<<endl;
+            return EXIT_FAILURE;
+          }
+          gServChunkMin = atoi(argv[optionIndex]);
+          optionIndex++;
+          break;
+        case 'H':
+          optionIndex++;
+          if ((optionIndex >= argc) || (argv[optionIndex][0] == '-')) {
+            cout<<"Option to -H missing"<<endl;
+            return EXIT_FAILURE;
+          }
+          gServStripeRate = atoi(argv[optionIndex]);
+          if (gServStripeRate > USHRT_MAX) {
+            cout<<"-H can be at most "<<USHRT_MAX<<endl;
+            return EXIT_FAILURE;
+          }
+          optionIndex++;
+          break;
+        case 'L':
+          optionIndex++;
+          gServHugePages = true;
+          break;
+        case 'k':
+          optionIndex++;
+          gServLockMemory = true;
+          break;
         case 't':
           optionIndex++;
           if ((optionIndex >= argc) || (argv[optionIndex][0] == '-')) {
@@ -56,11 +252,115 @@ int main (int argc, char *argv[])
           gServListPort = atoi(argv[optionIndex]);
           optionIndex++;
           break;
+        case 'b':
+          optionIndex++;
+          if ((optionIndex >= argc) || (argv[optionIndex][0] == '-')) {
+            cout<<"Option to -b missing"<<endl;
+            return EXIT_FAILURE;
+          }
+          gServBumpWindow = atoi(argv[optionIndex]);
+          optionIndex++;
+          break;
+        case 'c':
+          optionIndex++;
+          if ((optionIndex >= argc) || (argv[optionIndex][0] == '-')) {
+            cout<<"Option to -c missing"<<endl;
+            return EXIT_FAILURE;
+          }
+          gServCrawlerBudget = atoi(argv[optionIndex]);
+          if (gServCrawlerBudget > 100) {
+            gServCrawlerBudget = 100;
+          }
+          optionIndex++;
+          break;
+        case 'w':
+          optionIndex++;
+          if ((optionIndex >= argc) || (argv[optionIndex][0] == '-')) {
+            cout<<"Option to -w missing"<<endl;
+            return EXIT_FAILURE;
+          }
+          gServEvictWatermark = atoi(argv[optionIndex]);
+          if (gServEvictWatermark > 100) {
+            gServEvictWatermark = 100;
+          }
+          optionIndex++;
+          break;
+        case 'e':
+          optionIndex++;
+          if ((optionIndex >= argc) || (argv[optionIndex][0] == '-')) {
+            cout<<"Option to -e missing"<<endl;
+            return EXIT_FAILURE;
+          }
+          if (strcmp(argv[optionIndex], "lru") == 0) {
+            gServEvictPolicy = DB_POLICY_LRU;
+          } else if (strcmp(argv[optionIndex], "tinylfu") == 0) {
+            gServEvictPolicy = DB_POLICY_TINYLFU;
+          } else if (strcmp(argv[optionIndex], "2q") == 0) {
+            gServEvictPolicy = DB_POLICY_2Q;
+          } else if (strcmp(argv[optionIndex], "arc") == 0) {
+            gServEvictPolicy = DB_POLICY_ARC;
+          } else if (strcmp(argv[optionIndex], "sampled") == 0) {
+            gServEvictPolicy = DB_POLICY_SAMPLED;
+          } else if (strcmp(argv[optionIndex], "gdsf") == 0) {
+            gServEvictPolicy = DB_POLICY_GDSF;
+          } else {
+            cout<<"Unknown eviction policy "<<argv[optionIndex]<<endl;
+            return EXIT_FAILURE;
+          }
+          optionIndex++;
+          break;
+        case 's':
+          optionIndex++;
+          if ((optionIndex >= argc) || (argv[optionIndex][0] == '-')) {
+            cout<<"Option to -s missing"<<endl;
+            return EXIT_FAILURE;
+          }
+          if (strcmp(argv[optionIndex], "lru") == 0) {
+            gServStorageEngine = DB_ENGINE_LRU;
+          } else if (strcmp(argv[optionIndex], "segment") == 0) {
+            gServStorageEngine = DB_ENGINE_SEGMENT;
+          } else {
+            cout<<"Unknown storage engine "<<argv[optionIndex]<<endl;
+            return EXIT_FAILURE;
+          }
+          optionIndex++;
+          break;
         case 'h':
           optionIndex++;
           cout<<"The options are:"<<endl;
+          cout<<"-m The memory limit in megabytes (default 64), or with a k, "
+            "m or g suffix"<<endl;
+          cout<<"-L Reserve item memory up front on huge pages"<<endl;
+          cout<<"-k Reserve item memory up front and lock it in memory"<<endl;
+          cout<<"-R Keep item memory in the given file, on tmpfs or "
+            "hugetlbfs, and pick the items up again after a restart"<<endl;
+          cout<<"-S The snapshot file, loaded at startup and written by the "
+            "snapshot command"<<endl;
+          cout<<"-P Seconds between snapshots, 0 (default) takes them only "
+            "when asked for"<<endl;
+          cout<<"-E Move cold values to files in the given directory on a "
+            "local disk"<<endl;
+          cout<<"-X The size of the files of -E, like -m (default 1g)"<<endl;
+          cout<<"-V Smallest value in bytes moved to the files of -E "
+            "(default 512)"<<endl;
+          cout<<"-z Compress values of at least the given number of bytes, "
+            "0 (default) turns it off"<<endl;
+          cout<<"-C Keep values longer than the given number of bytes in "
+            "chunks (default 524288), 0 turns it off"<<endl;
+          cout<<"-H Incrs of a counter within a second after which it is "
+            "striped over the cores if any found its lock held (default "
+            "1000), 0 turns it off"<<endl;
           cout<<"-t The maximum number of worker threads"<<endl;
           cout<<"-p The listening port number"<<endl;
+          cout<<"-b Seconds within which a read item is not moved up the "
+            "LRU again"<<endl;
+          cout<<"-e The eviction policy: lru (default), tinylfu, 2q, arc, "
+            "sampled or gdsf"<<endl;
+          cout<<"-c Percentage of a CPU the expiry crawler may use, 0 turns "
+            "it off"<<endl;
+          cout<<"-s The storage engine: lru (default) or segment"<<endl;
+          cout<<"-w Percentage of the memory limit the background evictor "
+            "keeps memory use under, 100 turns it off"<<endl;
           return EXIT_SUCCESS;
       }
     }
@@ -82,8 +382,44 @@ int main (int argc, char *argv[])
   cout<<str<<endl;
 */
 
+  if ((gServSnapshotInterval > 0) && gServSnapshotFile.empty())
+  {
+    cout<<"-P needs a snapshot file given with -S"<<endl;
+    return EXIT_FAILURE;
+  }
+  if (!gServExtPath.empty() && (gServStorageEngine == DB_ENGINE_SEGMENT))
+  {
+    cout<<"-E is not supported by the segment engine"<<endl;
+    return EXIT_FAILURE;
+  }
+  if ((gServCompressMin > 0) && (gServStorageEngine == DB_ENGINE_SEGMENT))
+  {
+    cout<<"-z is not supported by the segment engine"<<endl;
+    return EXIT_FAILURE;
+  }
+  if (!gServMemFile.empty())
+  {
+    if (gServStorageEngine == DB_ENGINE_SEGMENT)
+    {
+      cout<<"-R is not supported by the segment engine"<<endl;
+      return EXIT_FAILURE;
+    }
+    // Blocked before any thread starts, so that only shutdownMain gets them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    thread(shutdownMain, signals).detach();
+  }
+
   // All optional parameters have been parsed. Time to set up the server.
   // This function will not return
+  dbClockInit();
+  dbArenaInit();
+  dbExtInit();
+  dbInit();
+  dbSnapshotInit();
   socketMain();
   return EXIT_SUCCESS;
 }				/* ----------  end of function main  ---------- */
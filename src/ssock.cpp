@@ -30,10 +30,13 @@ static mutex threadNotifyMutex;
  */
 void sockHandleIncomingConn (int sockFd)
 {
-  char   buffer[80];
+  char   buffer[SERV_RECV_BUFFER];
   int close_conn = FALSE;
   int readMore = 0;
-  unsigned int pos = 0;
+  string::size_type pos = 0;
+  // Where the search for the end of a line resumes. Bytes before it have
+  // been looked at already, which matters for values of many megabytes
+  string::size_type searchPos = 0;
   string data;
   string output;
   string persistentData;
@@ -54,6 +57,7 @@ void sockHandleIncomingConn (int sockFd)
     if (!persistentData.empty())
     {
       persistFlag = true;
+      searchPos = data.size();
       data.append(persistentData);
       persistentData.clear();
     }
@@ -84,11 +88,13 @@ void sockHandleIncomingConn (int sockFd)
       /* Data was received                          */
       /**********************************************/
 
+      // A \r may have been the last byte looked at
+      searchPos = (data.size() > 0) ? (data.size() - 1) : 0;
       data.append(buffer, rc);
       readMore -= rc; // If readMore was initially 0, it will now be -ve
     }
-    unsigned int oldPos = pos + 2;
-    pos = data.find("\r\n", oldPos);
+    string::size_type oldPos = pos + 2;
+    pos = data.find("\r\n", max(oldPos, searchPos));
     if (pos == string::npos)
     {
       // Cannot find an endline, have to read more from the input stream